@@ -0,0 +1,2463 @@
+// Headless benchmarks for TranslucentTB. Nothing in here touches the real desktop,
+// so they run anywhere a C++ compiler does, and always produce the same numbers.
+//
+// Usage: Benchmarks [name...]
+//        Benchmarks --replay FILE
+// Without arguments, every benchmark runs. --replay runs a trace recorded with
+// TranslucentTB.exe --record FILE through the classification and taskbar logic. Output is CSV on stdout, one table per
+// benchmark, each starting with its own header line, so runs on different commits
+// can be diffed or loaded into a spreadsheet.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <functional>
+#include <map>
+#include <new>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../TranslucentTB/classificationworker.hpp"
+#include "../TranslucentTB/decisiontrace.hpp"
+#include "../TranslucentTB/eventloop.hpp"
+#include "../TranslucentTB/exclusionmatcher.hpp"
+#include "../TranslucentTB/exclusionparser.hpp"
+#include "../TranslucentTB/maximisedindex.hpp"
+#include "../TranslucentTB/metrics.hpp"
+#include "../TranslucentTB/simulatedbackend.hpp"
+#include "../TranslucentTB/simulatedeventsource.hpp"
+#include "../TranslucentTB/taskbarcontroller.hpp"
+#include "../TranslucentTB/tracerecorder.hpp"
+#include "../TranslucentTB/tracereplay.hpp"
+#include "../TranslucentTB/windowclassifier.hpp"
+
+const std::uint64_t MINUTE = 60 * 1000;
+
+int failures = 0; // Benchmarks that check something count here when it doesn't hold, for the exit code
+
+double ElapsedNs(std::chrono::steady_clock::time_point start)
+{
+	return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+#pragma region allocation counting
+
+// Every heap allocation made by the process goes through here. Atomic, for the
+// benchmarks that run a classification worker.
+std::atomic<unsigned long long> allocations;
+
+// All kept out of line: inlined into their callers, GCC sees malloc() paired with
+// operator delete, or operator new with free(), and warns with -Wmismatched-new-delete.
+#if defined(__GNUC__)
+#define NOT_INLINED __attribute__((noinline))
+#else
+#define NOT_INLINED
+#endif
+
+NOT_INLINED void *operator new(std::size_t size)
+{
+	allocations++;
+	if (void *p = std::malloc(size ? size : 1))
+	{
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+NOT_INLINED void *operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+NOT_INLINED void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+NOT_INLINED void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+NOT_INLINED void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+NOT_INLINED void operator delete[](void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+#pragma endregion
+
+#pragma region wakeups
+
+// A desktop where someone is actually working: switching windows, maximising and
+// restoring them, dragging them around, opening and closing them.
+void ScriptBusyDesktop(SimulatedEventSource &source, std::uint64_t duration)
+{
+	std::mt19937 rng(42);
+	std::uniform_int_distribution<WINDOWID> window(1, 40);
+
+	for (std::uint64_t t = 0; t < duration; t += 2000)
+	{
+		source.Schedule(t + 500, ForegroundChanged, window(rng));
+	}
+	for (std::uint64_t t = 0; t < duration; t += 5000)
+	{
+		source.Schedule(t + 1200, WindowChanged, window(rng)); // maximise or restore
+	}
+	for (std::uint64_t t = 0; t < duration; t += 7000)
+	{
+		source.Schedule(t + 3000, WindowChanged, 100 + t);     // a window opens...
+		source.Schedule(t + 6500, WindowDestroyed, 100 + t);   // ...and closes
+	}
+	for (std::uint64_t t = 0; t < duration; t += 15000)
+	{
+		// Two second drag, the window reports its location at 60 Hz
+		WINDOWID dragged = window(rng);
+		for (std::uint64_t d = 0; d < 2000; d += 16)
+		{
+			source.Schedule(t + 8000 + d, WindowChanged, dragged);
+		}
+	}
+}
+
+// Someone reading: the desktop is idle but for a window switch every half minute.
+void ScriptReadingDesktop(SimulatedEventSource &source, std::uint64_t duration)
+{
+	for (std::uint64_t t = 0; t < duration; t += 30000)
+	{
+		source.Schedule(t + 29000, ForegroundChanged, 1);
+		source.Schedule(t + 29100, WindowChanged, 1);
+	}
+}
+
+void RunWakeupScenario(const char *name, const char *profile, const SCHEDULEROPTIONS &options, const std::function<void(SimulatedEventSource &, std::uint64_t)> &script)
+{
+	const std::uint64_t MINUTES = 10; // Long enough for the slowest refresh to be reached
+
+	SimulatedEventSource source(MINUTES * MINUTE);
+	if (script)
+	{
+		script(source, MINUTES * MINUTE);
+	}
+
+	// How long the first event waiting for a pass waited
+	std::uint64_t waiting = 0;
+	bool pending = false;
+	std::uint64_t max_latency = 0;
+	Scheduler scheduler(source, options);
+	scheduler.Run(
+		[&](unsigned int)
+		{
+			if (pending && source.Now() - waiting > max_latency)
+			{
+				max_latency = source.Now() - waiting;
+			}
+			pending = false;
+		},
+		[&](const EVENT &)
+		{
+			if (!pending)
+			{
+				waiting = source.Now();
+				pending = true;
+			}
+		});
+
+	const SCHEDULERSTATS &stats = scheduler.Stats();
+	std::printf("wakeups,%s,%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", name, profile,
+		static_cast<unsigned long long>(stats.wakeups / MINUTES),
+		static_cast<unsigned long long>(stats.events / MINUTES),
+		static_cast<unsigned long long>(stats.passes / MINUTES),
+		static_cast<unsigned long long>(stats.refreshes / MINUTES),
+		static_cast<unsigned long long>(stats.passes ? stats.totalinterval / stats.passes : 0),
+		static_cast<unsigned long long>(max_latency),
+		static_cast<unsigned long long>(stats.maxinterval));
+}
+
+// Wakeups per simulated minute of the event-driven scheduler, next to what the old
+// PeekMessage + Sleep(10) loop did (100 wakeups per second, an enumeration every 10th).
+// fixed is the scheduler before it backed off while idle, a refresh every second.
+// max_latency_ms must stay within the latency budget however long the desktop was idle.
+// max_stale_ms is the longest time between two passes: how long a change no event tells
+// about, like a background window maximising on its own, can go unnoticed. The +dynamic
+// profiles are what runs with dynamic-ws on, where the refresh backs off less for that.
+//
+// Only events WaitForEvent returns are counted. On the real desktop the thread also wakes
+// up for hook callbacks HookProc throws away, a message dispatch of a few us each. With
+// the location hook scoped to the foreground process, those are the cursor and caret
+// moves Windows attributes to that process, rather than every one on the desktop.
+void BenchmarkWakeups()
+{
+	const SCHEDULEROPTIONS FIXED = { DEFAULT_MIN_PASS_INTERVAL, DEFAULT_REFRESH_INTERVAL, DEFAULT_REFRESH_INTERVAL };
+	const struct
+	{
+		const char *name;
+		std::function<void(SimulatedEventSource &, std::uint64_t)> script;
+	} SCENARIOS[] = { { "idle", nullptr }, { "reading", &ScriptReadingDesktop }, { "busy", &ScriptBusyDesktop } };
+
+	std::printf("benchmark,scenario,profile,wakeups_per_minute,events_per_minute,passes_per_minute,refreshes_per_minute,average_interval_ms,max_latency_ms,max_stale_ms\n");
+	std::printf("wakeups,polling,polling,%llu,0,%llu,%llu,100,100,100\n", static_cast<unsigned long long>(MINUTE / 10), static_cast<unsigned long long>(MINUTE / 100), static_cast<unsigned long long>(MINUTE / 100));
+	for (const auto &scenario : SCENARIOS)
+	{
+		RunWakeupScenario(scenario.name, "fixed", FIXED, scenario.script);
+		RunWakeupScenario(scenario.name, "balanced", DEFAULT_SCHEDULING, scenario.script);
+		RunWakeupScenario(scenario.name, "minimal", MINIMAL_CPU_SCHEDULING, scenario.script);
+		RunWakeupScenario(scenario.name, "balanced+dynamic", EffectiveScheduling(DEFAULT_SCHEDULING, true), scenario.script);
+		RunWakeupScenario(scenario.name, "minimal+dynamic", EffectiveScheduling(MINIMAL_CPU_SCHEDULING, true), scenario.script);
+	}
+}
+
+#pragma endregion
+
+#pragma region maximised
+
+struct SIMULATEDWINDOW
+{
+	MONITORID monitor;
+	bool maximised;
+	bool visible;
+};
+
+// Same answer a full EnumWindows pass would give.
+std::vector<std::pair<WINDOWID, MONITORID>> EnumerateQualifying(const std::vector<SIMULATEDWINDOW> &windows)
+{
+	std::vector<std::pair<WINDOWID, MONITORID>> qualifying;
+	for (size_t i = 0; i < windows.size(); i++)
+	{
+		if (windows[i].maximised && windows[i].visible)
+		{
+			qualifying.push_back(std::make_pair(static_cast<WINDOWID>(i + 1), windows[i].monitor));
+		}
+	}
+	return qualifying;
+}
+
+void RunMaximisedScenario(size_t window_count)
+{
+	const int MONITORS = 4;
+	const int EVENTS = 200000;
+	const int CHECK_EVERY = 5000;
+
+	std::mt19937 rng(7);
+	std::vector<SIMULATEDWINDOW> windows(window_count);
+	for (SIMULATEDWINDOW &window : windows)
+	{
+		window = { static_cast<MONITORID>(rng() % MONITORS + 1), rng() % 10 == 0, rng() % 4 != 0 };
+	}
+
+	MaximisedWindowIndex index;
+	index.Reconcile(EnumerateQualifying(windows));
+
+	// Random window lifecycle events, each followed by the single window update a pass would do
+	double event_ns = 0;
+	size_t corrections = 0;
+	for (int i = 1; i <= EVENTS; i++)
+	{
+		size_t target = rng() % window_count;
+		SIMULATEDWINDOW &window = windows[target];
+		switch (rng() % 3)
+		{
+		case 0: window.maximised = !window.maximised; break;
+		case 1: window.visible = !window.visible; break;
+		case 2: window.monitor = static_cast<MONITORID>(rng() % MONITORS + 1); break;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		index.Update(static_cast<WINDOWID>(target + 1), window.maximised && window.visible, window.monitor);
+		event_ns += ElapsedNs(start);
+
+		if (i % CHECK_EVERY == 0)
+		{
+			// The index must agree with a full enumeration at all times
+			corrections += index.Reconcile(EnumerateQualifying(windows));
+		}
+	}
+
+	// What every event used to cost: enumerating every window
+	const int PASSES = 50;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < PASSES; i++)
+	{
+		index.Reconcile(EnumerateQualifying(windows));
+	}
+	double pass_ns = ElapsedNs(start) / PASSES;
+
+	std::printf("maximised,%zu,%.1f,%.1f,%zu\n", window_count, event_ns / EVENTS, pass_ns, corrections);
+}
+
+// Cost of keeping the per-monitor maximised window index up to date, one event at a
+// time, against a full enumeration. Corrections must be 0: the index never disagrees
+// with a full enumeration of the simulated desktop.
+void BenchmarkMaximised()
+{
+	std::printf("benchmark,windows,ns_per_event,ns_per_full_enumeration,corrections\n");
+	RunMaximisedScenario(1000);
+	RunMaximisedScenario(5000);
+	RunMaximisedScenario(10000);
+}
+
+#pragma endregion
+
+#pragma region desktop
+
+// What every taskbar should show, worked out from the simulated desktop directly.
+ACCENTPOLICY ExpectedPolicy(SimulatedBackend &backend, const OPTIONS &options, WINDOWID taskbar, const std::vector<WINDOWID> &windows, const std::vector<bool> &excluded)
+{
+	MONITORID monitor = backend.GetWindowMonitor(taskbar);
+	for (size_t i = 0; i < windows.size(); i++)
+	{
+		WINDOWID window = windows[i];
+		if (!excluded[i] && backend.IsWindow(window) && backend.IsWindowMaximised(window) && backend.IsWindowVisible(window) &&
+			backend.IsWindowOnCurrentDesktop(window) && backend.GetWindowMonitor(window) == monitor)
+		{
+			return { options.dynamicws_state, 2, options.color, 0 };
+		}
+	}
+	return { options.taskbar_appearance, 2, options.color, 0 };
+}
+
+void RunDesktopScenario(int monitor_count, size_t window_count)
+{
+	const int STEPS = 20000;
+	const int CHECK_EVERY = 100;
+	const int EVENTS_PER_PASS = 8;
+
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, DynamicWsMaximised };
+	EXCLUSIONRULES rules;
+	rules.exes.push_back(L"excluded.exe");
+	rules.titles.push_back(L"Private");
+	std::shared_ptr<const ExclusionMatcher> exclusions = std::make_shared<const ExclusionMatcher>(rules, FoldClassNames | FoldExeNames);
+
+	std::mt19937 rng(11);
+	SimulatedBackend backend;
+	for (int i = 0; i < monitor_count; i++)
+	{
+		backend.AddMonitor();
+	}
+	backend.AddProcess(1, L"explorer.exe");
+	backend.AddProcess(2, L"Excluded.exe");
+
+	std::vector<WINDOWID> windows;
+	std::vector<bool> excluded;
+	std::vector<bool> excludedexe;
+	for (size_t i = 0; i < window_count; i++)
+	{
+		bool exclude = rng() % 20 == 0;
+		MONITORID monitor = backend.Monitors()[rng() % monitor_count];
+		windows.push_back(backend.AddWindow(L"CabinetWClass", exclude && rng() % 2 ? L"Private browsing" : L"Documents", exclude ? 2 : 1, monitor));
+		excluded.push_back(exclude);
+		excludedexe.push_back(exclude);
+	}
+
+	WindowClassifier classifier(backend, exclusions);
+	TaskbarController controller(backend, options);
+	controller.RefreshHandles();
+	controller.Pass(PassSettings, *classifier.Classify(PassSettings, 0, options.dynamicws, options.dynamicstart), 0);
+
+	std::vector<EVENT> events;
+	backend.TakeEvents(events);
+
+	size_t checks = 0;
+	size_t mismatches = 0;
+	std::uint64_t now = 0;
+	double pass_ns = 0;
+	int passes = 0;
+	for (int step = 1; step <= STEPS; step++)
+	{
+		size_t target = rng() % window_count;
+		WINDOWID window = windows[target];
+		switch (rng() % 9)
+		{
+		case 0: case 1: backend.Maximise(window); break;
+		case 2: case 3: backend.Restore(window); break;
+		case 4: backend.Move(window, backend.Monitors()[rng() % monitor_count]); break;
+		case 5: if (rng() % 2) { backend.Hide(window); } else { backend.Show(window); } break;
+		case 6: backend.SetForeground(window); break;
+		case 7:
+			// Windows get closed and new ones opened
+			backend.Destroy(window);
+			windows[target] = backend.AddWindow(L"Notepad", L"Untitled", 1, backend.Monitors()[rng() % monitor_count]);
+			excluded[target] = false;
+			excludedexe[target] = false;
+			break;
+		case 8:
+		{
+			// Browsers rename their window as tabs change, which can flip the verdict
+			bool priv = rng() % 4 == 0;
+			backend.SetTitle(window, priv ? L"Private browsing" : L"Documents");
+			excluded[target] = excludedexe[target] || priv;
+			break;
+		}
+		}
+
+		if (step % EVENTS_PER_PASS == 0)
+		{
+			now += DEFAULT_MIN_PASS_INTERVAL;
+			backend.TakeEvents(events);
+
+			auto start = std::chrono::steady_clock::now();
+			for (const EVENT &ev : events)
+			{
+				classifier.OnEvent(ev);
+			}
+			controller.Pass(PassWindows, *classifier.Classify(PassWindows, now, options.dynamicws, options.dynamicstart), now);
+			pass_ns += ElapsedNs(start);
+			passes++;
+		}
+
+		if (step % CHECK_EVERY == 0)
+		{
+			for (MONITORID monitor : backend.Monitors())
+			{
+				WINDOWID taskbar = backend.TaskbarOf(monitor);
+				ACCENTPOLICY applied;
+				checks++;
+				if (!backend.AppliedPolicy(taskbar, applied) || applied != ExpectedPolicy(backend, options, taskbar, windows, excluded))
+				{
+					mismatches++;
+				}
+			}
+		}
+	}
+
+	const VERDICTCACHESTATS &verdicts = classifier.VerdictCacheStats();
+	unsigned long long lookups = verdicts.hits + verdicts.revalidations + verdicts.misses;
+	std::printf("desktop,%d,%zu,%d,%.1f,%zu,%zu,%.1f\n", monitor_count, window_count, passes, pass_ns / passes, checks, mismatches,
+		lookups ? 100.0 * (verdicts.hits + verdicts.revalidations) / lookups : 0.0);
+}
+
+// Drives the real taskbar logic against a simulated desktop, and checks what ends up
+// on every taskbar against what should be there. Mismatches must be 0.
+void BenchmarkDesktop()
+{
+	std::printf("benchmark,monitors,windows,passes,ns_per_pass,checks,mismatches,verdict_hit_pct\n");
+	RunDesktopScenario(1, 100);
+	RunDesktopScenario(4, 1000);
+	RunDesktopScenario(8, 5000);
+}
+
+#pragma endregion
+
+#pragma region pipeline
+
+enum RULEMIX { NoRules, TitleHeavy, ExeHeavy };
+
+const char *RuleMixName(RULEMIX mix)
+{
+	switch (mix)
+	{
+	case TitleHeavy: return "title";
+	case ExeHeavy: return "exe";
+	default: return "none";
+	}
+}
+
+// Nine out of ten rules are of the heavy kind. About one window in fifty matches a title
+// rule, and one process in fifty an executable rule, whatever the number of rules.
+EXCLUSIONRULES MakeRules(size_t count, RULEMIX mix)
+{
+	EXCLUSIONRULES rules;
+	for (size_t i = 0; i < count; i++)
+	{
+		bool title = (mix == TitleHeavy) == (i % 10 != 0);
+		if (title)
+		{
+			rules.titles.push_back(L"Private " + std::to_wstring(i));
+		}
+		else
+		{
+			rules.exes.push_back(L"tool" + std::to_wstring(i) + L".exe");
+		}
+	}
+	rules.classes.push_back(L"Progman"); // Every real exclusion file has a few of these
+	return rules;
+}
+
+struct PIPELINERESULT
+{
+	int ticks;
+	double ns;
+	unsigned long long allocations;
+	unsigned long long calls;
+};
+
+unsigned long long TotalCalls(const BACKENDCALLS &calls)
+{
+	return calls.enumerations + calls.windowqueries + calls.stringqueries + calls.processqueries + calls.snapshots + calls.desktopqueries + calls.compositions;
+}
+
+void RunPipelineScenario(int monitor_count, size_t window_count, size_t rule_count, RULEMIX mix)
+{
+	const int PROCESSES = 200;
+	const int CHANGES_PER_TICK = 16;
+	const double MIN_NS = 100e6; // Keep going for at least 100 ms of ticks...
+	const int MIN_TICKS = 5;     // ...and at least this many
+
+	std::mt19937 rng(3);
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, DynamicWsMaximised };
+	EXCLUSIONRULES rules = MakeRules(rule_count, mix);
+	std::shared_ptr<const ExclusionMatcher> exclusions = std::make_shared<const ExclusionMatcher>(rules, FoldClassNames | FoldExeNames);
+
+	SimulatedBackend backend;
+	for (int i = 0; i < monitor_count; i++)
+	{
+		backend.AddMonitor();
+	}
+	for (int pid = 1; pid <= PROCESSES; pid++)
+	{
+		backend.AddProcess(pid, pid % 50 == 0 && rule_count ? L"tool" + std::to_wstring(rng() % rule_count) + L".exe" : L"app" + std::to_wstring(pid) + L".exe");
+	}
+
+	std::vector<WINDOWID> windows;
+	for (size_t i = 0; i < window_count; i++)
+	{
+		std::wstring title = i % 50 == 0 && rule_count ? L"Private " + std::to_wstring(rng() % rule_count) + L" - Browser" : L"Document " + std::to_wstring(i) + L" - Editor";
+		WINDOWID window = backend.AddWindow(L"ApplicationFrameWindow", title, rng() % PROCESSES + 1, backend.Monitors()[rng() % monitor_count]);
+		if (rng() % 8 == 0)
+		{
+			backend.Maximise(window);
+		}
+		windows.push_back(window);
+	}
+
+	WindowClassifier classifier(backend, exclusions);
+	TaskbarController controller(backend, options);
+	controller.RefreshHandles();
+	controller.Pass(PassSettings, *classifier.Classify(PassSettings, 0, options.dynamicws, options.dynamicstart), 0); // Warm up the process cache
+	std::vector<EVENT> events;
+	backend.TakeEvents(events);
+
+	// full: everything is enumerated and classified again, like after a settings or monitor change.
+	// event: a few windows changed since the last tick, the common case.
+	for (int kind = 0; kind < 2; kind++)
+	{
+		PIPELINERESULT result = {};
+		std::uint64_t now = 0;
+		while (result.ns < MIN_NS || result.ticks < MIN_TICKS)
+		{
+			unsigned int reason = PassSettings;
+			if (kind == 1)
+			{
+				for (int i = 0; i < CHANGES_PER_TICK; i++)
+				{
+					WINDOWID window = windows[rng() % windows.size()];
+					switch (rng() % 3)
+					{
+					case 0: backend.Maximise(window); break;
+					case 1: backend.Restore(window); break;
+					case 2: backend.Move(window, backend.Monitors()[rng() % monitor_count]); break;
+					}
+				}
+				reason = PassWindows;
+			}
+			backend.TakeEvents(events);
+			now += DEFAULT_MIN_PASS_INTERVAL; // Includes the periodic full enumeration, as in real use
+
+			backend.ResetCalls();
+			unsigned long long before = allocations;
+			auto start = std::chrono::steady_clock::now();
+			for (const EVENT &ev : events)
+			{
+				classifier.OnEvent(ev);
+			}
+			controller.Pass(reason, *classifier.Classify(reason, now, options.dynamicws, options.dynamicstart), now);
+			result.ns += ElapsedNs(start);
+			result.allocations += allocations - before;
+			result.calls += TotalCalls(backend.Calls());
+			result.ticks++;
+		}
+
+		std::printf("pipeline,%d,%zu,%zu,%s,%s,%d,%.0f,%.1f,%.1f\n", monitor_count, window_count, rule_count, RuleMixName(mix), kind ? "event" : "full",
+			result.ticks, result.ns / result.ticks,
+			static_cast<double>(result.allocations) / result.ticks,
+			static_cast<double>(result.calls) / result.ticks);
+	}
+}
+
+// The whole decision pipeline, from events to SetAccentPolicy, over a matrix of desktop
+// sizes and exclusion rule sets. Per tick: wall time, heap allocations, and calls into
+// the backend (each one is at least a system call on the real desktop).
+void BenchmarkPipeline()
+{
+	const int MONITORS[] = { 1, 4, 8 };
+	const size_t WINDOWS[] = { 50, 1000, 10000 };
+	const size_t RULES[] = { 0, 100, 5000 };
+
+	std::printf("benchmark,monitors,windows,rules,mix,tick,ticks,ns_per_tick,allocations_per_tick,backend_calls_per_tick\n");
+	for (int monitors : MONITORS)
+	{
+		for (size_t windows : WINDOWS)
+		{
+			for (size_t rules : RULES)
+			{
+				if (rules == 0)
+				{
+					RunPipelineScenario(monitors, windows, rules, NoRules);
+					continue;
+				}
+				RunPipelineScenario(monitors, windows, rules, TitleHeavy);
+				RunPipelineScenario(monitors, windows, rules, ExeHeavy);
+			}
+		}
+	}
+}
+
+#pragma endregion
+
+#pragma region steady
+
+// Allocations in one mode, after warming up: none is the expected answer.
+unsigned long long RunSteadyScenario(int monitor_count, size_t window_count, DYNAMICWSMODE mode, bool dynamicstart)
+{
+	const int PROCESSES = 40;
+	const int WARMUP_TICKS = 5000;
+	const int TICKS = 10000;
+	const int CHANGES_PER_TICK = 6;
+	const size_t TITLES = 16; // Renames go round these, so every title has been seen before
+
+	std::mt19937 rng(19);
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, mode };
+	std::shared_ptr<const ExclusionMatcher> exclusions = std::make_shared<const ExclusionMatcher>(MakeRules(100, TitleHeavy), FoldClassNames | FoldExeNames);
+
+	SimulatedBackend backend;
+	for (int i = 0; i < monitor_count; i++)
+	{
+		backend.AddMonitor();
+	}
+	for (int pid = 1; pid <= PROCESSES; pid++)
+	{
+		backend.AddProcess(pid, pid % 10 == 0 ? L"tool" + std::to_wstring(pid) + L".exe" : L"app" + std::to_wstring(pid) + L".exe");
+	}
+
+	std::vector<std::wstring> titles;
+	for (size_t i = 0; i < TITLES; i++)
+	{
+		titles.push_back(i % 4 == 0 ? L"Private " + std::to_wstring(i) + L" - Browser" : L"Document " + std::to_wstring(i) + L" - Editor");
+	}
+
+	std::vector<WINDOWID> windows;
+	for (size_t i = 0; i < window_count; i++)
+	{
+		WINDOWID window = backend.AddWindow(L"ApplicationFrameWindow", titles[i % TITLES], rng() % PROCESSES + 1, backend.Monitors()[rng() % monitor_count]);
+		backend.SetRect(window, { 100, 100, 900, 700 });
+		// Already as the script leaves them on average, so only the warm up sees the desktop grow
+		if (rng() % 2 == 0)
+		{
+			backend.Maximise(window);
+		}
+		backend.MoveToDesktop(window, rng() % 3);
+		windows.push_back(window);
+	}
+
+	MetricsRegistry metrics; // Counting and tracing must not allocate either
+	DecisionTrace decisions;
+	WindowClassifier classifier(backend, exclusions);
+	classifier.SetMetrics(&metrics);
+	classifier.SetDecisionTrace(&decisions);
+	TaskbarController controller(backend, options);
+	controller.SetMetrics(&metrics);
+	controller.SetDecisionTrace(&decisions);
+	controller.RefreshHandles();
+	std::vector<EVENT> events;
+	events.reserve(1024); // The script's events, not the pass's allocations
+
+	unsigned long long counted = 0;
+	std::uint64_t now = 0;
+	for (int tick = 0; tick < WARMUP_TICKS + TICKS; tick++)
+	{
+		unsigned int reason = tick == 0 ? PassSettings : PassWindows;
+		for (int i = 0; i < CHANGES_PER_TICK; i++)
+		{
+			WINDOWID window = windows[rng() % windows.size()];
+			switch (rng() % 8)
+			{
+			case 0: backend.Maximise(window); break;
+			case 1: backend.Restore(window); break;
+			case 2: backend.Move(window, backend.Monitors()[rng() % monitor_count]); break;
+			case 3:
+			{
+				int top = rng() % 800; // Dragged, sometimes over the taskbar
+				backend.SetRect(window, { 100, top, 900, top + 300 });
+				break;
+			}
+			case 4: backend.SetForeground(window); break;
+			case 5: backend.SetTitle(window, titles[rng() % TITLES]); break;
+			case 6: backend.MoveToDesktop(window, rng() % 3); break;
+			case 7:
+				if (rng() % 16 == 0)
+				{
+					backend.SwitchDesktop(rng() % 3);
+				}
+				break;
+			}
+		}
+		backend.TakeEvents(events);
+		now += DEFAULT_MIN_PASS_INTERVAL; // Includes the periodic full enumeration
+
+		unsigned long long before = allocations;
+		for (const EVENT &ev : events)
+		{
+			classifier.OnEvent(ev);
+		}
+		controller.Pass(reason, *classifier.Classify(reason, now, options.dynamicws, dynamicstart, mode), now);
+		if (tick >= WARMUP_TICKS)
+		{
+			counted += allocations - before;
+		}
+	}
+
+	ARENASTATS arena = classifier.ArenaStats();
+	std::printf("steady,%d,%zu,%s,%s,%d,%llu,%.3f,%llu,%zu,%s\n", monitor_count, window_count,
+		mode == DynamicWsGeometry ? "geometry" : "maximised", dynamicstart ? "yes" : "no",
+		TICKS, counted, static_cast<double>(counted) / TICKS,
+		arena.grows, arena.capacity, counted ? "NO" : "yes");
+	return counted;
+}
+
+// Heap allocations made by the pipeline once it has seen the desktop: windows maximised,
+// moved, dragged, renamed, focused, sent to other virtual desktops, and the periodic full
+// enumerations. All of it must come from memory kept from earlier passes, the exit code
+// is non zero otherwise.
+void BenchmarkSteady()
+{
+	const int MONITORS[] = { 1, 4 };
+	const size_t WINDOWS[] = { 50, 1000 };
+
+	unsigned long long total = 0;
+	std::printf("benchmark,monitors,windows,mode,dynamicstart,ticks,allocations,allocations_per_tick,arena_grows,arena_bytes,zero\n");
+	for (int monitors : MONITORS)
+	{
+		for (size_t windows : WINDOWS)
+		{
+			total += RunSteadyScenario(monitors, windows, DynamicWsMaximised, false);
+			total += RunSteadyScenario(monitors, windows, DynamicWsMaximised, true);
+			total += RunSteadyScenario(monitors, windows, DynamicWsGeometry, false);
+		}
+	}
+	if (total)
+	{
+		failures++;
+	}
+}
+
+#pragma endregion
+
+#pragma region worker
+
+void RunWorkerScenario(int monitor_count, size_t window_count)
+{
+	const int TICKS = 200;
+	const int CHANGES_PER_TICK = 16;
+	const int FULL_EVERY = 10; // Like a settings or monitor change
+
+	std::mt19937 rng(5);
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, DynamicWsMaximised };
+	EXCLUSIONRULES rules = MakeRules(100, ExeHeavy);
+	std::shared_ptr<const ExclusionMatcher> exclusions = std::make_shared<const ExclusionMatcher>(rules, FoldClassNames | FoldExeNames);
+
+	SimulatedBackend backend;
+	for (int i = 0; i < monitor_count; i++)
+	{
+		backend.AddMonitor();
+	}
+	backend.AddProcess(1, L"app.exe");
+
+	std::vector<WINDOWID> windows;
+	for (size_t i = 0; i < window_count; i++)
+	{
+		windows.push_back(backend.AddWindow(L"ApplicationFrameWindow", L"Document", 1, backend.Monitors()[rng() % monitor_count]));
+	}
+
+	WindowClassifier classifier(backend, exclusions);
+	TaskbarController controller(backend, options);
+	controller.RefreshHandles();
+	ClassificationWorker worker(classifier, nullptr);
+	worker.Start();
+
+	std::vector<EVENT> events;
+	double handoff_ns = 0;
+	double handoff_max_ns = 0;
+	for (int tick = 1; tick <= TICKS; tick++)
+	{
+		for (int i = 0; i < CHANGES_PER_TICK; i++)
+		{
+			WINDOWID window = windows[rng() % windows.size()];
+			if (rng() % 2) { backend.Maximise(window); } else { backend.Restore(window); }
+		}
+		backend.TakeEvents(events);
+		unsigned int reason = tick % FULL_EVERY ? PassWindows : PassSettings;
+
+		// All the UI thread does for a pass, the rest happens on the worker
+		auto start = std::chrono::steady_clock::now();
+		for (const EVENT &ev : events)
+		{
+			worker.Post(ev);
+		}
+		controller.Prepare(reason);
+		worker.Request(reason, tick * DEFAULT_MIN_PASS_INTERVAL, options.dynamicws, options.dynamicstart);
+		double handoff = ElapsedNs(start);
+		handoff_ns += handoff;
+		handoff_max_ns = handoff > handoff_max_ns ? handoff : handoff_max_ns;
+
+		worker.Wait(); // The desktop can't change while it is being classified
+		controller.Apply(*worker.Latest(), tick * DEFAULT_MIN_PASS_INTERVAL);
+	}
+	worker.Stop();
+
+	WORKERSTATS stats = worker.Stats();
+	const APPLYSTATS &applied = controller.ApplyStats();
+	std::printf("worker,%d,%zu,%d,%.0f,%.0f,%.0f,%llu,%llu\n", monitor_count, window_count, TICKS,
+		handoff_ns / TICKS, handoff_max_ns,
+		static_cast<double>(applied.total_ns) / applied.applies, applied.max_ns,
+		stats.maxclassify_us);
+}
+
+// Time the UI thread spends per pass once classification runs on a worker: handing
+// events and the request over, then applying the published state. Neither should grow
+// with the number of windows; only the worker's own time does. With a single CPU the
+// handoff maximum also counts the worker being scheduled in as soon as it is woken up,
+// which TranslucentTB avoids by running it below normal priority.
+void BenchmarkWorker()
+{
+	const size_t WINDOWS[] = { 100, 1000, 10000, 50000 };
+
+	std::printf("benchmark,monitors,windows,ticks,ui_handoff_ns,ui_handoff_max_ns,ui_apply_ns,ui_apply_max_ns,worker_max_us\n");
+	for (size_t windows : WINDOWS)
+	{
+		RunWorkerScenario(4, windows);
+	}
+}
+
+#pragma endregion
+
+#pragma region transitions
+
+struct TRANSITIONSCENARIO
+{
+	const char *name;
+	TRANSITIONOPTIONS transitions;
+};
+
+void RunTransitionScenario(const TRANSITIONSCENARIO &scenario)
+{
+	const std::uint64_t DURATION = 10 * MINUTE;
+	const std::uint64_t STEP = 10;
+
+	std::mt19937 rng(17);
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, scenario.transitions, DynamicWsMaximised };
+	std::shared_ptr<const ExclusionMatcher> exclusions;
+
+	SimulatedBackend backend;
+	MONITORID monitor = backend.AddMonitor();
+	backend.AddProcess(1, L"app.exe");
+	WINDOWID real = backend.AddWindow(L"Notepad", L"Untitled", 1, monitor);        // Maximised and restored for good
+	WINDOWID dragged = backend.AddWindow(L"CabinetWClass", L"Documents", 1, monitor); // Dragged along the top of the screen
+	WINDOWID animated = backend.AddWindow(L"Chrome_WidgetWin_1", L"Browser", 1, monitor);
+
+	WindowClassifier classifier(backend, exclusions);
+	TaskbarController controller(backend, options);
+	controller.RefreshHandles();
+	std::shared_ptr<const DESKTOPSTATE> state = classifier.Classify(PassSettings, 0, options.dynamicws, options.dynamicstart);
+	std::uint64_t due = controller.Pass(PassSettings, *state, 0);
+	backend.ResetCalls();
+
+	std::vector<EVENT> events;
+	bool pending = false;
+	std::uint64_t last_pass = 0;
+	std::uint64_t drag_flip = 0;
+	std::uint64_t real_change = 0; // When the real window last changed, 0 once the taskbar caught up
+	double latency_ms = 0;
+	std::uint64_t latency_max_ms = 0;
+	int real_changes = 0;
+	for (std::uint64_t now = STEP; now < DURATION; now += STEP)
+	{
+		// Every 10 s: a real change, then a 2 s drag snapping in and out of maximised,
+		// then a window animating through the maximised state.
+		std::uint64_t phase = now % 10000;
+		if (phase == 1000)
+		{
+			if (backend.IsWindowMaximised(real)) { backend.Restore(real); } else { backend.Maximise(real); }
+			real_change = now;
+			real_changes++;
+		}
+		else if (phase >= 5000 && phase < 7000 && now >= drag_flip)
+		{
+			if (backend.IsWindowMaximised(dragged)) { backend.Restore(dragged); } else { backend.Maximise(dragged); }
+			drag_flip = now + 60 + rng() % 200;
+		}
+		else if (phase == 7000)
+		{
+			backend.Restore(dragged);
+		}
+		else if (phase == 8000)
+		{
+			backend.Maximise(animated);
+		}
+		else if (phase == 8120)
+		{
+			backend.Restore(animated);
+		}
+
+		// Same timing as the real scheduler and the transition timer
+		backend.TakeEvents(events);
+		pending = pending || !events.empty();
+		for (const EVENT &ev : events)
+		{
+			classifier.OnEvent(ev);
+		}
+		if (pending && now >= last_pass + DEFAULT_MIN_PASS_INTERVAL)
+		{
+			state = classifier.Classify(PassWindows, now, options.dynamicws, options.dynamicstart);
+			due = controller.Pass(PassWindows, *state, now);
+			pending = false;
+			last_pass = now;
+		}
+		else if (due && now >= due)
+		{
+			due = controller.Apply(*state, now);
+		}
+
+		TASKBARSTATE expected = backend.IsWindowMaximised(real) ? WindowMaximised : Normal;
+		if (real_change && phase < 5000 && controller.Taskbars().State(0) == expected)
+		{
+			std::uint64_t latency = now - real_change;
+			latency_ms += latency;
+			latency_max_ms = latency > latency_max_ms ? latency : latency_max_ms;
+			real_change = 0;
+		}
+	}
+
+	const TRANSITIONSTATS &stats = controller.TransitionStats();
+	std::printf("transitions,%s,%llu,%llu,%llu,%.1f,%llu,%.1f,%llu\n", scenario.name,
+		backend.Calls().compositions, stats.transitions, stats.suppressed,
+		stats.delayed ? static_cast<double>(stats.delay_ms) / stats.delayed : 0.0, stats.maxdelay_ms,
+		latency_ms / real_changes, static_cast<unsigned long long>(latency_max_ms));
+}
+
+// Ten simulated minutes of windows being dragged across the top of the screen and
+// animating through the maximised state, in between real maximise/restore changes.
+// Compositions are SetAccentPolicy calls, each one makes DWM recompose the taskbar;
+// real_latency is how long the taskbar took to follow a real change.
+void BenchmarkTransitions()
+{
+	const TRANSITIONSCENARIO SCENARIOS[] = {
+		{ "unfiltered", { 0, 0, LeadingEdge } },
+		{ "default", DEFAULT_TRANSITIONS },
+		{ "trailing-200", { 0, 200, TrailingEdge } },
+		{ "dwell-500", { 500, 0, LeadingEdge } }
+	};
+
+	std::printf("benchmark,filter,compositions,transitions,suppressed,avg_delay_ms,max_delay_ms,real_latency_ms,real_latency_max_ms\n");
+	for (const TRANSITIONSCENARIO &scenario : SCENARIOS)
+	{
+		RunTransitionScenario(scenario);
+	}
+}
+
+#pragma endregion
+
+#pragma region taskbars
+
+// How taskbars used to be kept: a map by handle, each one scanning the DESKTOPSTATE
+// for its monitor.
+struct LEGACYTASKBAR
+{
+	MONITORID hmon;
+	TASKBARSTATE state;
+};
+
+void RunTaskbarLookupScenario(int monitor_count)
+{
+	const int PASSES = 1000000 / monitor_count; // About the same number of taskbar updates for every size
+
+	SimulatedBackend backend;
+	for (int i = 0; i < monitor_count; i++)
+	{
+		backend.AddMonitor();
+	}
+	std::vector<WINDOWID> handles;
+	std::vector<MONITORID> monitors;
+	backend.FindTaskbars(handles);
+	for (WINDOWID handle : handles)
+	{
+		monitors.push_back(backend.GetWindowMonitor(handle));
+	}
+
+	// Every other monitor has a maximised window, in the opposite order to the taskbars
+	DESKTOPSTATE states[2] = {};
+	for (int i = monitor_count - 1; i >= 0; i--)
+	{
+		states[i % 2].monitors.push_back({ backend.Monitors()[i], WindowMaximised });
+	}
+
+	std::map<WINDOWID, LEGACYTASKBAR> legacy;
+	for (std::size_t i = 0; i < handles.size(); i++)
+	{
+		legacy[handles[i]] = { monitors[i], Normal };
+	}
+	TaskbarTable table;
+	table.Update(handles, monitors);
+
+	unsigned long long comparisons = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < PASSES; i++)
+	{
+		for (auto &taskbar : legacy)
+		{
+			taskbar.second.state = Normal;
+			for (const MONITORSTATE &entry : states[i % 2].monitors)
+			{
+				comparisons++;
+				if (entry.monitor == taskbar.second.hmon)
+				{
+					taskbar.second.state = entry.state;
+					break;
+				}
+			}
+		}
+	}
+	double legacy_ns = ElapsedNs(start);
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < PASSES; i++)
+	{
+		table.SetTargets(states[i % 2]); // One lookup for each monitor the state lists
+	}
+	double table_ns = ElapsedNs(start);
+
+	int mismatches = 0;
+	for (const DESKTOPSTATE &state : states)
+	{
+		table.SetTargets(state);
+		for (std::size_t row = 0; row < table.Size(); row++)
+		{
+			mismatches += table.Target(row) != state.StateOf(table.Monitor(row));
+		}
+	}
+
+	double updates = static_cast<double>(PASSES) * monitor_count;
+	double lookups = static_cast<double>(PASSES / 2) * (states[0].monitors.size() + states[1].monitors.size());
+	std::printf("taskbars,lookup,%d,%.2f,%.2f,%.1f,%.1f,%d\n", monitor_count,
+		comparisons / updates, lookups / updates,
+		legacy_ns / updates, table_ns / updates, mismatches);
+}
+
+// Monitors unplugged and plugged back while windows are maximised: every taskbar must
+// follow, and the ones that stayed keep their row.
+void RunTaskbarHotplugScenario()
+{
+	const int CHANGES = 200;
+
+	std::mt19937 rng(23);
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, DynamicWsMaximised };
+	std::shared_ptr<const ExclusionMatcher> exclusions;
+
+	SimulatedBackend backend;
+	for (int i = 0; i < 4; i++)
+	{
+		backend.AddMonitor();
+	}
+	backend.AddProcess(1, L"app.exe");
+	std::vector<WINDOWID> windows;
+	for (int i = 0; i < 40; i++)
+	{
+		windows.push_back(backend.AddWindow(L"Notepad", L"Untitled", 1, backend.Monitors()[rng() % 4]));
+	}
+
+	WindowClassifier classifier(backend, exclusions);
+	TaskbarController controller(backend, options);
+	std::vector<EVENT> events;
+	std::uint64_t now = 0;
+	auto pass = [&](unsigned int reason)
+	{
+		backend.TakeEvents(events);
+		for (const EVENT &ev : events)
+		{
+			classifier.OnEvent(ev);
+		}
+		now += DEFAULT_MIN_PASS_INTERVAL;
+		controller.Pass(reason, *classifier.Classify(reason, now, options.dynamicws, options.dynamicstart), now);
+	};
+	pass(PassMonitors);
+	backend.ResetCalls();
+
+	int mismatches = 0;
+	for (int change = 0; change < CHANGES; change++)
+	{
+		// Unplug a secondary monitor, or plug a new one in, between 2 and 8 of them
+		std::size_t count = backend.Monitors().size();
+		if (count == 8 || (count > 2 && rng() % 2))
+		{
+			backend.RemoveMonitor(backend.Monitors()[1 + rng() % (count - 1)]);
+		}
+		else
+		{
+			backend.AddMonitor();
+		}
+		for (int i = 0; i < 4; i++)
+		{
+			WINDOWID window = windows[rng() % windows.size()];
+			if (rng() % 2) { backend.Maximise(window); } else { backend.Restore(window); }
+		}
+		pass(PassMonitors);
+
+		for (std::size_t i = 0; i < backend.Monitors().size(); i++)
+		{
+			MONITORID monitor = backend.Monitors()[i];
+			bool maximised = false;
+			for (WINDOWID window : windows)
+			{
+				maximised = maximised || (backend.IsWindowMaximised(window) && backend.GetWindowMonitor(window) == monitor);
+			}
+			std::size_t row = controller.Taskbars().Find(monitor);
+			mismatches += row == NO_TASKBAR || controller.Taskbars().Handle(row) != backend.TaskbarOf(monitor) ||
+				controller.Taskbars().State(row) != (maximised ? WindowMaximised : Normal);
+		}
+	}
+
+	const TASKBARTABLESTATS &stats = controller.Taskbars().Stats();
+	std::printf("taskbars,hotplug,%d,%llu,%llu,%llu,%.1f,%d\n", CHANGES,
+		stats.added, stats.removed, stats.moved,
+		static_cast<double>(backend.Calls().compositions) / CHANGES, mismatches);
+}
+
+// Explorer putting its own accent back on a taskbar without anything else happening: a
+// windows pass leaves the cached policy alone, the next refresh must set it again. The
+// exit code is non zero otherwise.
+void RunTaskbarResetScenario()
+{
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, DynamicWsMaximised };
+	std::shared_ptr<const ExclusionMatcher> exclusions;
+
+	SimulatedBackend backend;
+	for (int i = 0; i < 2; i++)
+	{
+		backend.AddMonitor();
+	}
+	backend.AddProcess(1, L"app.exe");
+	backend.Maximise(backend.AddWindow(L"Notepad", L"Untitled", 1, backend.Monitors()[0]));
+
+	WindowClassifier classifier(backend, exclusions);
+	TaskbarController controller(backend, options);
+	std::vector<EVENT> events;
+	std::uint64_t now = 0;
+	auto pass = [&](unsigned int reason)
+	{
+		backend.TakeEvents(events);
+		for (const EVENT &ev : events)
+		{
+			classifier.OnEvent(ev);
+		}
+		now += DEFAULT_MIN_PASS_INTERVAL;
+		controller.Pass(reason, *classifier.Classify(reason, now, options.dynamicws, options.dynamicstart), now);
+	};
+	pass(PassMonitors);
+
+	WINDOWID taskbar = backend.TaskbarOf(backend.Monitors()[0]);
+	ACCENTPOLICY policy;
+	backend.ResetAccent(taskbar);
+	backend.ResetCalls();
+	pass(PassWindows);
+	unsigned long long windows = backend.Calls().compositions;
+
+	backend.ResetCalls();
+	pass(PassRefresh);
+	unsigned long long refresh = backend.Calls().compositions;
+	bool restored = backend.AppliedPolicy(taskbar, policy) && policy.nAccentState == ACCENT_ENABLE_BLURBEHIND;
+
+	std::printf("taskbars,reset,%llu,%llu,%s\n", windows, refresh, restored ? "yes" : "NO");
+	if (!restored)
+	{
+		failures++;
+	}
+}
+
+// Telling every taskbar what a DESKTOPSTATE says, with 1 to 16 monitors: comparisons
+// per taskbar made by the old map scanning the state for its monitor, next to hash
+// lookups made by the taskbar table, and the time per taskbar of each. Then monitors
+// coming and going, checked against the simulated desktop, and a taskbar Explorer reset.
+void BenchmarkTaskbars()
+{
+	const int MONITORS[] = { 1, 2, 4, 8, 16 };
+
+	std::printf("benchmark,scenario,monitors,map_comparisons_per_taskbar,table_lookups_per_taskbar,map_ns_per_taskbar,table_ns_per_taskbar,mismatches\n");
+	for (int monitors : MONITORS)
+	{
+		RunTaskbarLookupScenario(monitors);
+	}
+	std::printf("benchmark,scenario,display_changes,taskbars_added,taskbars_removed,taskbars_moved,compositions_per_change,mismatches\n");
+	RunTaskbarHotplugScenario();
+	std::printf("benchmark,scenario,compositions_windows_pass,compositions_refresh_pass,restored\n");
+	RunTaskbarResetScenario();
+}
+
+#pragma endregion
+
+#pragma region geometry
+
+// A random place for a window on a monitor: mostly floating, sometimes snapped to one
+// half of the screen, sized down to the taskbar by hand, or borderless full screen.
+WINDOWRECT RandomRect(std::mt19937 &rng)
+{
+	const int WORK_BOTTOM = SIMULATED_MONITOR_HEIGHT - SIMULATED_TASKBAR_HEIGHT;
+	const int HALF = SIMULATED_MONITOR_WIDTH / 2;
+	switch (rng() % 20)
+	{
+	case 0: return { 0, 0, HALF, WORK_BOTTOM };
+	case 1: return { HALF, 0, SIMULATED_MONITOR_WIDTH, WORK_BOTTOM };
+	case 2: { int left = rng() % 1000; return { left, 50 + static_cast<int>(rng() % 300), left + 800, WORK_BOTTOM - static_cast<int>(rng() % 6) }; }
+	case 3: return { 0, 0, SIMULATED_MONITOR_WIDTH, SIMULATED_MONITOR_HEIGHT };
+	default:
+	{
+		int left = rng() % 1200;
+		int top = rng() % 400;
+		return { left, top, left + 300 + static_cast<int>(rng() % 400), top + 200 + static_cast<int>(rng() % 400) };
+	}
+	}
+}
+
+// Which monitors have a window touching their taskbar, looking at every window.
+std::vector<MONITORID> TouchingMonitors(SimulatedBackend &backend, const std::vector<WINDOWID> &windows)
+{
+	std::vector<MONITORID> monitors;
+	for (WINDOWID window : windows)
+	{
+		WINDOWRECT rect, bounds, work;
+		MONITORID monitor = backend.GetWindowMonitor(window);
+		if (backend.IsWindowVisible(window) && backend.GetWindowRect(window, rect) && backend.GetMonitorRects(monitor, bounds, work) &&
+			Intersects(rect, bounds) && rect.bottom >= work.bottom - EDGE_TOLERANCE &&
+			std::find(monitors.begin(), monitors.end(), monitor) == monitors.end())
+		{
+			monitors.push_back(monitor);
+		}
+	}
+	std::sort(monitors.begin(), monitors.end());
+	return monitors;
+}
+
+void RunGeometryScenario(int monitor_count, size_t window_count)
+{
+	const int TICKS = 180; // Stays within CONSISTENCY_INTERVAL, so every pass is driven by events
+	const int CHANGES_PER_TICK = 4;
+	const size_t ACTIVE = 16; // Windows being moved around, the others stay where they are
+	const int CHECK_EVERY = 20; // The brute force check costs more than the whole scenario
+
+	std::mt19937 rng(31);
+	std::shared_ptr<const ExclusionMatcher> exclusions;
+
+	SimulatedBackend backend;
+	for (int i = 0; i < monitor_count; i++)
+	{
+		backend.AddMonitor();
+	}
+	backend.AddProcess(1, L"app.exe");
+
+	std::vector<WINDOWID> windows;
+	for (size_t i = 0; i < window_count; i++)
+	{
+		WINDOWID window = backend.AddWindow(L"ApplicationFrameWindow", L"Document", 1, backend.Monitors()[rng() % monitor_count]);
+		int left = rng() % 1200;
+		int top = rng() % 400;
+		backend.SetRect(window, { left, top, left + 400, top + 300 });
+		windows.push_back(window);
+	}
+
+	// The same desktop, classified by geometry and by maximised state
+	WindowClassifier geometry(backend, exclusions);
+	WindowClassifier maximised(backend, exclusions);
+	std::vector<EVENT> events;
+	backend.TakeEvents(events); // Seen by the full enumerations
+	geometry.Classify(PassSettings, 0, true, false, DynamicWsGeometry);
+	maximised.Classify(PassSettings, 0, true, false, DynamicWsMaximised);
+
+	double event_ns = 0;
+	unsigned long long queries = 0;
+	int mismatches = 0;
+	int covered = 0;
+	int missed = 0;
+	for (int tick = 1; tick <= TICKS; tick++)
+	{
+		for (int i = 0; i < CHANGES_PER_TICK; i++)
+		{
+			WINDOWID window = windows[rng() % ACTIVE];
+			if (rng() % 8 == 0)
+			{
+				if (backend.IsWindowMaximised(window)) { backend.Restore(window); } else { backend.Maximise(window); }
+			}
+			else
+			{
+				backend.SetRect(window, RandomRect(rng));
+			}
+		}
+		backend.TakeEvents(events);
+		std::uint64_t now = tick * DEFAULT_MIN_PASS_INTERVAL;
+
+		backend.ResetCalls();
+		auto start = std::chrono::steady_clock::now();
+		for (const EVENT &ev : events)
+		{
+			geometry.OnEvent(ev);
+		}
+		std::shared_ptr<const DESKTOPSTATE> state = geometry.Classify(PassWindows, now, true, false, DynamicWsGeometry);
+		event_ns += ElapsedNs(start);
+		queries += backend.Calls().windowqueries + backend.Calls().stringqueries + backend.Calls().desktopqueries;
+
+		for (const EVENT &ev : events)
+		{
+			maximised.OnEvent(ev);
+		}
+		std::shared_ptr<const DESKTOPSTATE> old = maximised.Classify(PassWindows, now, true, false, DynamicWsMaximised);
+		for (const MONITORSTATE &monitor : state->monitors)
+		{
+			covered++;
+			missed += old->StateOf(monitor.monitor) != WindowMaximised;
+		}
+
+		if (tick % CHECK_EVERY == 0)
+		{
+			std::vector<MONITORID> expected = TouchingMonitors(backend, windows);
+			std::vector<MONITORID> actual;
+			for (const MONITORSTATE &monitor : state->monitors)
+			{
+				actual.push_back(monitor.monitor);
+			}
+			std::sort(actual.begin(), actual.end());
+			mismatches += actual != expected;
+		}
+	}
+
+	// What checking every window's rectangle costs instead
+	backend.ResetCalls();
+	auto start = std::chrono::steady_clock::now();
+	const int FULL_PASSES = 20;
+	for (int pass = 0; pass < FULL_PASSES; pass++)
+	{
+		geometry.Classify(PassSettings, (TICKS + 1 + pass) * DEFAULT_MIN_PASS_INTERVAL, true, false, DynamicWsGeometry);
+	}
+	double full_ns = ElapsedNs(start) / FULL_PASSES;
+
+	const GEOMETRYINDEXSTATS &stats = geometry.WindowGeometryStats();
+	std::printf("geometry,%d,%zu,%d,%.0f,%.1f,%.0f,%llu,%d,%d,%d\n", monitor_count, window_count, TICKS,
+		event_ns / TICKS, static_cast<double>(queries) / TICKS, full_ns, stats.queries,
+		covered, missed, mismatches);
+}
+
+// A few windows moved, sized, snapped and maximised at random among many that stay put,
+// with dynamic-ws-mode=geometry. The index is updated from events (ns_per_pass) instead
+// of looking at every window's rectangle (full_pass_ns), and checked against doing just
+// that every 20 ticks.
+// missed_by_maximised counts the covered taskbars dynamic-ws-mode=maximised doesn't see.
+void BenchmarkGeometry()
+{
+	const size_t WINDOWS[] = { 100, 1000, 10000, 50000 };
+
+	std::printf("benchmark,monitors,windows,passes,ns_per_pass,queries_per_pass,full_pass_ns,edge_lookups,covered,missed_by_maximised,mismatches\n");
+	for (size_t windows : WINDOWS)
+	{
+		RunGeometryScenario(4, windows);
+	}
+}
+
+#pragma endregion
+
+#pragma region start
+
+// Ten simulated minutes of switching windows, with the Start menu opened every now and
+// then, sometimes in the middle of a window being dragged on the other monitor. Driven
+// by the real Scheduler, so latency_ms is what the throttling adds between the Start
+// menu opening and the pass that sees it. clobbered counts passes where the Start menu
+// made the other monitor's maximised window be forgotten, which it used to do.
+void BenchmarkStart()
+{
+	const std::uint64_t DURATION = 10 * MINUTE;
+
+	std::mt19937 rng(11);
+	std::shared_ptr<const ExclusionMatcher> exclusions;
+
+	SimulatedBackend backend;
+	MONITORID primary = backend.AddMonitor();
+	MONITORID secondary = backend.AddMonitor();
+	backend.AddProcess(1, L"app.exe");
+	backend.AddProcess(2, L"SearchUI.exe");
+	std::vector<WINDOWID> windows;
+	for (int i = 0; i < 20; i++)
+	{
+		windows.push_back(backend.AddWindow(L"Notepad", L"Untitled " + std::to_wstring(i), 1, i % 2 ? secondary : primary));
+	}
+	WINDOWID dragged = backend.AddWindow(L"CabinetWClass", L"Documents", 1, secondary);
+	backend.Maximise(windows[1]); // Stays maximised on the secondary monitor
+	WINDOWID start = backend.AddWindow(L"Windows.UI.Core.CoreWindow", L"Search", 2, primary);
+
+	WindowClassifier classifier(backend, exclusions);
+	std::vector<EVENT> events;
+	backend.TakeEvents(events);
+	classifier.Classify(PassSettings, 0, true, true);
+
+	SimulatedEventSource source(DURATION);
+	std::vector<std::uint64_t> opened;
+	for (std::uint64_t t = 0; t < DURATION; t += 2000)
+	{
+		source.Schedule(t + 500, ForegroundChanged, windows[rng() % windows.size()]);
+	}
+	for (std::uint64_t t = 0; t < DURATION; t += 15000)
+	{
+		for (std::uint64_t d = 0; d < 2000; d += 16)
+		{
+			source.Schedule(t + 8000 + d, WindowChanged, dragged);
+		}
+	}
+	for (std::uint64_t t = 0; t < DURATION; t += 5000)
+	{
+		std::uint64_t open = t + 1000 + rng() % 3000; // Lands in a drag every now and then
+		opened.push_back(open);
+		source.Schedule(open, ForegroundChanged, start);
+		source.Schedule(open + 900, ForegroundChanged, windows[0]);
+	}
+
+	std::uint64_t open_since = 0;
+	unsigned long long opens = 0;
+	unsigned long long clobbered = 0;
+	std::uint64_t latency_ms = 0;
+	std::uint64_t latency_max_ms = 0;
+	bool shown = false;
+	Scheduler scheduler(source, DEFAULT_REFRESH_INTERVAL, DEFAULT_MIN_PASS_INTERVAL);
+	scheduler.Run(
+		[&](unsigned int reason)
+		{
+			std::shared_ptr<const DESKTOPSTATE> state = classifier.Classify(reason, source.Now(), true, true);
+			bool open = state->StateOf(primary) == StartMenuOpen;
+			if (open && !shown)
+			{
+				std::uint64_t latency = source.Now() - open_since;
+				latency_ms += latency;
+				latency_max_ms = latency > latency_max_ms ? latency : latency_max_ms;
+				opens++;
+			}
+			shown = open;
+			clobbered += open && state->StateOf(secondary) != WindowMaximised;
+		},
+		[&](const EVENT &ev)
+		{
+			if (ev.type == ForegroundChanged)
+			{
+				backend.SetForeground(ev.window);
+				open_since = ev.window == start ? source.Now() : open_since;
+			}
+			backend.TakeEvents(events); // Already described by `ev`
+			classifier.OnEvent(ev);
+		});
+
+	const STARTMENUSTATS &stats = classifier.StartMenuStats();
+	const SCHEDULERSTATS &scheduled = scheduler.Stats();
+	std::printf("benchmark,passes,start_opens,detected,avg_latency_ms,max_latency_ms,identifications,resyncs,polled_calls,clobbered\n");
+	std::printf("start,%llu,%zu,%llu,%.1f,%llu,%llu,%llu,%llu,%llu\n",
+		static_cast<unsigned long long>(scheduled.passes), opened.size(), opens,
+		opens ? static_cast<double>(latency_ms) / opens : 0.0, static_cast<unsigned long long>(latency_max_ms),
+		stats.identifications, stats.resyncs, static_cast<unsigned long long>(scheduled.passes) * 3, clobbered);
+}
+
+#pragma endregion
+
+#pragma region fullscreen
+
+// Ten simulated minutes, eight of them with a game filling the primary monitor and, when
+// `both`, a video filling the secondary one. Meanwhile a download renames its window every
+// second and a chat window on the secondary monitor keeps changing. `detect` is whether
+// covered taskbars are parked, as opposed to being kept up to date behind the game.
+void RunFullscreenScenario(bool both, bool detect)
+{
+	const std::uint64_t DURATION = 10 * MINUTE;
+	const std::uint64_t START = MINUTE;
+	const std::uint64_t END = 9 * MINUTE;
+	const WINDOWRECT FULL = { 0, 0, SIMULATED_MONITOR_WIDTH, SIMULATED_MONITOR_HEIGHT };
+
+	std::shared_ptr<const ExclusionMatcher> exclusions;
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, DynamicWsMaximised };
+	SimulatedBackend backend;
+	MONITORID primary = backend.AddMonitor();
+	MONITORID secondary = backend.AddMonitor();
+	backend.AddProcess(1, L"app.exe");
+	for (int i = 0; i < 200; i++)
+	{
+		backend.AddWindow(L"Notepad", L"Untitled " + std::to_wstring(i), 1, i % 2 ? secondary : primary);
+	}
+	WINDOWID download = backend.AddWindow(L"Chrome_WidgetWin_1", L"Downloads", 1, primary);
+	WINDOWID chat = backend.AddWindow(L"Chrome_WidgetWin_1", L"Chat", 1, secondary);
+	WINDOWID game = backend.AddWindow(L"UnityWndClass", L"Game", 1, primary);
+	WINDOWID video = backend.AddWindow(L"Chrome_WidgetWin_1", L"Video", 1, secondary);
+	for (WINDOWID window : { game, video })
+	{
+		backend.SetRect(window, FULL);
+		backend.Hide(window);
+	}
+	backend.SetForeground(download);
+
+	WindowClassifier classifier(backend, exclusions);
+	TaskbarController controller(backend, options);
+	controller.RefreshHandles();
+	std::vector<EVENT> events;
+	backend.TakeEvents(events);
+	controller.Pass(PassSettings, *classifier.Classify(PassSettings, 0, true, false), 0);
+
+	SimulatedEventSource source(DURATION);
+	for (std::uint64_t t = 0; t < DURATION; t += 1000)
+	{
+		source.Schedule(t + 300, WindowRenamed, download);
+	}
+	for (std::uint64_t t = 0; t < DURATION; t += 3000)
+	{
+		source.Schedule(t + 1700, WindowChanged, chat);
+	}
+	source.Schedule(START, ForegroundChanged, game);
+	if (both)
+	{
+		source.Schedule(START + 5000, ForegroundChanged, video);
+		source.Schedule(END - 5000, WindowDestroyed, video);
+	}
+	source.Schedule(END, WindowDestroyed, game);
+
+	std::uint64_t ended = 0;
+	std::uint64_t resume_ms = 0;
+	bool resumed = false;
+	std::vector<WINDOWID> fullscreen;
+	backend.ResetCalls();
+	Scheduler scheduler(source, DEFAULT_SCHEDULING);
+	scheduler.Run(
+		[&](unsigned int reason)
+		{
+			std::shared_ptr<DESKTOPSTATE> state = classifier.Classify(reason, source.Now(), true, false);
+			if (!detect)
+			{
+				state->fullscreen.clear();
+			}
+			controller.Pass(reason, *state, source.Now());
+			if (ended && !resumed && !controller.Taskbars().Parked(controller.Taskbars().Find(primary)))
+			{
+				resume_ms = source.Now() - ended;
+				resumed = true;
+			}
+
+			fullscreen.clear();
+			for (const FULLSCREENWINDOW &entry : state->fullscreen)
+			{
+				fullscreen.push_back(entry.window);
+			}
+			if (controller.AllParked())
+			{
+				scheduler.Park(fullscreen);
+			}
+			else
+			{
+				scheduler.Unpark();
+			}
+		},
+		[&](const EVENT &ev)
+		{
+			if (ev.type == ForegroundChanged)
+			{
+				backend.Show(ev.window);
+				backend.SetForeground(ev.window);
+			}
+			else if (ev.type == WindowDestroyed)
+			{
+				backend.Destroy(ev.window);
+				ended = ev.window == game ? source.Now() : ended;
+			}
+			backend.TakeEvents(events); // Already described by `ev`
+			classifier.OnEvent(ev);
+		});
+
+	const SCHEDULERSTATS &scheduled = scheduler.Stats();
+	const PARKSTATS &parked = controller.ParkStats();
+	std::printf("fullscreen,%s,%s,%llu,%llu,%llu,%.1f,%.1f,%llu,", both ? "both" : "primary", detect ? "park" : "none",
+		static_cast<unsigned long long>(scheduled.passes), TotalCalls(backend.Calls()), backend.Calls().compositions,
+		parked.parked_ms / 1000.0, scheduled.parked_ms / 1000.0, static_cast<unsigned long long>(scheduled.ignored));
+	if (detect)
+	{
+		std::printf("%llu\n", static_cast<unsigned long long>(resume_ms));
+	}
+	else
+	{
+		std::printf("\n"); // Never parked
+	}
+}
+
+// What covered taskbars cost while a game or a video runs fullscreen. taskbars_parked_s
+// adds up every taskbar, loop_parked_s is how long nothing ran at all. resume_ms is how
+// long the primary taskbar took to be looked after again once the game quit, on the
+// simulated clock.
+void BenchmarkFullscreen()
+{
+	std::printf("benchmark,covered,detection,passes,backend_calls,compositions,taskbars_parked_s,loop_parked_s,events_ignored,resume_ms\n");
+	for (bool both : { false, true })
+	{
+		RunFullscreenScenario(both, false);
+		RunFullscreenScenario(both, true);
+	}
+}
+
+#pragma endregion
+
+#pragma region desktops
+
+// Ten minutes of someone who lives in four virtual desktops: a pass every 100 ms while
+// windows are dragged, maximised and restored, a desktop switch every 20 seconds and a
+// window sent to another desktop every 45. uncached_per_min is how many
+// IsWindowOnCurrentDesktop calls (COM round trips on Windows) there would be without
+// DesktopMembershipCache. Mismatches must be 0.
+void BenchmarkDesktops()
+{
+	const std::uint64_t DURATION = 10 * MINUTE;
+	const std::uint64_t TICK = 100;
+	const int DESKTOPS = 4;
+	const size_t WINDOWS = 200;
+
+	std::mt19937 rng(17);
+	std::shared_ptr<const ExclusionMatcher> exclusions;
+
+	SimulatedBackend backend;
+	std::vector<MONITORID> monitors = { backend.AddMonitor(), backend.AddMonitor() };
+	backend.AddProcess(1, L"app.exe");
+	std::vector<WINDOWID> windows;
+	for (size_t i = 0; i < WINDOWS; i++)
+	{
+		backend.SwitchDesktop(i % DESKTOPS); // Opened where it belongs
+		WINDOWID window = backend.AddWindow(L"Notepad", L"Untitled " + std::to_wstring(i), 1, monitors[i % monitors.size()]);
+		if (rng() % 10 < 3)
+		{
+			backend.Maximise(window);
+		}
+		windows.push_back(window);
+	}
+	backend.SwitchDesktop(0);
+
+	WindowClassifier classifier(backend, exclusions);
+	std::vector<EVENT> events;
+	backend.TakeEvents(events);
+	classifier.Classify(PassSettings, 0, true, false);
+
+	size_t passes = 0;
+	size_t mismatches = 0;
+	for (std::uint64_t now = TICK; now <= DURATION; now += TICK)
+	{
+		WINDOWID window = windows[rng() % windows.size()];
+		backend.SetRect(window, RandomRect(rng)); // Dragged
+		if (now % 500 == 0)
+		{
+			WINDOWID toggled = windows[rng() % windows.size()];
+			if (backend.IsWindowMaximised(toggled))
+			{
+				backend.Restore(toggled);
+			}
+			else
+			{
+				backend.Maximise(toggled);
+			}
+		}
+		if (now % 20000 == 0)
+		{
+			backend.SwitchDesktop(rng() % DESKTOPS);
+		}
+		if (now % 45000 == 0)
+		{
+			backend.MoveToDesktop(windows[rng() % windows.size()], rng() % DESKTOPS);
+		}
+
+		backend.TakeEvents(events);
+		unsigned int reason = PassRefresh;
+		for (const EVENT &ev : events)
+		{
+			classifier.OnEvent(ev);
+			reason |= PassWindows;
+		}
+		std::shared_ptr<DESKTOPSTATE> state = classifier.Classify(reason, now, true, false);
+		passes++;
+
+		for (MONITORID monitor : monitors)
+		{
+			bool expected = false;
+			for (WINDOWID candidate : windows)
+			{
+				expected = expected || (backend.IsWindowMaximised(candidate) && backend.IsWindowVisible(candidate) &&
+					backend.IsWindowOnCurrentDesktop(candidate) && backend.GetWindowMonitor(candidate) == monitor);
+			}
+			mismatches += expected != (state->StateOf(monitor) == WindowMaximised);
+		}
+	}
+
+	const DESKTOPCACHESTATS &stats = classifier.DesktopCacheStats();
+	double minutes = static_cast<double>(DURATION) / MINUTE;
+	std::printf("benchmark,windows,desktops,passes,com_calls_per_min,uncached_per_min,switches,moves,mismatches\n");
+	std::printf("desktops,%zu,%d,%zu,%.1f,%.1f,%llu,%llu,%zu\n", WINDOWS, DESKTOPS, passes,
+		stats.queries / minutes, (stats.queries + stats.hits) / minutes, stats.switches, stats.moves, mismatches);
+}
+
+#pragma endregion
+
+#pragma region qualify
+
+struct QUALIFYPROFILE
+{
+	const char *name;
+	double passes[STAGE_COUNT]; // How likely a window is to get through each check
+};
+
+// What the checks cost per window with QualifyPipeline, against the fixed order they had
+// originally (maximised, desktop, visible, excluded), on made up desktops where each check
+// lets a given share of the windows through and the caches answer nine times out of ten.
+// Costs are STAGE_COSTS, the ones the pipeline orders by; order is where it ended up.
+void BenchmarkQualify()
+{
+	const int WINDOWS = 100000;
+	const QUALIFYPROFILE PROFILES[] = {
+		//                maximised, visible, desktop, placed, shell, excluded
+		{ "typical",    { 0.10,      0.30,    0.90,    1.0,    1.0,   0.95 } },
+		{ "hidden",     { 0.30,      0.05,    0.90,    1.0,    1.0,   0.95 } },
+		{ "desktops",   { 0.60,      0.90,    0.10,    1.0,    1.0,   0.95 } },
+		{ "excluded",   { 0.90,      0.90,    0.90,    1.0,    1.0,   0.20 } }
+	};
+	const QUALIFYSTAGE FIXED[] = { StageMaximised, StageDesktop, StageVisible, StageExcluded };
+
+	std::printf("benchmark,profile,fixed_ns_per_window,pipeline_ns_per_window,saved_pct,order\n");
+	for (const QUALIFYPROFILE &profile : PROFILES)
+	{
+		std::mt19937 rng(5);
+		std::uniform_real_distribution<double> chance(0.0, 1.0);
+		QualifyPipeline pipeline({ StageMaximised, StageVisible, StageDesktop, StageExcluded });
+		double fixed = 0;
+		double adaptive = 0;
+		for (int i = 0; i < WINDOWS; i++)
+		{
+			// The same window, whichever order it is looked at in
+			bool passes[STAGE_COUNT];
+			bool cached[STAGE_COUNT];
+			for (int stage = 0; stage < STAGE_COUNT; stage++)
+			{
+				passes[stage] = chance(rng) < profile.passes[stage];
+				cached[stage] = chance(rng) < 0.9;
+			}
+			auto cost = [&](QUALIFYSTAGE stage) { return cached[stage] ? STAGE_COSTS[stage].cached : STAGE_COSTS[stage].uncached; };
+
+			for (QUALIFYSTAGE stage : FIXED)
+			{
+				fixed += cost(stage);
+				if (!passes[stage]) { break; }
+			}
+			pipeline.Evaluate([&](QUALIFYSTAGE stage, bool &answered) { adaptive += cost(stage); answered = cached[stage]; return passes[stage]; });
+		}
+
+		std::string order;
+		for (QUALIFYSTAGE stage : pipeline.Order())
+		{
+			const wchar_t *name = StageName(stage);
+			order += order.empty() ? "" : " ";
+			order += std::string(name, name + std::wcslen(name));
+		}
+		std::printf("qualify,%s,%.0f,%.0f,%.1f,%s\n", profile.name, fixed / WINDOWS, adaptive / WINDOWS,
+			100.0 * (fixed - adaptive) / fixed, order.c_str());
+	}
+}
+
+#pragma endregion
+
+#pragma region replay
+
+void RunReplayScenario(size_t window_count)
+{
+	const int TICKS = 1000;
+	const char *const PATH = "Benchmarks-replay.trace";
+
+	std::mt19937 rng(23);
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, true, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, DynamicWsMaximised };
+	EXCLUSIONRULES rules = MakeRules(50, ExeHeavy);
+	rules.exes.push_back(L"app3.exe"); // Some that match
+	rules.classes.push_back(L"Class7");
+	std::shared_ptr<const ExclusionMatcher> exclusions = std::make_shared<const ExclusionMatcher>(rules, FoldClassNames | FoldExeNames);
+
+	SimulatedBackend backend;
+	for (int i = 0; i < 3; i++)
+	{
+		backend.AddMonitor();
+	}
+	for (unsigned long pid = 1; pid <= 20; pid++)
+	{
+		backend.AddProcess(pid, L"app" + std::to_wstring(pid) + L".exe");
+	}
+
+	std::vector<WINDOWID> windows;
+	for (size_t i = 0; i < window_count; i++)
+	{
+		windows.push_back(backend.AddWindow(L"Class" + std::to_wstring(i % 40), L"Window " + std::to_wstring(i), 1 + rng() % 20, backend.Monitors()[rng() % 3]));
+	}
+	WINDOWID start = backend.AddWindow(L"Windows.UI.Core.CoreWindow", L"Search", 21, backend.Monitors()[0]);
+	backend.AddProcess(21, L"SearchUI.exe");
+
+	// Record a session, keeping a digest of every state it came up with
+	std::FILE *file = std::fopen(PATH, "wb");
+	std::uint64_t digest = 0;
+	unsigned long long events_recorded = 0;
+	TRACESTATS tracestats;
+	{
+		TraceRecorder recorder(backend, file);
+		WindowClassifier classifier(recorder, exclusions);
+		classifier.SetRecorder(&recorder);
+		std::vector<EVENT> events;
+		for (int tick = 1; tick <= TICKS; tick++)
+		{
+			WINDOWID &window = windows[rng() % windows.size()];
+			switch (rng() % 12)
+			{
+			case 0: backend.SetTitle(window, L"Renamed " + std::to_wstring(rng() % 100)); break;
+			case 1: backend.MoveToDesktop(window, rng() % 2); break;
+			case 2: backend.Move(window, backend.Monitors()[rng() % 3]); break;
+			case 3: backend.SetRect(window, RandomRect(rng)); break;
+			case 4: backend.SetForeground(tick % 50 ? window : start); break;
+			case 5:
+				backend.Destroy(window);
+				window = backend.AddWindow(L"Class" + std::to_wstring(rng() % 40), L"New window", 1 + rng() % 20, backend.Monitors()[rng() % 3]);
+				break;
+			default:
+				if (backend.IsWindowMaximised(window)) { backend.Restore(window); } else { backend.Maximise(window); }
+				break;
+			}
+			if (tick == TICKS / 2)
+			{
+				rules.titles.push_back(L"Renamed 1"); // The exclusion file changed
+				std::atomic_store(&exclusions, std::make_shared<const ExclusionMatcher>(rules, FoldClassNames | FoldExeNames));
+			}
+
+			backend.TakeEvents(events);
+			for (const EVENT &ev : events)
+			{
+				classifier.OnEvent(ev);
+			}
+			events_recorded += events.size();
+			unsigned int reason = tick % 100 ? PassWindows : PassSettings | PassRefresh;
+			DYNAMICWSMODE mode = tick > TICKS * 3 / 4 ? DynamicWsGeometry : DynamicWsMaximised;
+			digest = DigestState(digest, *classifier.Classify(reason, tick * DEFAULT_MIN_PASS_INTERVAL, options.dynamicws, options.dynamicstart, mode));
+		}
+		tracestats = recorder.Stats();
+	}
+	std::fclose(file);
+
+	// Replay it twice: both must agree with each other and with the live session
+	REPLAYSTATS first = REPLAYSTATS();
+	REPLAYSTATS second = REPLAYSTATS();
+	double replay_ns = 0;
+	{
+		MappedFile trace(PATH);
+		TraceReplayer replayer;
+		auto begin = std::chrono::steady_clock::now();
+		replayer.Replay(trace.Data(), trace.Size());
+		replay_ns = ElapsedNs(begin);
+		first = replayer.Stats();
+
+		TraceReplayer again;
+		again.Replay(trace.Data(), trace.Size());
+		second = again.Stats();
+	}
+	std::remove(PATH);
+
+	bool matches = first.complete && first.digest == digest && first.passes == static_cast<unsigned long long>(TICKS) &&
+		second.digest == first.digest && second.compositions == first.compositions;
+	std::printf("replay,%zu,%d,%llu,%llu,%.1f,%.0f,%.2f,%s\n", window_count, TICKS,
+		events_recorded, tracestats.bytes, static_cast<double>(tracestats.bytes) / events_recorded,
+		first.events / (replay_ns / 1e9), replay_ns / 1e6, matches ? "yes" : "NO");
+}
+
+// A session of windows being maximised, renamed, moved, sized, replaced and switched
+// between desktops, with the Start menu opening, the exclusion rules changing halfway
+// and dynamic-ws-mode switching to geometry for the last quarter, recorded to a trace
+// and replayed from a memory mapping. The trace has to reproduce every state the live
+// session came up with.
+void BenchmarkReplay()
+{
+	const size_t WINDOWS[] = { 100, 1000, 10000 };
+
+	std::printf("benchmark,windows,passes,events,trace_bytes,bytes_per_event,replay_events_per_s,replay_ms,matches\n");
+	for (size_t windows : WINDOWS)
+	{
+		RunReplayScenario(windows);
+	}
+}
+
+// Benchmarks --replay FILE
+int ReplayFile(const char *path)
+{
+	MappedFile trace(path);
+	if (!trace.Data())
+	{
+		std::fprintf(stderr, "Can't read %s\n", path);
+		return 1;
+	}
+
+	TraceReplayer replayer;
+	auto begin = std::chrono::steady_clock::now();
+	if (!replayer.Replay(trace.Data(), trace.Size()))
+	{
+		std::fprintf(stderr, "%s isn't a trace\n", path);
+		return 1;
+	}
+	double replay_ns = ElapsedNs(begin);
+
+	const REPLAYSTATS &stats = replayer.Stats();
+	std::printf("trace,bytes,records,events,passes,duration_ms,compositions,digest,replay_ms,complete\n");
+	std::printf("%s,%zu,%llu,%llu,%llu,%llu,%llu,%016llx,%.2f,%s\n", path, trace.Size(), stats.records, stats.events, stats.passes,
+		static_cast<unsigned long long>(stats.duration), stats.compositions, static_cast<unsigned long long>(stats.digest),
+		replay_ns / 1e6, stats.complete ? "yes" : "no");
+	return stats.complete ? 0 : 1;
+}
+
+#pragma endregion
+
+#pragma region processes
+
+// The first pass after logging in, when none of the process names are known yet: every
+// monitor has one maximised window, and on half of them it belongs to an excluded
+// executable that runs guarded, which only a snapshot can name. Then a few programs
+// start, newer than the snapshot the pass before used.
+void RunProcessScenario(size_t window_count, bool snapshots)
+{
+	const int MONITORS = 16;
+	const unsigned long PROCESSES = 500;
+	const unsigned long LAUNCHED = 20;
+
+	std::mt19937 rng(29);
+	EXCLUSIONRULES rules;
+	SimulatedBackend backend;
+	backend.SetSnapshots(snapshots);
+	for (int i = 0; i < MONITORS; i++)
+	{
+		backend.AddMonitor();
+	}
+	for (unsigned long pid = 1; pid <= PROCESSES; pid++)
+	{
+		bool guarded = pid % 10 == 0;
+		std::wstring exe = (guarded ? L"service" : L"app") + std::to_wstring(pid) + L".exe";
+		if (guarded && pid % 20 == 0)
+		{
+			rules.exes.push_back(exe);
+		}
+		backend.AddProcess(pid, exe, guarded);
+	}
+	std::shared_ptr<const ExclusionMatcher> exclusions = std::make_shared<const ExclusionMatcher>(rules, FoldClassNames | FoldExeNames);
+
+	for (size_t i = 0; i < window_count; i++)
+	{
+		backend.AddWindow(L"ApplicationFrameWindow", L"Document " + std::to_wstring(i), rng() % PROCESSES + 1, backend.Monitors()[rng() % MONITORS]);
+	}
+	std::vector<TASKBARSTATE> expected;
+	for (int i = 0; i < MONITORS; i++)
+	{
+		bool excluded = i % 2 == 0;
+		unsigned long pid = excluded ? 20 * (rng() % (PROCESSES / 20) + 1) : 20 * (rng() % (PROCESSES / 20)) + 1;
+		backend.Maximise(backend.AddWindow(L"ApplicationFrameWindow", L"Maximised", pid, backend.Monitors()[i]));
+		expected.push_back(excluded ? Normal : WindowMaximised);
+	}
+
+	WindowClassifier classifier(backend, exclusions);
+	std::vector<EVENT> events;
+	backend.TakeEvents(events);
+	backend.ResetCalls();
+	auto start = std::chrono::steady_clock::now();
+	std::shared_ptr<DESKTOPSTATE> state = classifier.Classify(PassSettings, 0, true, false);
+	double first_ms = ElapsedNs(start) / 1e6;
+	BACKENDCALLS first = backend.Calls();
+
+	int mismatches = 0;
+	for (int i = 0; i < MONITORS; i++)
+	{
+		mismatches += state->StateOf(backend.Monitors()[i]) != expected[i];
+	}
+
+	// A maximised window each, on the excluded half of the monitors
+	for (unsigned long pid = PROCESSES + 1; pid <= PROCESSES + LAUNCHED; pid++)
+	{
+		backend.AddProcess(pid, L"launched" + std::to_wstring(pid) + L".exe");
+		WINDOWID window = backend.AddWindow(L"ApplicationFrameWindow", L"Launched", pid, backend.Monitors()[2 * (pid % (MONITORS / 2))]);
+		if (pid % 5 == 0)
+		{
+			backend.Maximise(window);
+			expected[2 * (pid % (MONITORS / 2))] = WindowMaximised;
+		}
+	}
+	backend.TakeEvents(events);
+	for (const EVENT &event : events)
+	{
+		classifier.OnEvent(event);
+	}
+	backend.ResetCalls();
+	state = classifier.Classify(PassWindows, 100, true, false);
+	BACKENDCALLS launch = backend.Calls();
+	for (int i = 0; i < MONITORS; i++)
+	{
+		mismatches += state->StateOf(backend.Monitors()[i]) != expected[i];
+	}
+
+	// Long after that snapshot went stale: the names are cached, except the guarded ones
+	backend.ResetCalls();
+	state = classifier.Classify(PassRefresh, 100 + 10 * SNAPSHOT_MAX_AGE, true, false);
+	BACKENDCALLS later = backend.Calls();
+	for (int i = 0; i < MONITORS; i++)
+	{
+		mismatches += state->StateOf(backend.Monitors()[i]) != expected[i];
+	}
+
+	std::printf("processes,%zu,%s,%.2f,%llu,%llu,%llu,%llu,%llu,%llu,%d\n", window_count, snapshots ? "snapshot" : "open", first_ms,
+		first.processqueries, first.snapshots, launch.processqueries, launch.snapshots, later.processqueries, later.snapshots, mismatches);
+}
+
+// The open rows are how names were resolved before snapshots: a few queries per process,
+// and the monitors whose maximised window is excluded but guarded come out wrong.
+// The later columns are a pass once the snapshot went stale, which the cache answers
+// without taking another.
+void BenchmarkProcesses()
+{
+	std::printf("benchmark,windows,resolution,first_pass_ms,first_process_queries,first_snapshots,launch_process_queries,launch_snapshots,later_process_queries,later_snapshots,mismatches\n");
+	for (size_t windows : { 100, 1000, 10000 })
+	{
+		RunProcessScenario(windows, false);
+		RunProcessScenario(windows, true);
+	}
+}
+
+#pragma endregion
+
+#pragma region parser
+
+// An exclusion file with `rule_count` rules, `per_line` of them on each line, mixing all rule types.
+std::wstring MakeExclusionFile(size_t rule_count, size_t per_line)
+{
+	const wchar_t *const TYPES[] = { L"title", L"exename", L"class" };
+	std::wstring text = L"; Generated\r\n";
+	for (size_t i = 0, line = 0; i < rule_count; line++)
+	{
+		text += TYPES[line % 3];
+		for (size_t j = 0; j < per_line && i < rule_count; j++, i++)
+		{
+			text += L", Rule number " + std::to_wstring(i);
+		}
+		text += L" ; comment\r\n";
+	}
+	return text;
+}
+
+void RunParserScenario(size_t rule_count, size_t per_line)
+{
+	const size_t CHUNK = 4096; // What ParseDWSExcludesFile reads at once
+	std::wstring text = MakeExclusionFile(rule_count, per_line);
+
+	auto start = std::chrono::steady_clock::now();
+	EXCLUSIONRULES rules;
+	std::vector<PARSEERROR> errors;
+	ExclusionParser parser(rules, errors);
+	for (size_t offset = 0; offset < text.size(); offset += CHUNK)
+	{
+		parser.Feed(text.data() + offset, std::min(CHUNK, text.size() - offset));
+	}
+	parser.Finish();
+	double parse_ns = ElapsedNs(start);
+
+	start = std::chrono::steady_clock::now();
+	ExclusionMatcher matcher(rules);
+	double compile_ns = ElapsedNs(start);
+
+	size_t loaded = rules.classes.size() + rules.titles.size() + rules.exes.size();
+	std::printf("parser,%zu,%zu,%zu,%.3f,%.3f,%zu,%zu\n", rule_count, per_line, text.size(), parse_ns / 1e6, compile_ns / 1e6, loaded, errors.size());
+}
+
+// Loading exclusion files from memory, in chunks like from disk. Every rule must be
+// loaded (rules_loaded equal to rules) without any error.
+void BenchmarkParser()
+{
+	std::printf("benchmark,rules,rules_per_line,characters,parse_ms,compile_ms,rules_loaded,errors\n");
+	RunParserScenario(1000, 1);
+	RunParserScenario(1000, 100);
+	RunParserScenario(100000, 1);
+	RunParserScenario(100000, 100);
+	RunParserScenario(100000, 10000);
+}
+
+#pragma endregion
+
+#pragma region patterns
+
+// Cost of matching a title against a growing number of regular expressions: all of
+// them combined in one automaton, next to trying std::wregex one pattern at a time.
+void RunPatternScenario(size_t pattern_count)
+{
+	const int TITLES = 2000;
+	const size_t MAX_WREGEX = 100; // Past this, looping over std::wregex takes too long to bother
+
+	std::mt19937 rng(5);
+	std::vector<std::wstring> patterns;
+	for (size_t i = 0; i < pattern_count; i++)
+	{
+		switch (i % 3)
+		{
+		case 0: patterns.push_back(L"^Meeting " + std::to_wstring(i) + L" .*Teams$"); break;
+		case 1: patterns.push_back(L"Report[0-9]+ \\(" + std::to_wstring(i) + L"\\)"); break;
+		case 2: patterns.push_back(L"(Draft|Final) " + std::to_wstring(i) + L"\\.docx"); break;
+		}
+	}
+
+	std::vector<std::wstring> titles;
+	for (int i = 0; i < TITLES; i++)
+	{
+		titles.push_back(i % 10 == 0 ? L"Meeting " + std::to_wstring(rng() % (pattern_count * 2)) + L" with the team | Microsoft Teams" : L"Document " + std::to_wstring(i) + L".txt - Notepad");
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	PatternAutomaton automaton(patterns, false);
+	double compile_ns = ElapsedNs(start);
+
+	// The first time around the automaton still builds its DFA states
+	size_t matches = 0;
+	double cold_ns = 0, warm_ns = 0;
+	for (double *ns : { &cold_ns, &warm_ns })
+	{
+		matches = 0;
+		start = std::chrono::steady_clock::now();
+		for (const std::wstring &title : titles)
+		{
+			matches += automaton.Matches(title.c_str(), title.length());
+		}
+		*ns = ElapsedNs(start) / TITLES;
+	}
+
+	if (pattern_count <= MAX_WREGEX)
+	{
+		std::vector<std::wregex> regexes(patterns.begin(), patterns.end());
+		size_t regex_matches = 0;
+		start = std::chrono::steady_clock::now();
+		for (const std::wstring &title : titles)
+		{
+			for (const std::wregex &regex : regexes)
+			{
+				if (std::regex_search(title, regex))
+				{
+					regex_matches++;
+					break;
+				}
+			}
+		}
+		double regex_ns = ElapsedNs(start) / TITLES;
+		std::printf("patterns,%zu,%.3f,%.0f,%.0f,%.0f,%zu,%zu,%zu\n", pattern_count, compile_ns / 1e6, cold_ns, warm_ns, regex_ns, automaton.DfaSize(), matches, regex_matches);
+	}
+	else
+	{
+		std::printf("patterns,%zu,%.3f,%.0f,%.0f,,%zu,%zu,\n", pattern_count, compile_ns / 1e6, cold_ns, warm_ns, automaton.DfaSize(), matches);
+	}
+}
+
+// The matches columns must agree wherever std::wregex ran. cold_ns_per_title grows with
+// the number of patterns, each new DFA state walks all of their NFAs: with 10000 the
+// first titles take about half a millisecond each, which a pass only pays once.
+void BenchmarkPatterns()
+{
+	std::printf("benchmark,patterns,compile_ms,cold_ns_per_title,warm_ns_per_title,wregex_ns_per_title,dfa_states,automaton_matches,wregex_matches\n");
+	RunPatternScenario(1);
+	RunPatternScenario(10);
+	RunPatternScenario(100);
+	RunPatternScenario(1000);
+	RunPatternScenario(10000);
+}
+
+#pragma endregion
+
+#pragma region metrics
+
+const int METRICS_MONITORS = 4;
+const int METRICS_PROCESSES = 40;
+
+// The same desktop every time it is called.
+std::vector<WINDOWID> MakeMetricsDesktop(SimulatedBackend &backend, size_t window_count)
+{
+	std::mt19937 rng(23);
+	for (int i = 0; i < METRICS_MONITORS; i++)
+	{
+		backend.AddMonitor();
+	}
+	for (int pid = 1; pid <= METRICS_PROCESSES; pid++)
+	{
+		backend.AddProcess(pid, L"app" + std::to_wstring(pid) + L".exe");
+	}
+	std::vector<WINDOWID> windows;
+	for (size_t i = 0; i < window_count; i++)
+	{
+		windows.push_back(backend.AddWindow(L"ApplicationFrameWindow", L"Document " + std::to_wstring(i % 16), rng() % METRICS_PROCESSES + 1, backend.Monitors()[rng() % METRICS_MONITORS]));
+	}
+	return windows;
+}
+
+// Average time per pass, on the same script every time.
+double RunMetricsPasses(SimulatedBackend &backend, const std::vector<WINDOWID> &windows, WindowClassifier &classifier, TaskbarController &controller, const OPTIONS &options)
+{
+	const int TICKS = 4000;
+	const int CHANGES_PER_TICK = 6;
+
+	std::mt19937 rng(29);
+	controller.RefreshHandles();
+	std::vector<EVENT> events;
+	double pass_ns = 0;
+	std::uint64_t now = 0;
+	for (int tick = 0; tick < TICKS; tick++)
+	{
+		for (int i = 0; i < CHANGES_PER_TICK; i++)
+		{
+			WINDOWID window = windows[rng() % windows.size()];
+			switch (rng() % 4)
+			{
+			case 0: backend.Maximise(window); break;
+			case 1: backend.Restore(window); break;
+			case 2: backend.SetForeground(window); break;
+			case 3: backend.SetTitle(window, L"Document " + std::to_wstring(rng() % 16)); break;
+			}
+		}
+		backend.TakeEvents(events);
+		now += DEFAULT_MIN_PASS_INTERVAL;
+		unsigned int reason = tick == 0 ? PassSettings : PassWindows;
+
+		auto start = std::chrono::steady_clock::now();
+		for (const EVENT &ev : events)
+		{
+			classifier.OnEvent(ev);
+		}
+		controller.Pass(reason, *classifier.Classify(reason, now, options.dynamicws, options.dynamicstart), now);
+		pass_ns += ElapsedNs(start);
+	}
+	return pass_ns / TICKS;
+}
+
+void RunMetricsScenario(size_t window_count)
+{
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, DynamicWsMaximised };
+	std::shared_ptr<const ExclusionMatcher> exclusions = std::make_shared<const ExclusionMatcher>(MakeRules(100, TitleHeavy), FoldClassNames | FoldExeNames);
+
+	SimulatedBackend plainbackend;
+	std::vector<WINDOWID> plainwindows = MakeMetricsDesktop(plainbackend, window_count);
+	WindowClassifier plainclassifier(plainbackend, exclusions);
+	TaskbarController plaincontroller(plainbackend, options);
+	double plain_ns = RunMetricsPasses(plainbackend, plainwindows, plainclassifier, plaincontroller, options);
+
+	MetricsRegistry metrics;
+	SimulatedBackend backend;
+	std::vector<WINDOWID> windows = MakeMetricsDesktop(backend, window_count);
+	WindowClassifier classifier(backend, exclusions);
+	classifier.SetMetrics(&metrics);
+	TaskbarController controller(backend, options);
+	controller.SetMetrics(&metrics);
+	double counted_ns = RunMetricsPasses(backend, windows, classifier, controller, options);
+
+	// Whoever reads the pipe pays for the formatting, nobody else
+	const int SNAPSHOTS = 1000;
+	size_t bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < SNAPSHOTS; i++)
+	{
+		bytes = metrics.Snapshot().size();
+	}
+	double snapshot_ns = ElapsedNs(start) / SNAPSHOTS;
+
+	// The metrics count the same things as the components' own stats
+	bool agrees =
+		metrics.Counter(MetricTicks).Value() == controller.ApplyStats().applies &&
+		metrics.Counter(MetricPoliciesIssued).Value() == controller.CompositionStats().issued &&
+		metrics.Counter(MetricPoliciesSkipped).Value() == controller.CompositionStats().skipped &&
+		metrics.Counter(MetricEnumerations).Value() == classifier.MaximisedWindowStats().reconciles &&
+		metrics.Histogram(MetricExclusionTime).Count() == classifier.VerdictCacheStats().misses &&
+		metrics.Histogram(MetricTickTime).Count() == metrics.Counter(MetricTicks).Value();
+	if (!agrees)
+	{
+		failures++;
+	}
+	const LatencyHistogram &exclusion = metrics.Histogram(MetricExclusionTime);
+	std::printf("metrics,%zu,%.0f,%.0f,%.1f,%llu,%llu,%llu,%llu,%.0f,%zu,%s\n", window_count, plain_ns, counted_ns,
+		plain_ns > 0 ? (counted_ns - plain_ns) * 100 / plain_ns : 0.0,
+		metrics.Counter(MetricWindowsVisited).Value(), metrics.Counter(MetricWindowsQualified).Value(),
+		exclusion.Count(), exclusion.Percentile(0.99), snapshot_ns, bytes, agrees ? "yes" : "NO");
+}
+
+// Cost of counting the metrics on every pass against not counting them, which should
+// be lost in the noise, and of formatting a snapshot, which only happens when one is
+// read. The counts must agree with the stats the components keep themselves, the exit
+// code is non zero otherwise.
+void BenchmarkMetrics()
+{
+	std::printf("benchmark,windows,ns_per_pass,ns_per_pass_counted,overhead_percent,windows_visited,windows_qualified,exclusion_runs,exclusion_p99_ns,ns_per_snapshot,snapshot_bytes,agrees\n");
+	RunMetricsScenario(100);
+	RunMetricsScenario(1000);
+	RunMetricsScenario(5000);
+}
+
+#pragma endregion
+
+#pragma region decisions
+
+// What a test record's `arg` is made from its subject, so a torn one can be told.
+std::uint32_t DecisionCheck(std::uint64_t subject)
+{
+	return static_cast<std::uint32_t>(subject * 2654435761u);
+}
+
+// `threads` threads emitting at once, while this one reads the ring over and over if
+// `read`. Returns the average time per record, and how many records read didn't hold together.
+double RunDecisionEmitters(int threads, bool read, unsigned long long &torn)
+{
+	const int RECORDS = 2000000; // Per thread
+
+	DecisionTrace decisions;
+	std::atomic<int> running(threads);
+	std::atomic<unsigned long long> emit_ns(0);
+	std::vector<std::thread> emitters;
+	for (int t = 0; t < threads; t++)
+	{
+		emitters.push_back(std::thread([&decisions, &running, &emit_ns, t]()
+		{
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < RECORDS; i++)
+			{
+				std::uint64_t subject = (static_cast<std::uint64_t>(t) << 32) | static_cast<std::uint64_t>(i);
+				decisions.Emit(DecisionQualified, subject, DecisionCheck(subject), ~DecisionCheck(subject));
+			}
+			emit_ns += static_cast<unsigned long long>(ElapsedNs(start));
+			running--;
+		}));
+	}
+
+	torn = 0;
+	std::vector<DECISION> records;
+	records.reserve(DECISION_TRACE_SIZE);
+	while (read && running)
+	{
+		decisions.Read(records);
+		for (const DECISION &record : records)
+		{
+			torn += record.kind != DecisionQualified || record.arg != DecisionCheck(record.subject) || record.detail != ~DecisionCheck(record.subject);
+		}
+	}
+	for (std::thread &emitter : emitters)
+	{
+		emitter.join();
+	}
+	return static_cast<double>(emit_ns) / threads / RECORDS;
+}
+
+// Cost of emitting a record from one thread, then from two at once while the ring is
+// being read (with fewer CPUs than threads, that time includes the others' turns), and
+// of tracing every decision of a pass on the desktop of the metrics benchmark, against
+// not tracing. Then what a dump costs whoever asks for it. No record read may be torn,
+// and a full ring must give back every record it holds, the exit code is non zero otherwise.
+void BenchmarkDecisions()
+{
+	const size_t WINDOWS = 1000;
+
+	std::printf("benchmark,scenario,ns_per_record,torn,ns_per_pass,ns_per_pass_traced,records_per_pass,records_kept,ms_per_dump,dump_bytes\n");
+	unsigned long long torn = 0;
+	double record_ns = RunDecisionEmitters(1, false, torn);
+	std::printf("decisions,emit 1 thread,%.1f,,,,,,,\n", record_ns);
+	record_ns = RunDecisionEmitters(2, true, torn);
+	failures += torn != 0;
+	std::printf("decisions,emit 2 threads read,%.1f,%llu,,,,,,\n", record_ns, torn);
+
+	OPTIONS options = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 0, true, false, ACCENT_ENABLE_BLURBEHIND, { 0, 0, LeadingEdge }, DynamicWsMaximised };
+	std::shared_ptr<const ExclusionMatcher> exclusions = std::make_shared<const ExclusionMatcher>(MakeRules(100, TitleHeavy), FoldClassNames | FoldExeNames);
+
+	SimulatedBackend plainbackend;
+	std::vector<WINDOWID> plainwindows = MakeMetricsDesktop(plainbackend, WINDOWS);
+	WindowClassifier plainclassifier(plainbackend, exclusions);
+	TaskbarController plaincontroller(plainbackend, options);
+	double plain_ns = RunMetricsPasses(plainbackend, plainwindows, plainclassifier, plaincontroller, options);
+
+	DecisionTrace decisions;
+	SimulatedBackend backend;
+	std::vector<WINDOWID> windows = MakeMetricsDesktop(backend, WINDOWS);
+	WindowClassifier classifier(backend, exclusions);
+	classifier.SetDecisionTrace(&decisions);
+	TaskbarController controller(backend, options);
+	controller.SetDecisionTrace(&decisions);
+	double traced_ns = RunMetricsPasses(backend, windows, classifier, controller, options);
+
+	const int DUMPS = 10;
+	size_t bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < DUMPS; i++)
+	{
+		bytes = decisions.ChromeTrace().size();
+	}
+	double dump_ms = ElapsedNs(start) / DUMPS / 1e6;
+
+	std::vector<DECISION> records;
+	decisions.Read(records);
+	failures += decisions.Emitted() >= DECISION_TRACE_SIZE && records.size() != DECISION_TRACE_SIZE;
+	std::printf("decisions,passes %zu windows,,,%.0f,%.0f,%.1f,%zu,%.2f,%zu\n", WINDOWS, plain_ns, traced_ns,
+		static_cast<double>(decisions.Emitted()) / classifier.ArenaStats().resets, records.size(), dump_ms, bytes);
+}
+
+#pragma endregion
+
+struct BENCHMARK
+{
+	const char *name;
+	void (*run)();
+};
+
+const BENCHMARK benchmarks[] = {
+	{ "wakeups", &BenchmarkWakeups },
+	{ "maximised", &BenchmarkMaximised },
+	{ "desktop", &BenchmarkDesktop },
+	{ "pipeline", &BenchmarkPipeline },
+	{ "steady", &BenchmarkSteady },
+	{ "worker", &BenchmarkWorker },
+	{ "transitions", &BenchmarkTransitions },
+	{ "taskbars", &BenchmarkTaskbars },
+	{ "geometry", &BenchmarkGeometry },
+	{ "start", &BenchmarkStart },
+	{ "fullscreen", &BenchmarkFullscreen },
+	{ "desktops", &BenchmarkDesktops },
+	{ "qualify", &BenchmarkQualify },
+	{ "replay", &BenchmarkReplay },
+	{ "processes", &BenchmarkProcesses },
+	{ "parser", &BenchmarkParser },
+	{ "patterns", &BenchmarkPatterns },
+	{ "metrics", &BenchmarkMetrics },
+	{ "decisions", &BenchmarkDecisions }
+};
+
+int main(int argc, char **argv)
+{
+	if (argc == 3 && !std::strcmp(argv[1], "--replay"))
+	{
+		return ReplayFile(argv[2]);
+	}
+
+	for (const BENCHMARK &benchmark : benchmarks)
+	{
+		bool selected = argc < 2;
+		for (int i = 1; i < argc; i++)
+		{
+			if (!std::strcmp(argv[i], benchmark.name))
+			{
+				selected = true;
+			}
+		}
+
+		if (selected)
+		{
+			benchmark.run();
+		}
+	}
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,258 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+const std::size_t ARENA_BLOCK_SIZE = 64 * 1024; // Enough for a pass over a few thousand windows
+
+struct ARENASTATS
+{
+	unsigned long long resets; // Passes it was used for
+	unsigned long long grows;  // Times a pass needed more than the arena had, each one a heap allocation
+	std::size_t peak;          // Most bytes a single pass used
+	std::size_t capacity;      // Bytes it holds on to between passes
+};
+
+// Memory for whatever a pass needs only while it runs: lists of monitors, of windows
+// found by an enumeration, etc. Allocating is moving a pointer, freeing does nothing,
+// and Reset gives everything back at once when the pass is over. A pass that needed
+// more than one block leaves a single block big enough for all of it, so after the
+// first few passes it stops touching the heap at all.
+class TickArena
+{
+public:
+	explicit TickArena(std::size_t size = ARENA_BLOCK_SIZE) : m_Used(0), m_Total(0), m_Stats()
+	{
+		Grow(size);
+	}
+
+	~TickArena()
+	{
+		for (const BLOCK &block : m_Blocks)
+		{
+			::operator delete(block.data);
+		}
+	}
+
+	TickArena(const TickArena &) = delete;
+	TickArena &operator =(const TickArena &) = delete;
+
+	void *Allocate(std::size_t size, std::size_t alignment)
+	{
+		std::size_t offset = (m_Used + alignment - 1) & ~(alignment - 1);
+		if (offset + size > m_Blocks.back().size)
+		{
+			m_Stats.grows++;
+			Grow(size + alignment > m_Blocks.back().size * 2 ? size + alignment : m_Blocks.back().size * 2);
+			offset = 0;
+		}
+		m_Used = offset + size;
+		m_Total += size;
+		return static_cast<char *>(m_Blocks.back().data) + offset;
+	}
+
+	// Everything allocated since the last reset must be gone by now.
+	void Reset()
+	{
+		m_Stats.resets++;
+		m_Stats.peak = m_Total > m_Stats.peak ? m_Total : m_Stats.peak;
+		if (m_Blocks.size() > 1)
+		{
+			std::size_t size = 0;
+			for (const BLOCK &block : m_Blocks)
+			{
+				size += block.size;
+				::operator delete(block.data);
+			}
+			m_Blocks.clear();
+			Grow(size);
+		}
+		m_Used = 0;
+		m_Total = 0;
+	}
+
+	ARENASTATS Stats() const
+	{
+		ARENASTATS stats = m_Stats;
+		stats.capacity = 0;
+		for (const BLOCK &block : m_Blocks)
+		{
+			stats.capacity += block.size;
+		}
+		return stats;
+	}
+
+private:
+	struct BLOCK
+	{
+		void *data;
+		std::size_t size;
+	};
+
+	void Grow(std::size_t size)
+	{
+		m_Blocks.push_back({ ::operator new(size), size });
+		m_Used = 0;
+	}
+
+	std::vector<BLOCK> m_Blocks; // Allocations come from the last one
+	std::size_t m_Used;          // In the last block
+	std::size_t m_Total;         // Since the last reset, for the stats
+	ARENASTATS m_Stats;
+};
+
+// Lets standard containers live in a TickArena. They must be destroyed before it is reset.
+template<typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit ArenaAllocator(TickArena &arena) : m_Arena(&arena) { }
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U> &other) : m_Arena(other.Arena()) { }
+
+	T *allocate(std::size_t count)
+	{
+		return static_cast<T *>(m_Arena->Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T *, std::size_t) { } // Given back by Reset
+
+	TickArena *Arena() const { return m_Arena; }
+
+	template<typename U>
+	bool operator ==(const ArenaAllocator<U> &other) const { return m_Arena == other.Arena(); }
+
+	template<typename U>
+	bool operator !=(const ArenaAllocator<U> &other) const { return m_Arena != other.Arena(); }
+
+private:
+	TickArena *m_Arena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+const std::size_t POOL_SLAB_SIZE = 4096;
+const std::size_t POOL_MAX_NODE = 128; // Bigger allocations, like hash table buckets, go to the heap
+
+// Recycles the nodes of long lived node based containers (std::map, std::unordered_map...).
+// Erasing an element puts its node on a free list, and the next insertion of the same
+// size takes it back, so a container whose size stays about the same stops allocating
+// however much it churns. Memory is only given back when the pool is destroyed, which
+// must happen after the containers using it.
+class NodePool
+{
+public:
+	NodePool() : m_Free() { }
+
+	~NodePool()
+	{
+		for (void *slab : m_Slabs)
+		{
+			::operator delete(slab);
+		}
+	}
+
+	NodePool(const NodePool &) = delete;
+	NodePool &operator =(const NodePool &) = delete;
+
+	void *Allocate(std::size_t size)
+	{
+		if (size > POOL_MAX_NODE)
+		{
+			return ::operator new(size);
+		}
+
+		std::size_t sizeclass = Class(size);
+		FREENODE *&free = m_Free[sizeclass];
+		if (!free)
+		{
+			Refill(sizeclass);
+		}
+		FREENODE *node = free;
+		free = node->next;
+		return node;
+	}
+
+	void Free(void *p, std::size_t size)
+	{
+		if (size > POOL_MAX_NODE)
+		{
+			::operator delete(p);
+			return;
+		}
+
+		FREENODE *node = static_cast<FREENODE *>(p);
+		FREENODE *&free = m_Free[Class(size)];
+		node->next = free;
+		free = node;
+	}
+
+	std::size_t Slabs() const { return m_Slabs.size(); }
+
+private:
+	struct FREENODE
+	{
+		FREENODE *next;
+	};
+
+	static const std::size_t GRANULARITY = alignof(std::max_align_t) > sizeof(FREENODE) ? alignof(std::max_align_t) : sizeof(FREENODE);
+	static const std::size_t CLASSES = POOL_MAX_NODE / GRANULARITY;
+
+	static std::size_t Class(std::size_t size)
+	{
+		return size ? (size - 1) / GRANULARITY : 0;
+	}
+
+	void Refill(std::size_t sizeclass)
+	{
+		std::size_t nodesize = (sizeclass + 1) * GRANULARITY;
+		char *slab = static_cast<char *>(::operator new(POOL_SLAB_SIZE));
+		m_Slabs.push_back(slab);
+		for (std::size_t offset = 0; offset + nodesize <= POOL_SLAB_SIZE; offset += nodesize)
+		{
+			Free(slab + offset, nodesize);
+		}
+	}
+
+	FREENODE *m_Free[CLASSES];
+	std::vector<void *> m_Slabs;
+};
+
+// Lets standard node based containers take their nodes from a NodePool.
+template<typename T>
+class PoolAllocator
+{
+public:
+	typedef T value_type;
+
+	explicit PoolAllocator(NodePool &pool) : m_Pool(&pool) { }
+
+	template<typename U>
+	PoolAllocator(const PoolAllocator<U> &other) : m_Pool(other.Pool()) { }
+
+	T *allocate(std::size_t count)
+	{
+		return static_cast<T *>(m_Pool->Allocate(count * sizeof(T)));
+	}
+
+	void deallocate(T *p, std::size_t count)
+	{
+		m_Pool->Free(p, count * sizeof(T));
+	}
+
+	NodePool *Pool() const { return m_Pool; }
+
+	template<typename U>
+	bool operator ==(const PoolAllocator<U> &other) const { return m_Pool == other.Pool(); }
+
+	template<typename U>
+	bool operator !=(const PoolAllocator<U> &other) const { return m_Pool != other.Pool(); }
+
+private:
+	NodePool *m_Pool;
+};
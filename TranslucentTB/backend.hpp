@@ -0,0 +1,89 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "eventloop.hpp"
+
+typedef std::uintptr_t PROCESSREF; // An open reference to a process (a HANDLE on Windows), 0 when invalid
+
+const std::size_t MAX_EXE_NAME = 260; // MAX_PATH, which the name of an executable can't be longer than
+
+// A process, as listed by a snapshot of every running process.
+struct PROCESSNAME
+{
+	unsigned long pid;
+	wchar_t exe[MAX_EXE_NAME]; // File name only, no directory
+};
+
+struct ACCENTPOLICY
+{
+	int nAccentState;
+	int nFlags;
+	int nColor;
+	int nAnimationId;
+};
+
+// In screen coordinates, right and bottom excluded.
+struct WINDOWRECT
+{
+	int left;
+	int top;
+	int right;
+	int bottom;
+};
+
+inline bool operator==(const ACCENTPOLICY &a, const ACCENTPOLICY &b)
+{
+	return a.nAccentState == b.nAccentState &&
+	       a.nFlags == b.nFlags &&
+	       a.nColor == b.nColor &&
+	       a.nAnimationId == b.nAnimationId;
+}
+
+inline bool operator!=(const ACCENTPOLICY &a, const ACCENTPOLICY &b)
+{
+	return !(a == b);
+}
+
+// Everything the taskbar logic needs from the window system. Keep it narrow: each
+// method maps to one or two system calls on Windows (win32backend.hpp), and has to
+// be easy to fake in memory (simulatedbackend.hpp).
+class Backend
+{
+public:
+	virtual ~Backend() { }
+
+	// Windows
+	virtual void EnumerateWindows(std::vector<WINDOWID> &windows) = 0; // Top level windows, in z-order
+	virtual bool IsWindow(WINDOWID window) = 0;
+	virtual bool IsWindowMaximised(WINDOWID window) = 0;
+	virtual bool IsWindowVisible(WINDOWID window) = 0;
+	// Copies at most size - 1 characters and a null terminator, returns the length copied.
+	virtual std::size_t GetWindowClass(WINDOWID window, wchar_t *buffer, std::size_t size) = 0;
+	virtual std::size_t GetWindowTitle(WINDOWID window, wchar_t *buffer, std::size_t size) = 0;
+	virtual unsigned long GetWindowProcessId(WINDOWID window) = 0;
+	virtual WINDOWID GetForegroundWindow() = 0;
+	virtual bool GetWindowRect(WINDOWID window, WINDOWRECT &rect) = 0; // What can be seen of it, without invisible resize borders
+
+	// Monitors and taskbars
+	virtual MONITORID GetWindowMonitor(WINDOWID window) = 0; // The primary monitor when the window is on none
+	virtual void FindTaskbars(std::vector<WINDOWID> &taskbars) = 0; // The main taskbar first
+	virtual bool GetMonitorRects(MONITORID monitor, WINDOWRECT &bounds, WINDOWRECT &work) = 0; // `work` leaves out the taskbar
+
+	// Processes
+	virtual PROCESSREF OpenProcess(unsigned long pid) = 0;
+	virtual bool HasProcessExited(PROCESSREF process) = 0;
+	virtual bool GetProcessExeName(PROCESSREF process, std::wstring &name) = 0; // File name only, no directory
+	virtual void CloseProcess(PROCESSREF process) = 0;
+	// Every running process in one go, whether or not it could be opened. False if
+	// the system wouldn't give a list, OpenProcess is all there is then.
+	virtual bool SnapshotProcesses(std::vector<PROCESSNAME> &processes) = 0;
+
+	// Virtual desktops
+	virtual bool IsWindowOnCurrentDesktop(WINDOWID window) = 0;
+
+	// Composition
+	virtual bool SetAccentPolicy(WINDOWID taskbar, const ACCENTPOLICY &policy) = 0;
+};
@@ -0,0 +1,244 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "eventloop.hpp"
+#include "metrics.hpp"
+#include "windowclassifier.hpp"
+
+struct WORKERSTATS
+{
+	unsigned long long requests;      // Passes asked for by the UI thread
+	unsigned long long published;     // States published, requests arriving while one is running are merged
+	unsigned long long overflows;     // Times the event queue filled up and a full enumeration was forced instead
+	unsigned long long lastclassify_us;
+	unsigned long long maxclassify_us;
+	unsigned long long totalclassify_us; // Divide by published for the average
+};
+
+// Runs a WindowClassifier on its own thread, so the thread that owns the tray window
+// and the taskbars never waits on EnumWindows, OpenProcess or a hung window.
+//
+// The UI thread hands over events and pass requests, which only takes a short lock on
+// a queue. Each classification ends with the new DESKTOPSTATE being published through
+// std::atomic_store, then `published` is called (on the worker thread) so the UI thread
+// can pick it up with Latest() and apply it. Neither side ever waits for the other to
+// finish its work.
+class ClassificationWorker
+{
+public:
+	typedef std::function<void()> HOOK;
+
+	static const std::size_t MAX_QUEUED_EVENTS = 4096; // Past that, the events are dropped and everything is enumerated again
+
+	// `attach` and `detach` (optional) run on the worker thread when it starts and exits,
+	// for per-thread setup the backend needs.
+	ClassificationWorker(WindowClassifier &classifier, const HOOK &published, const HOOK &attach = nullptr, const HOOK &detach = nullptr) :
+		m_Classifier(classifier),
+		m_Published(published),
+		m_Attach(attach),
+		m_Detach(detach),
+		m_Metrics(nullptr),
+		m_Latest(std::make_shared<const DESKTOPSTATE>()),
+		m_Pending(),
+		m_Stopping(false),
+		m_Busy(false),
+		m_Overflowed(false),
+		m_Requests(0),
+		m_Publications(0),
+		m_Overflows(0),
+		m_LastClassify(0),
+		m_MaxClassify(0),
+		m_TotalClassify(0)
+	{ }
+
+	~ClassificationWorker()
+	{
+		Stop();
+	}
+
+	void Start()
+	{
+		if (!m_Thread.joinable())
+		{
+			m_Stopping = false;
+			m_Thread = std::thread(&ClassificationWorker::Run, this);
+		}
+	}
+
+	// Waits for the classification in progress, if any, to finish.
+	void Stop()
+	{
+		if (m_Thread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Stopping = true;
+			}
+			m_Wake.notify_one();
+			m_Thread.join();
+		}
+	}
+
+	void Post(const EVENT &ev)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Events.size() < MAX_QUEUED_EVENTS)
+		{
+			m_Events.push_back(ev);
+		}
+		else if (!m_Overflowed)
+		{
+			m_Overflowed = true;
+			m_Overflows++;
+		}
+	}
+
+	// Asks for a pass. If the worker is busy, it runs once the current one is done,
+	// merged with any other request made in the meantime.
+	void Request(unsigned int reason, std::uint64_t now, bool dynamicws, bool dynamicstart, DYNAMICWSMODE mode = DynamicWsMaximised)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Pending.reason |= reason;
+			m_Pending.now = now;
+			m_Pending.dynamicws = dynamicws;
+			m_Pending.dynamicstart = dynamicstart;
+			m_Pending.mode = mode;
+			m_Pending.requested = true;
+			m_Requests++;
+		}
+		m_Wake.notify_one();
+	}
+
+	// Waits until every request made so far has been published.
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Idle.wait(lock, [this] { return !m_Pending.requested && !m_Busy; });
+	}
+
+	// Counts passes and how long they take. Set it before Start().
+	void SetMetrics(MetricsRegistry *metrics) { m_Metrics = metrics; }
+
+	std::shared_ptr<const DESKTOPSTATE> Latest() const
+	{
+		return std::atomic_load(&m_Latest);
+	}
+
+	WORKERSTATS Stats() const
+	{
+		return { m_Requests, m_Publications, m_Overflows, m_LastClassify, m_MaxClassify, m_TotalClassify };
+	}
+
+private:
+	struct REQUEST
+	{
+		unsigned int reason;
+		std::uint64_t now;
+		bool dynamicws;
+		bool dynamicstart;
+		DYNAMICWSMODE mode;
+		bool requested;
+	};
+
+	void Run()
+	{
+		if (m_Attach)
+		{
+			m_Attach();
+		}
+
+		std::vector<EVENT> events;
+		for (;;)
+		{
+			REQUEST request;
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_Wake.wait(lock, [this] { return m_Stopping || m_Pending.requested; });
+				if (m_Stopping)
+				{
+					break;
+				}
+
+				request = m_Pending;
+				m_Pending = REQUEST();
+				events.swap(m_Events);
+				if (m_Overflowed)
+				{
+					request.reason |= PassSettings; // Some windows were missed, look at all of them
+					m_Overflowed = false;
+				}
+				m_Busy = true;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			for (const EVENT &ev : events)
+			{
+				m_Classifier.OnEvent(ev);
+			}
+			events.clear();
+			std::shared_ptr<const DESKTOPSTATE> state = m_Classifier.Classify(request.reason, request.now, request.dynamicws, request.dynamicstart, request.mode);
+			std::atomic_store(&m_Latest, state);
+			unsigned long long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+			m_LastClassify = elapsed;
+			m_MaxClassify = std::max<unsigned long long>(m_MaxClassify, elapsed); // Only this thread writes
+			m_TotalClassify += elapsed;
+			m_Publications++;
+			if (m_Metrics)
+			{
+				m_Metrics->Add(MetricPasses);
+				m_Metrics->Record(MetricPassTime, elapsed);
+			}
+			if (m_Published)
+			{
+				m_Published();
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Busy = false;
+			}
+			m_Idle.notify_all();
+		}
+
+		if (m_Detach)
+		{
+			m_Detach();
+		}
+	}
+
+	WindowClassifier &m_Classifier;
+	HOOK m_Published;
+	HOOK m_Attach;
+	HOOK m_Detach;
+	MetricsRegistry *m_Metrics;
+	std::shared_ptr<const DESKTOPSTATE> m_Latest; // Only accessed through std::atomic_load/std::atomic_store
+
+	std::thread m_Thread;
+	std::mutex m_Mutex; // Guards everything below, except the stats
+	std::condition_variable m_Wake;
+	std::condition_variable m_Idle;
+	std::vector<EVENT> m_Events;
+	REQUEST m_Pending;
+	bool m_Stopping;
+	bool m_Busy;
+	bool m_Overflowed;
+
+	std::atomic<unsigned long long> m_Requests;
+	std::atomic<unsigned long long> m_Publications;
+	std::atomic<unsigned long long> m_Overflows;
+	std::atomic<unsigned long long> m_LastClassify;
+	std::atomic<unsigned long long> m_MaxClassify;
+	std::atomic<unsigned long long> m_TotalClassify;
+};
@@ -0,0 +1,197 @@
+#pragma once
+#include <windows.h>
+#include <Shlwapi.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct RELOADSTATS
+{
+	unsigned long long reloads;
+	unsigned long long lastparse_us;   // Time the last reload callback took
+	unsigned long long maxparse_us;
+	unsigned long long lastlatency_ms; // From the file being written to its new contents being published
+	unsigned long long maxlatency_ms;
+};
+
+// Watches files on a background thread. When one of them changes its reload callback
+// runs on that thread, then `message` is posted to `window`.
+// Callbacks do the file I/O and parsing, and must hand over the result as an immutable
+// snapshot through std::atomic_store, so the UI thread never waits for either.
+class ConfigWatcher
+{
+public:
+	typedef std::function<void(const std::wstring &path)> RELOADER;
+
+	ConfigWatcher(HWND window, UINT message) :
+		m_Window(window),
+		m_Message(message),
+		m_Stop(CreateEventW(NULL, TRUE, FALSE, NULL)),
+		m_Reloads(0),
+		m_LastParse(0),
+		m_MaxParse(0),
+		m_LastLatency(0),
+		m_MaxLatency(0)
+	{ }
+
+	~ConfigWatcher()
+	{
+		Stop();
+		CloseHandle(m_Stop);
+	}
+
+	// Only before Start.
+	void Watch(const std::wstring &path, const RELOADER &reload)
+	{
+		wchar_t full[MAX_PATH];
+		if (!GetFullPathNameW(path.c_str(), MAX_PATH, full, NULL))
+		{
+			return;
+		}
+
+		WATCHEDFILE file;
+		file.path = full;
+		PathRemoveFileSpecW(full);
+		file.directory = full;
+		file.reload = reload;
+		file.lastwrite = LastWriteTime(file.path);
+		m_Files.push_back(file);
+	}
+
+	void Start()
+	{
+		if (!m_Thread.joinable() && !m_Files.empty())
+		{
+			m_Thread = std::thread(&ConfigWatcher::Run, this);
+		}
+	}
+
+	void Stop()
+	{
+		if (m_Thread.joinable())
+		{
+			SetEvent(m_Stop);
+			m_Thread.join();
+		}
+	}
+
+	RELOADSTATS Stats() const
+	{
+		return { m_Reloads, m_LastParse, m_MaxParse, m_LastLatency, m_MaxLatency };
+	}
+
+private:
+	static const DWORD SETTLE_DELAY = 50; // Editors often save in several writes, let them finish (ms)
+
+	struct WATCHEDFILE
+	{
+		std::wstring path;
+		std::wstring directory;
+		RELOADER reload;
+		ULONGLONG lastwrite;
+	};
+
+	static ULONGLONG LastWriteTime(const std::wstring &path)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data))
+		{
+			return 0;
+		}
+		return (static_cast<ULONGLONG>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+	}
+
+	static ULONGLONG SystemTime()
+	{
+		FILETIME now;
+		GetSystemTimeAsFileTime(&now);
+		return (static_cast<ULONGLONG>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+	}
+
+	static void Max(std::atomic<unsigned long long> &max, unsigned long long value)
+	{
+		if (value > max)
+		{
+			max = value; // Only this thread writes
+		}
+	}
+
+	void Run()
+	{
+		// The stop event first, then one change notification per directory
+		std::vector<HANDLE> handles(1, m_Stop);
+		std::vector<std::wstring> directories;
+		for (const WATCHEDFILE &file : m_Files)
+		{
+			bool seen = false;
+			for (const std::wstring &directory : directories)
+			{
+				seen = seen || directory == file.directory;
+			}
+			if (seen)
+			{
+				continue;
+			}
+
+			HANDLE change = FindFirstChangeNotificationW(file.directory.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+			if (change != INVALID_HANDLE_VALUE)
+			{
+				handles.push_back(change);
+				directories.push_back(file.directory);
+			}
+		}
+
+		for (;;)
+		{
+			DWORD result = WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), FALSE, INFINITE);
+			if (result == WAIT_OBJECT_0 || result == WAIT_FAILED || WaitForSingleObject(m_Stop, SETTLE_DELAY) == WAIT_OBJECT_0)
+			{
+				break;
+			}
+			FindNextChangeNotification(handles[result - WAIT_OBJECT_0]);
+
+			for (WATCHEDFILE &file : m_Files)
+			{
+				ULONGLONG lastwrite = LastWriteTime(file.path);
+				if (lastwrite == file.lastwrite)
+				{
+					continue;
+				}
+				file.lastwrite = lastwrite;
+
+				auto start = std::chrono::steady_clock::now();
+				file.reload(file.path);
+				unsigned long long parse = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+				ULONGLONG now = SystemTime();
+				unsigned long long latency = now > lastwrite ? (now - lastwrite) / 10000 : 0; // FILETIMEs count 100 ns intervals
+
+				m_LastParse = parse;
+				Max(m_MaxParse, parse);
+				m_LastLatency = latency;
+				Max(m_MaxLatency, latency);
+				m_Reloads++;
+				PostMessage(m_Window, m_Message, 0, 0);
+			}
+		}
+
+		for (size_t i = 1; i < handles.size(); i++)
+		{
+			FindCloseChangeNotification(handles[i]);
+		}
+	}
+
+	HWND m_Window;
+	UINT m_Message;
+	HANDLE m_Stop;
+	std::vector<WATCHEDFILE> m_Files;
+	std::thread m_Thread;
+	std::atomic<unsigned long long> m_Reloads;
+	std::atomic<unsigned long long> m_LastParse;
+	std::atomic<unsigned long long> m_MaxParse;
+	std::atomic<unsigned long long> m_LastLatency;
+	std::atomic<unsigned long long> m_MaxLatency;
+};
@@ -0,0 +1,245 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "eventloop.hpp"
+#include "qualifypipeline.hpp"
+
+const std::size_t DECISION_TRACE_SIZE = 8192; // Records kept, a power of two: a few seconds of a busy desktop
+
+// What made the taskbar look the way it does, one record at a time.
+enum DECISIONKIND
+{
+	DecisionTickBegin,     // The UI thread starts applying a state to the taskbars
+	DecisionTickEnd,       // `arg` is the number of policies it set
+	DecisionPassBegin,     // The classifier starts a pass, `arg` is its PASSREASON flags
+	DecisionPassEnd,       // `arg` is the number of monitors that aren't Normal
+	DecisionQualified,     // Window `subject` can change the taskbar of its monitor
+	DecisionRejected,      // ...or can't, `arg` is the QUALIFYSTAGE that turned it down
+	DecisionTransition,    // Taskbar `subject` went from state `detail` to `arg`, see TransitionDetail
+	DecisionPolicyIssued,  // SetAccentPolicy on taskbar `subject`, `arg` the accent state and `detail` the colour
+	DecisionPolicySkipped, // ...not called, the taskbar already had that policy
+	DECISION_KINDS
+};
+
+// A transition's `detail`: the state it comes from, and the one the taskbar is headed
+// for, which differs from where it ends up when the transition filter holds it back.
+inline std::uint32_t TransitionDetail(unsigned int from, unsigned int target)
+{
+	return (from & 0xFFFF) | (target << 16);
+}
+
+// Read for every record, so it has to be cheap: the processor's time stamp counter where
+// there is one, a few cycles against tens of ns for steady_clock. DecisionTrace turns it
+// into time with two steady_clock readings, when the trace is read.
+inline std::uint64_t DecisionClock()
+{
+#if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+struct DECISION
+{
+	std::uint64_t time; // DecisionClock ticks since the trace was created, ns once read
+	std::uint64_t subject;
+	DECISIONKIND kind;
+	std::uint32_t arg;
+	std::uint32_t detail;
+};
+
+// The last DECISION_TRACE_SIZE decisions the classifier and the taskbar controller made,
+// so what a user saw the taskbar do ("it flickers when I drag Excel") can be looked at
+// afterwards in a trace viewer, from ChromeTrace().
+//
+// Always on: the memory is taken once, and Emit never locks nor allocates, it takes a
+// slot with a single atomic increment and fills it in. Any thread can emit. A record is
+// only read once its slot says it is complete and still the one that was asked for, so
+// a reader gets every record that was finished and not yet overwritten, and nothing else.
+class DecisionTrace
+{
+public:
+	DecisionTrace() :
+		m_Slots(new SLOT[DECISION_TRACE_SIZE]()),
+		m_Next(0),
+		m_Epoch(std::chrono::steady_clock::now()),
+		m_EpochTicks(DecisionClock())
+	{ }
+
+	void Emit(DECISIONKIND kind, std::uint64_t subject = 0, std::uint32_t arg = 0, std::uint32_t detail = 0)
+	{
+		std::uint64_t index = m_Next.fetch_add(1, std::memory_order_relaxed);
+		SLOT &slot = m_Slots[index & (DECISION_TRACE_SIZE - 1)];
+
+		// Odd while it is written, so a reader can tell
+		slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.time.store(DecisionClock() - m_EpochTicks, std::memory_order_relaxed);
+		slot.subject.store(subject, std::memory_order_relaxed);
+		slot.kind.store(kind, std::memory_order_relaxed);
+		slot.arg.store(arg, std::memory_order_relaxed);
+		slot.detail.store(detail, std::memory_order_relaxed);
+		slot.sequence.store(2 * index + 2, std::memory_order_release);
+	}
+
+	// Records emitted so far, including the ones overwritten since.
+	unsigned long long Emitted() const { return m_Next.load(std::memory_order_relaxed); }
+
+	// Copies out the records still in the ring, oldest first.
+	void Read(std::vector<DECISION> &records) const
+	{
+		// However fast the clock ticks, it did so since the trace was created
+		double elapsed = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Epoch).count());
+		std::uint64_t ticks = DecisionClock() - m_EpochTicks;
+		double ns_per_tick = ticks ? elapsed / ticks : 1.0;
+
+		records.clear();
+		std::uint64_t next = m_Next.load(std::memory_order_acquire);
+		for (std::uint64_t index = next > DECISION_TRACE_SIZE ? next - DECISION_TRACE_SIZE : 0; index < next; index++)
+		{
+			const SLOT &slot = m_Slots[index & (DECISION_TRACE_SIZE - 1)];
+			std::uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+			DECISION record;
+			record.time = static_cast<std::uint64_t>(slot.time.load(std::memory_order_relaxed) * ns_per_tick);
+			record.subject = slot.subject.load(std::memory_order_relaxed);
+			record.kind = static_cast<DECISIONKIND>(slot.kind.load(std::memory_order_relaxed));
+			record.arg = slot.arg.load(std::memory_order_relaxed);
+			record.detail = slot.detail.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence == 2 * index + 2 && slot.sequence.load(std::memory_order_relaxed) == sequence)
+			{
+				records.push_back(record); // Neither being written nor overwritten while it was copied
+			}
+		}
+	}
+
+	// The records in the Trace Event Format that chrome://tracing, Perfetto and
+	// speedscope open: passes and ticks as spans on the classifier and UI threads,
+	// everything else as instant events with their details as arguments.
+	std::string ChromeTrace() const
+	{
+		std::vector<DECISION> records;
+		Read(records);
+
+		std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+			"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"UI thread\"}},\n"
+			"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"Classifier\"}}";
+		json.reserve(json.size() + records.size() * 160);
+
+		bool open[3] = { }; // Per thread, whether a span began: a ring starting halfway through one doesn't end it
+		char event[320];
+		for (const DECISION &record : records)
+		{
+			int thread = Thread(record.kind);
+			double ts = record.time / 1000.0;
+			int length = 0;
+			switch (record.kind)
+			{
+			case DecisionTickBegin:
+				open[thread] = true;
+				length = std::snprintf(event, sizeof(event), "{\"name\":\"tick\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", ts, thread);
+				break;
+			case DecisionPassBegin:
+				open[thread] = true;
+				length = std::snprintf(event, sizeof(event), "{\"name\":\"pass\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"reason\":\"%s\"}}",
+					ts, thread, ReasonName(record.arg).c_str());
+				break;
+			case DecisionTickEnd:
+			case DecisionPassEnd:
+				if (!open[thread])
+				{
+					continue;
+				}
+				open[thread] = false;
+				length = std::snprintf(event, sizeof(event), "{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"%s\":%u}}",
+					ts, thread, record.kind == DecisionTickEnd ? "policies" : "monitors", record.arg);
+				break;
+			case DecisionQualified:
+				length = std::snprintf(event, sizeof(event), "{\"name\":\"qualified\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"window\":\"0x%llx\"}}",
+					ts, thread, static_cast<unsigned long long>(record.subject));
+				break;
+			case DecisionRejected:
+				length = std::snprintf(event, sizeof(event), "{\"name\":\"rejected\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"window\":\"0x%llx\",\"check\":\"%ls\"}}",
+					ts, thread, static_cast<unsigned long long>(record.subject), StageName(static_cast<QUALIFYSTAGE>(record.arg)));
+				break;
+			case DecisionTransition:
+				length = std::snprintf(event, sizeof(event), "{\"name\":\"transition\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"taskbar\":\"0x%llx\",\"from\":\"%s\",\"to\":\"%s\",\"target\":\"%s\"}}",
+					ts, thread, static_cast<unsigned long long>(record.subject), StateName(record.detail & 0xFFFF), StateName(record.arg), StateName(record.detail >> 16));
+				break;
+			default:
+				length = std::snprintf(event, sizeof(event), "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"taskbar\":\"0x%llx\",\"accent\":%u,\"color\":\"0x%08x\"}}",
+					record.kind == DecisionPolicyIssued ? "policy" : "policy skipped", ts, thread, static_cast<unsigned long long>(record.subject), record.arg, record.detail);
+				break;
+			}
+			json += ",\n";
+			json.append(event, length > 0 && length < static_cast<int>(sizeof(event)) ? length : 0);
+		}
+		json += "\n]}\n";
+		return json;
+	}
+
+private:
+	struct SLOT
+	{
+		std::atomic<std::uint64_t> sequence; // 2 * index + 2 once record `index` is complete, 0 if none ever was
+		std::atomic<std::uint64_t> time;
+		std::atomic<std::uint64_t> subject;
+		std::atomic<std::uint32_t> kind;
+		std::atomic<std::uint32_t> arg;
+		std::atomic<std::uint32_t> detail;
+	};
+
+	// 1 for what the UI thread does, 2 for the classifier, whichever thread it runs on.
+	static int Thread(DECISIONKIND kind)
+	{
+		return kind == DecisionPassBegin || kind == DecisionPassEnd || kind == DecisionQualified || kind == DecisionRejected ? 2 : 1;
+	}
+
+	// A TASKBARSTATE, which windowclassifier.hpp can't be included here for.
+	static const char *StateName(std::uint32_t state)
+	{
+		switch (state)
+		{
+		case 0: return "normal";
+		case 1: return "maximised";
+		default: return "start";
+		}
+	}
+
+	static std::string ReasonName(std::uint32_t reason)
+	{
+		const std::pair<PASSREASON, const char *> NAMES[] = {
+			{ PassWindows, "windows" }, { PassForeground, "foreground" }, { PassMonitors, "monitors" }, { PassRefresh, "refresh" }, { PassSettings, "settings" }
+		};
+		std::string name;
+		for (const auto &entry : NAMES)
+		{
+			if (reason & entry.first)
+			{
+				name += name.empty() ? "" : " ";
+				name += entry.second;
+			}
+		}
+		return name;
+	}
+
+	std::unique_ptr<SLOT[]> m_Slots;
+	std::atomic<std::uint64_t> m_Next;
+	std::chrono::steady_clock::time_point m_Epoch;
+	std::uint64_t m_EpochTicks;
+};
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+
+#include "arena.hpp"
+#include "backend.hpp"
+#include "eventloop.hpp"
+
+struct DESKTOPCACHESTATS
+{
+	unsigned long long hits;     // Answers reused
+	unsigned long long queries;  // IsWindowOnCurrentDesktop calls, a cross-apartment COM call each on Windows
+	unsigned long long moves;    // Windows cloaked or uncloaked, whose answer was forgotten
+	unsigned long long switches; // Times the current virtual desktop changed, which forgets every answer
+};
+
+// Remembers whether each window is on the current virtual desktop. That can only change
+// when the user switches desktops, or moves a window to another one; Windows cloaks or
+// uncloaks the window either way, so an answer holds until the window gets a
+// WindowCloaked event, or a DesktopSwitched event forgets them all.
+class DesktopMembershipCache
+{
+public:
+	explicit DesktopMembershipCache(Backend &backend) :
+		m_Backend(backend),
+		m_Members(0, std::hash<WINDOWID>(), std::equal_to<WINDOWID>(), MEMBERMAP::allocator_type(m_Pool)),
+		m_Stats()
+	{ }
+
+	bool IsOnCurrentDesktop(WINDOWID window)
+	{
+		auto it = m_Members.find(window);
+		if (it != m_Members.end())
+		{
+			m_Stats.hits++;
+			return it->second;
+		}
+
+		m_Stats.queries++;
+		bool member = m_Backend.IsWindowOnCurrentDesktop(window);
+		m_Members.emplace(window, member);
+		return member;
+	}
+
+	void OnEvent(const EVENT &ev)
+	{
+		switch (ev.type)
+		{
+		case WindowCloaked:
+			m_Stats.moves += m_Members.erase(ev.window);
+			break;
+		case WindowDestroyed:
+			m_Members.erase(ev.window);
+			break;
+		case DesktopSwitched:
+			m_Stats.switches++;
+			m_Members.clear();
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Called with the size of a full enumeration. Destroyed windows are forgotten as
+	// their events arrive, holding more than that means some were missed.
+	void Trim(std::size_t windows)
+	{
+		if (m_Members.size() > windows)
+		{
+			m_Members.clear();
+		}
+	}
+
+	void Clear() { m_Members.clear(); }
+
+	const DESKTOPCACHESTATS &Stats() const { return m_Stats; }
+
+private:
+	// Windows are forgotten and asked about again all the time, the nodes are recycled
+	typedef std::unordered_map<WINDOWID, bool, std::hash<WINDOWID>, std::equal_to<WINDOWID>, PoolAllocator<std::pair<const WINDOWID, bool>>> MEMBERMAP;
+
+	Backend &m_Backend;
+	NodePool m_Pool; // Before the map, which gives its nodes back when destroyed
+	MEMBERMAP m_Members;
+	DESKTOPCACHESTATS m_Stats;
+};
@@ -0,0 +1,338 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Portable part of the main loop. Nothing in here knows about Win32, so the
+// same scheduler can be driven by the real desktop (win32eventsource.hpp) or
+// by a scripted, headless one (simulatedeventsource.hpp).
+
+typedef std::uintptr_t WINDOWID;  // An opaque window identifier (a HWND on Windows)
+typedef std::uintptr_t MONITORID; // An opaque monitor identifier (a HMONITOR on Windows)
+
+const std::uint32_t DEFAULT_REFRESH_INTERVAL = 1000; // Run a pass at least this often (ms), in case Explorer reset the taskbar on its own
+const std::uint32_t DEFAULT_MIN_PASS_INTERVAL = 50;  // Coalesce events arriving faster than this (ms), e.g. while dragging a window
+const std::uint32_t MAX_MIN_PASS_INTERVAL = 1000;    // Highest `latency` the config file can set (ms), the refresh interval takes over past it
+const std::uint32_t DEFAULT_MAX_REFRESH_INTERVAL = 8000; // The refresh interval doubles while nothing happens, up to this (ms)
+
+// How often the scheduler runs passes, see Scheduler. Set from the `latency` and `cpu`
+// config keys.
+struct SCHEDULEROPTIONS
+{
+	std::uint32_t min_pass_interval;    // The latency budget: how long events may be held back to be coalesced
+	std::uint32_t refresh_interval;     // Refresh interval right after something happened
+	std::uint32_t max_refresh_interval; // Refresh interval once the desktop has been idle for a while
+};
+
+const SCHEDULEROPTIONS DEFAULT_SCHEDULING = { DEFAULT_MIN_PASS_INTERVAL, DEFAULT_REFRESH_INTERVAL, DEFAULT_MAX_REFRESH_INTERVAL };
+const SCHEDULEROPTIONS MINIMAL_CPU_SCHEDULING = { DEFAULT_MIN_PASS_INTERVAL, 2000, 60000 }; // cpu=minimal, for laptops on battery
+const std::uint32_t DYNAMIC_WS_MAX_REFRESH_INTERVAL = 2000; // How far the refresh interval backs off while dynamic-ws is on (ms)
+
+// What to run the scheduler with. A window that maximises, restores or goes full screen
+// on its own while it isn't in the foreground raises no event we listen to (see
+// Win32EventSource), only a refresh notices it. With dynamic-ws on that would leave the
+// taskbar wrong for as long as the refresh backed off to, so it backs off no further than
+// DYNAMIC_WS_MAX_REFRESH_INTERVAL, or refresh_interval when that is longer.
+inline SCHEDULEROPTIONS EffectiveScheduling(const SCHEDULEROPTIONS &options, bool dynamicws)
+{
+	SCHEDULEROPTIONS effective = options;
+	if (dynamicws && effective.max_refresh_interval > DYNAMIC_WS_MAX_REFRESH_INTERVAL)
+	{
+		effective.max_refresh_interval = effective.refresh_interval > DYNAMIC_WS_MAX_REFRESH_INTERVAL ? effective.refresh_interval : DYNAMIC_WS_MAX_REFRESH_INTERVAL;
+	}
+	return effective;
+}
+
+enum EVENTTYPE
+{
+	WindowChanged,     // A window was shown, hidden, moved, sized, minimised or restored
+	WindowRenamed,     // A window's title changed
+	WindowDestroyed,   // A window was destroyed
+	ForegroundChanged, // The foreground window changed
+	MonitorsChanged,   // A monitor was added, removed, or its resolution changed
+	SettingsChanged,   // The user changed an option, everything should be re-evaluated
+	QuitRequested,     // The loop should exit
+	// Traces store these numbers, new ones go last
+	WindowCloaked,     // A window was cloaked or uncloaked, by switching or moving it to another virtual desktop
+	DesktopSwitched    // The current virtual desktop changed
+};
+
+struct EVENT
+{
+	EVENTTYPE type;
+	WINDOWID window; // 0 when the event is not about a particular window
+};
+
+class EventSource
+{
+public:
+	virtual ~EventSource() { }
+
+	// Current time in milliseconds. Only differences are meaningful.
+	virtual std::uint64_t Now() = 0;
+
+	// Blocks until an event is available or timeout milliseconds have passed.
+	// Returns false when the timeout expired without an event.
+	virtual bool WaitForEvent(std::uint32_t timeout, EVENT &ev) = 0;
+};
+
+// What made the scheduler run a pass, so the pass can skip work that isn't needed.
+enum PASSREASON
+{
+	PassWindows    = 1 << 0, // Some window changed state
+	PassForeground = 1 << 1, // The foreground window changed
+	PassMonitors   = 1 << 2, // The monitor layout changed, taskbar handles should be refreshed
+	PassRefresh    = 1 << 3, // Periodic refresh timer expired
+	PassSettings   = 1 << 4  // The user changed an option, re-evaluate everything
+};
+
+struct SCHEDULERSTATS
+{
+	std::uint64_t wakeups; // Number of times WaitForEvent returned
+	std::uint64_t events;  // Number of events received
+	std::uint64_t passes;  // Number of times the pass callback ran
+	std::uint64_t refreshes;     // Passes run only because the refresh timer expired
+	std::uint64_t backoffs;      // Times the refresh interval doubled
+	std::uint64_t totalinterval; // Time between passes (ms), divide by passes for the average
+	std::uint64_t maxinterval;   // Longest time without a pass (ms)
+	std::uint64_t parks;         // Times every taskbar got hidden behind a fullscreen window
+	std::uint64_t parked_ms;     // Time spent parked
+	std::uint64_t ignored;       // Events that came while parked and couldn't have ended it
+};
+
+class Scheduler
+{
+public:
+	// refresh_interval: how often a pass runs when nothing happens, to catch anything the
+	//                   events missed (e.g. Explorer resetting the taskbar on its own).
+	// min_pass_interval: minimum time between two passes. Events arriving faster than this
+	//                    (e.g. while a window is being dragged) are coalesced into a single pass.
+	//                    Foreground changes don't wait for it.
+	// max_refresh_interval: each refresh that no event came before doubles the refresh interval,
+	//                       up to this. Any event, or a call to Activity, starts it over from
+	//                       refresh_interval. 0 keeps it at refresh_interval.
+	Scheduler(EventSource &source, std::uint32_t refresh_interval, std::uint32_t min_pass_interval, std::uint32_t max_refresh_interval = 0) :
+		m_Source(source),
+		m_Interval(0),
+		m_Parked(false),
+		m_ParkedSince(0),
+		m_Stats()
+	{
+		SetOptions({ min_pass_interval, refresh_interval, max_refresh_interval });
+	}
+
+	Scheduler(EventSource &source, const SCHEDULEROPTIONS &options) :
+		m_Source(source),
+		m_Interval(0),
+		m_Parked(false),
+		m_ParkedSince(0),
+		m_Stats()
+	{
+		SetOptions(options);
+	}
+
+	// Takes effect from the next pass on. Call it from the thread running Run.
+	void SetOptions(const SCHEDULEROPTIONS &options)
+	{
+		m_RefreshInterval = options.refresh_interval;
+		m_MinPassInterval = options.min_pass_interval;
+		m_MaxRefreshInterval = options.max_refresh_interval > options.refresh_interval ? options.max_refresh_interval : options.refresh_interval;
+		m_Interval = m_RefreshInterval;
+	}
+
+	// Something changed that no event told about, e.g. a refresh pass found a taskbar to fix:
+	// the desktop isn't idle after all, so the refresh interval starts over after the refresh
+	// already planned. Call it from the thread running Run.
+	void Activity()
+	{
+		m_Interval = m_RefreshInterval;
+	}
+
+	// Every taskbar is hidden behind a fullscreen window, so there is nothing to keep up to
+	// date: no pass runs, not even a refresh, until an event might have ended it. That is
+	// the foreground, the monitors, the settings or the virtual desktop changing, or one of
+	// `watched` (the fullscreen windows) changing or going away; the pass it causes also
+	// covers every event that came in the meantime, `on_event` still sees them as they
+	// arrive. Call it from the thread running Run, again whenever `watched` changes.
+	void Park(const std::vector<WINDOWID> &watched)
+	{
+		m_Watched.assign(watched.begin(), watched.end());
+		if (!m_Parked)
+		{
+			m_Parked = true;
+			m_ParkedSince = m_Source.Now();
+			m_Stats.parks++;
+		}
+	}
+
+	void Unpark()
+	{
+		if (m_Parked)
+		{
+			m_Parked = false;
+			m_Stats.parked_ms += m_Source.Now() - m_ParkedSince;
+		}
+	}
+
+	bool Parked() const { return m_Parked; }
+
+	// Runs until a QuitRequested event is received.
+	// `pass` receives a combination of PASSREASON flags, and `on_event` (if set) sees every event
+	// as it arrives, before it is coalesced.
+	void Run(const std::function<void(unsigned int)> &pass, const std::function<void(const EVENT &)> &on_event = nullptr)
+	{
+		std::uint64_t now = m_Source.Now();
+		std::uint64_t last_pass = now;
+		std::uint64_t next_refresh = now + m_RefreshInterval;
+		m_Interval = m_RefreshInterval;
+		unsigned int pending = 0;
+
+		for (;;)
+		{
+			now = m_Source.Now();
+
+			// Wait for the refresh timer, or for the end of the throttle window when
+			// there is already something pending.
+			std::uint64_t deadline = next_refresh;
+			if (pending && last_pass + m_MinPassInterval < deadline)
+			{
+				deadline = last_pass + m_MinPassInterval;
+			}
+			std::uint32_t timeout = deadline > now ? static_cast<std::uint32_t>(deadline - now) : 0;
+			if (m_Parked)
+			{
+				timeout = PARKED_TIMEOUT;
+			}
+
+			EVENT ev;
+			bool got_event = m_Source.WaitForEvent(timeout, ev);
+			m_Stats.wakeups++;
+
+			if (got_event)
+			{
+				m_Stats.events++;
+				if (ev.type == QuitRequested)
+				{
+					Unpark(); // Counts the time parked so far
+					return;
+				}
+
+				if (on_event)
+				{
+					on_event(ev);
+				}
+				pending |= ReasonFor(ev.type);
+				m_Interval = m_RefreshInterval; // Someone is using the desktop
+
+				if (m_Parked && Wakes(ev))
+				{
+					Unpark();
+				}
+				else if (m_Parked)
+				{
+					m_Stats.ignored++;
+				}
+			}
+
+			if (m_Parked)
+			{
+				continue; // Parked while waiting, or an event that can't have changed anything
+			}
+
+			now = m_Source.Now();
+			if (now >= next_refresh)
+			{
+				pending |= PassRefresh;
+			}
+
+			// A foreground change is a single click or key press, it never comes in bursts
+			// like a drag does, so it isn't held back: the Start menu opening shows right away.
+			if (pending && (now >= last_pass + m_MinPassInterval || (pending & PassForeground)))
+			{
+				if (pending == PassRefresh)
+				{
+					// Nothing happened since the last pass. If this one doesn't find anything
+					// either, it's not worth checking as often.
+					m_Stats.refreshes++;
+					Backoff();
+				}
+				m_Stats.totalinterval += now - last_pass;
+				if (now - last_pass > m_Stats.maxinterval)
+				{
+					m_Stats.maxinterval = now - last_pass;
+				}
+
+				pass(pending);
+				m_Stats.passes++;
+				pending = 0;
+				last_pass = now;
+				next_refresh = now + m_Interval;
+			}
+		}
+	}
+
+	const SCHEDULERSTATS &Stats() const { return m_Stats; }
+	std::uint32_t RefreshInterval() const { return m_Interval; }
+
+private:
+	static const std::uint32_t PARKED_TIMEOUT = 0xFFFFFFFF; // INFINITE on Windows
+
+	bool Wakes(const EVENT &ev) const
+	{
+		switch (ev.type)
+		{
+		case ForegroundChanged:
+		case MonitorsChanged:
+		case SettingsChanged:
+		case DesktopSwitched:
+			return true;
+		case WindowChanged:
+		case WindowCloaked:
+		case WindowDestroyed:
+			return std::find(m_Watched.begin(), m_Watched.end(), ev.window) != m_Watched.end();
+		default:
+			return false;
+		}
+	}
+
+	void Backoff()
+	{
+		if (m_Interval < m_MaxRefreshInterval)
+		{
+			m_Interval = m_Interval > m_MaxRefreshInterval / 2 ? m_MaxRefreshInterval : m_Interval * 2;
+			m_Stats.backoffs++;
+		}
+	}
+
+	static unsigned int ReasonFor(EVENTTYPE type)
+	{
+		switch (type)
+		{
+		case WindowChanged:
+		case WindowRenamed:
+		case WindowDestroyed:
+		case WindowCloaked:
+		case DesktopSwitched:
+			return PassWindows;
+		case ForegroundChanged:
+			return PassForeground;
+		case MonitorsChanged:
+			return PassMonitors;
+		case SettingsChanged:
+			return PassSettings;
+		default:
+			return 0;
+		}
+	}
+
+	EventSource &m_Source;
+	std::uint32_t m_RefreshInterval;
+	std::uint32_t m_MinPassInterval;
+	std::uint32_t m_MaxRefreshInterval;
+	std::uint32_t m_Interval; // Current refresh interval, between m_RefreshInterval and m_MaxRefreshInterval
+	bool m_Parked;
+	std::uint64_t m_ParkedSince;
+	std::vector<WINDOWID> m_Watched; // What can end the parking, besides the foreground changing
+	SCHEDULERSTATS m_Stats;
+};
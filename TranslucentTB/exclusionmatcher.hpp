@@ -0,0 +1,282 @@
+#pragma once
+#include <cstddef>
+#include <cwctype>
+#include <map>
+#include <queue>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "patternautomaton.hpp"
+
+// Rules as read from the exclusion file, before they are compiled.
+struct EXCLUSIONRULES
+{
+	std::vector<std::wstring> classes; // Exact window class names
+	std::vector<std::wstring> exes;    // Exact executable names
+	std::vector<std::wstring> titles;  // Substrings of window titles
+	std::vector<std::wstring> classglobs;   // Globs matching whole window class names
+	std::vector<std::wstring> exeglobs;     // Globs matching whole executable names
+	std::vector<std::wstring> titleregexes; // Regular expressions searched for in window titles
+};
+
+enum CASEFOLDING
+{
+	FoldClassNames = 1 << 0,
+	FoldExeNames   = 1 << 1,
+	FoldTitles     = 1 << 2
+};
+
+inline wchar_t FoldCase(wchar_t c)
+{
+	return static_cast<wchar_t>(std::towlower(c));
+}
+
+inline std::wstring FoldCase(std::wstring str)
+{
+	for (wchar_t &c : str)
+	{
+		c = FoldCase(c);
+	}
+	return str;
+}
+
+// Aho-Corasick automaton: tells whether a text contains any of a set of patterns,
+// looking at each character of the text once no matter how many patterns there are.
+class SubstringAutomaton
+{
+public:
+	explicit SubstringAutomaton(const std::vector<std::wstring> &patterns, bool fold = false) : m_Fold(fold)
+	{
+		// Build the trie. Node 0 is the root.
+		std::vector<std::map<wchar_t, unsigned int>> trie(1);
+		std::vector<bool> output(1, false);
+		for (const std::wstring &pattern : patterns)
+		{
+			if (pattern.empty())
+			{
+				continue; // Would match every window, almost certainly a stray delimiter
+			}
+
+			unsigned int node = 0;
+			for (wchar_t c : pattern)
+			{
+				c = m_Fold ? FoldCase(c) : c;
+				auto it = trie[node].find(c);
+				if (it == trie[node].end())
+				{
+					unsigned int next = static_cast<unsigned int>(trie.size());
+					trie[node][c] = next;
+					trie.emplace_back();
+					output.push_back(false);
+					node = next;
+				}
+				else
+				{
+					node = it->second;
+				}
+			}
+			output[node] = true;
+		}
+
+		// Flatten it, edges of a node are contiguous and sorted by character.
+		m_Nodes.resize(trie.size());
+		for (size_t i = 0; i < trie.size(); i++)
+		{
+			m_Nodes[i].first_edge = static_cast<unsigned int>(m_Edges.size());
+			m_Nodes[i].edge_count = static_cast<unsigned int>(trie[i].size());
+			m_Nodes[i].fail = 0;
+			m_Nodes[i].output = output[i];
+			for (const auto &edge : trie[i])
+			{
+				m_Edges.push_back({ edge.first, edge.second });
+			}
+		}
+
+		// Failure links, breadth first so a node's fail target is always done before it.
+		// A node also matches if anything along its failure chain does.
+		std::queue<unsigned int> pending;
+		for (const auto &edge : trie[0])
+		{
+			pending.push(edge.second);
+		}
+		while (!pending.empty())
+		{
+			unsigned int node = pending.front();
+			pending.pop();
+			for (const auto &edge : trie[node])
+			{
+				unsigned int child = edge.second;
+				m_Nodes[child].fail = Step(m_Nodes[node].fail, edge.first);
+				m_Nodes[child].output = m_Nodes[child].output || m_Nodes[m_Nodes[child].fail].output;
+				pending.push(child);
+			}
+		}
+	}
+
+	bool Empty() const { return m_Nodes.size() <= 1; }
+
+	bool Matches(const wchar_t *text, size_t length) const
+	{
+		if (Empty())
+		{
+			return false;
+		}
+
+		unsigned int node = 0;
+		for (size_t i = 0; i < length; i++)
+		{
+			node = Step(node, m_Fold ? FoldCase(text[i]) : text[i]);
+			if (m_Nodes[node].output)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+private:
+	struct NODE
+	{
+		unsigned int first_edge;
+		unsigned int edge_count;
+		unsigned int fail;
+		bool output;
+	};
+	struct EDGE
+	{
+		wchar_t c;
+		unsigned int target;
+	};
+
+	unsigned int Step(unsigned int node, wchar_t c) const
+	{
+		for (;;)
+		{
+			const NODE &n = m_Nodes[node];
+
+			// Binary search among this node's edges
+			unsigned int lo = n.first_edge, hi = n.first_edge + n.edge_count;
+			while (lo < hi)
+			{
+				unsigned int mid = lo + (hi - lo) / 2;
+				if (m_Edges[mid].c < c)
+				{
+					lo = mid + 1;
+				}
+				else
+				{
+					hi = mid;
+				}
+			}
+			if (lo < n.first_edge + n.edge_count && m_Edges[lo].c == c)
+			{
+				return m_Edges[lo].target;
+			}
+
+			if (node == 0)
+			{
+				return 0;
+			}
+			node = n.fail;
+		}
+	}
+
+	bool m_Fold;
+	std::vector<NODE> m_Nodes;
+	std::vector<EDGE> m_Edges;
+};
+
+// The exclusion rules, compiled once when they are loaded: class and executable
+// names become hash lookups, all title substrings a single automaton, and the globs
+// and regular expressions one automaton per attribute. It is immutable once built,
+// so a new one can be swapped in while the old one is in use.
+class ExclusionMatcher
+{
+public:
+	explicit ExclusionMatcher(const EXCLUSIONRULES &rules, unsigned int casefolding = FoldClassNames | FoldExeNames) :
+		m_Rules(rules),
+		m_Folding(casefolding),
+		m_Titles(rules.titles, (casefolding & FoldTitles) != 0),
+		m_ClassPatterns(GlobsToRegexes(rules.classglobs), (casefolding & FoldClassNames) != 0, &m_Errors),
+		m_ExePatterns(GlobsToRegexes(rules.exeglobs), (casefolding & FoldExeNames) != 0, &m_Errors),
+		m_TitlePatterns(rules.titleregexes, (casefolding & FoldTitles) != 0, &m_Errors)
+	{
+		for (const std::wstring &name : rules.classes)
+		{
+			m_Classes.insert((m_Folding & FoldClassNames) ? FoldCase(name) : name);
+		}
+		for (const std::wstring &name : rules.exes)
+		{
+			m_Exes.insert((m_Folding & FoldExeNames) ? FoldCase(name) : name);
+		}
+	}
+
+	// Lets callers avoid fetching a window attribute that no rule looks at.
+	bool HasClassRules() const { return !m_Classes.empty() || !m_ClassPatterns.Empty(); }
+	bool HasExeRules() const { return !m_Exes.empty() || !m_ExePatterns.Empty(); }
+	bool HasTitleRules() const { return !m_Titles.Empty() || !m_TitlePatterns.Empty(); }
+
+	// These two fold the name to lower case in place when the rules are case insensitive,
+	// so matching doesn't have to allocate a folded copy.
+	bool MatchesClass(std::wstring &classname) const
+	{
+		return Contains(m_Classes, classname, (m_Folding & FoldClassNames) != 0) ||
+			m_ClassPatterns.Matches(classname.c_str(), classname.length());
+	}
+
+	bool MatchesExe(std::wstring &exename) const
+	{
+		return Contains(m_Exes, exename, (m_Folding & FoldExeNames) != 0) ||
+			m_ExePatterns.Matches(exename.c_str(), exename.length());
+	}
+
+	bool MatchesTitle(const wchar_t *title, size_t length) const
+	{
+		return m_Titles.Matches(title, length) || m_TitlePatterns.Matches(title, length);
+	}
+
+	// Globs and regular expressions that couldn't be compiled, and were left out.
+	const std::vector<std::wstring> &Errors() const { return m_Errors; }
+
+	// What the matcher was built from, so a trace can record it (tracerecorder.hpp).
+	const EXCLUSIONRULES &Rules() const { return m_Rules; }
+	unsigned int Folding() const { return m_Folding; }
+
+private:
+	static std::vector<std::wstring> GlobsToRegexes(const std::vector<std::wstring> &globs)
+	{
+		std::vector<std::wstring> regexes;
+		for (const std::wstring &glob : globs)
+		{
+			regexes.push_back(PatternAutomaton::GlobToRegex(glob));
+		}
+		return regexes;
+	}
+
+	static bool Contains(const std::unordered_set<std::wstring> &set, std::wstring &value, bool fold)
+	{
+		if (set.empty())
+		{
+			return false;
+		}
+		if (fold)
+		{
+			for (wchar_t &c : value)
+			{
+				c = FoldCase(c);
+			}
+		}
+		return set.count(value) != 0;
+	}
+
+	EXCLUSIONRULES m_Rules;
+	unsigned int m_Folding;
+	std::vector<std::wstring> m_Errors; // Before the automata, which fill it
+	std::unordered_set<std::wstring> m_Classes;
+	std::unordered_set<std::wstring> m_Exes;
+	SubstringAutomaton m_Titles;
+	PatternAutomaton m_ClassPatterns;
+	PatternAutomaton m_ExePatterns;
+	PatternAutomaton m_TitlePatterns;
+};
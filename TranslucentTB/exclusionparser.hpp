@@ -0,0 +1,185 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "exclusionmatcher.hpp"
+
+struct PARSEERROR
+{
+	std::size_t line; // 1-based
+	std::wstring message;
+};
+
+// Reads exclusion rules, one rule type per line followed by its values:
+//
+//   class, ConsoleWindowClass, Progman
+//   title, Command Prompt
+//   exename, cmd.exe
+//   classglob, Chrome_WidgetWin_*
+//   exeglob, *setup*.exe
+//   titlere, ^Microsoft Teams.*Meeting
+//
+// Everything after a ';' is a comment. A rule type can appear on several lines, the
+// values add up. Globs and regular expressions are checked against what
+// PatternAutomaton supports as they are read, so a bad one is reported with its line
+// and left out. Each character is looked at a fixed number of times, and the only
+// allocations are the rules themselves, so loading time grows linearly with file size.
+class ExclusionParser
+{
+public:
+	ExclusionParser(EXCLUSIONRULES &rules, std::vector<PARSEERROR> &errors) : m_Rules(rules), m_Errors(errors), m_Line(0) { }
+
+	// The text can be cut anywhere, even in the middle of a line.
+	void Feed(const wchar_t *text, std::size_t length)
+	{
+		const wchar_t *end = text + length;
+		while (text != end)
+		{
+			const wchar_t *newline = std::find(text, end, L'\n');
+			if (newline == end)
+			{
+				m_Partial.append(text, end);
+				return;
+			}
+
+			if (m_Partial.empty())
+			{
+				ParseLine(text, newline);
+			}
+			else
+			{
+				m_Partial.append(text, newline);
+				ParseLine(m_Partial.data(), m_Partial.data() + m_Partial.size());
+				m_Partial.clear();
+			}
+			text = newline + 1;
+		}
+	}
+
+	// Call once all the text was fed, for the last line when it doesn't end with a newline.
+	void Finish()
+	{
+		if (!m_Partial.empty())
+		{
+			ParseLine(m_Partial.data(), m_Partial.data() + m_Partial.size());
+			m_Partial.clear();
+		}
+	}
+
+private:
+	// Part of a line, pointing into the text being parsed
+	struct TOKEN
+	{
+		const wchar_t *begin;
+		const wchar_t *end;
+	};
+
+	static bool IsBlank(wchar_t c)
+	{
+		return c == L' ' || c == L'\t' || c == L'\r';
+	}
+
+	static TOKEN Trim(const wchar_t *begin, const wchar_t *end)
+	{
+		while (begin != end && IsBlank(*begin)) { begin++; }
+		while (end != begin && IsBlank(*(end - 1))) { end--; }
+		return { begin, end };
+	}
+
+	static bool KeyIs(TOKEN key, const wchar_t *name)
+	{
+		for (const wchar_t *c = key.begin; c != key.end; c++, name++)
+		{
+			if (!*name || FoldCase(*c) != *name)
+			{
+				return false;
+			}
+		}
+		return !*name;
+	}
+
+	std::vector<std::wstring> *ListFor(TOKEN key)
+	{
+		if (KeyIs(key, L"class")) { return &m_Rules.classes; }
+		if (KeyIs(key, L"title") || KeyIs(key, L"windowtitle")) { return &m_Rules.titles; }
+		if (KeyIs(key, L"exename")) { return &m_Rules.exes; }
+		if (KeyIs(key, L"classglob")) { return &m_Rules.classglobs; }
+		if (KeyIs(key, L"exeglob")) { return &m_Rules.exeglobs; }
+		if (KeyIs(key, L"titlere")) { return &m_Rules.titleregexes; }
+		return nullptr;
+	}
+
+	bool IsPatternList(const std::vector<std::wstring> *list) const
+	{
+		return list == &m_Rules.classglobs || list == &m_Rules.exeglobs || list == &m_Rules.titleregexes;
+	}
+
+	bool CheckPattern(const std::vector<std::wstring> *list, const std::wstring &value)
+	{
+		std::wstring error;
+		if (PatternAutomaton::Check(list == &m_Rules.titleregexes ? value : PatternAutomaton::GlobToRegex(value), error))
+		{
+			return true;
+		}
+		Error(L"'" + value + L"': " + error);
+		return false;
+	}
+
+	void Error(const std::wstring &message)
+	{
+		m_Errors.push_back({ m_Line, message });
+	}
+
+	void ParseLine(const wchar_t *begin, const wchar_t *end)
+	{
+		m_Line++;
+		end = std::find(begin, end, L';'); // Strip comments
+
+		const wchar_t *comma = std::find(begin, end, L',');
+		TOKEN key = Trim(begin, comma);
+		if (key.begin == key.end)
+		{
+			if (comma != end)
+			{
+				Error(L"missing rule type before ','");
+			}
+			return; // Blank line
+		}
+
+		std::vector<std::wstring> *list = ListFor(key);
+		if (!list)
+		{
+			Error(L"unknown rule type '" + std::wstring(key.begin, key.end) + L"', expected class, title, exename, classglob, exeglob or titlere");
+			return;
+		}
+
+		std::size_t values = 0;
+		while (comma != end)
+		{
+			begin = comma + 1;
+			comma = std::find(begin, end, L',');
+			TOKEN value = Trim(begin, comma);
+			if (value.begin != value.end)
+			{
+				values++;
+				if (IsPatternList(list) && !CheckPattern(list, std::wstring(value.begin, value.end)))
+				{
+					continue;
+				}
+				list->emplace_back(value.begin, value.end);
+			}
+		}
+
+		if (!values)
+		{
+			Error(L"'" + std::wstring(key.begin, key.end) + L"' without any value");
+		}
+	}
+
+	EXCLUSIONRULES &m_Rules;
+	std::vector<PARSEERROR> &m_Errors;
+	std::size_t m_Line;
+	std::wstring m_Partial; // Start of a line cut between two calls to Feed
+};
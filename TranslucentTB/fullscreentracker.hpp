@@ -0,0 +1,174 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "backend.hpp"
+#include "eventloop.hpp"
+#include "geometryindex.hpp"
+
+struct FULLSCREENSTATS
+{
+	unsigned long long covers;  // Times a monitor got covered by a fullscreen window
+	unsigned long long lookups; // Times the covering windows had to be looked at again
+};
+
+// A window covering the whole of its monitor, taskbar included.
+struct FULLSCREENWINDOW
+{
+	MONITORID monitor;
+	WINDOWID window;
+};
+
+// Knows which monitors a fullscreen game, video or presentation covers, from events:
+// the taskbar of such a monitor is hidden behind it, so there is no point in keeping it
+// up to date. A window covers its monitor once it takes the foreground while filling
+// it, and keeps covering it until it goes away, shrinks, or another window on the same
+// monitor takes the foreground (a presentation keeps covering the projector while the
+// presenter view has the focus). Between those events, knowing costs no backend call.
+//
+// Only monitors where a taskbar takes room count: with an auto-hide taskbar, a plain
+// maximised window fills the monitor too, and the taskbar still shows up over it.
+class FullscreenTracker
+{
+public:
+	explicit FullscreenTracker(Backend &backend) :
+		m_Backend(backend),
+		m_Foreground(0),
+		m_Dirty(true), // Nothing is known until the first resync
+		m_Stats()
+	{ }
+
+	void OnEvent(const EVENT &ev)
+	{
+		switch (ev.type)
+		{
+		case ForegroundChanged:
+			m_Foreground = ev.window;
+			m_Dirty = true;
+			break;
+		case WindowChanged:
+		case WindowCloaked:
+		case WindowDestroyed:
+			m_Dirty = m_Dirty || ev.window == m_Foreground || IsCovering(ev.window);
+			break;
+		case MonitorsChanged:
+		case DesktopSwitched:
+			m_Dirty = true;
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Returns the covering windows, at most one per monitor. `resync` asks the backend for
+	// the foreground window again rather than trusting the events. `geometry(monitor)`
+	// gives the MONITORGEOMETRY of a monitor or null, `candidate(window)` whether a window
+	// could be a fullscreen one at all: not part of the shell, on the current desktop.
+	template<typename GEOMETRY, typename CANDIDATE>
+	const std::vector<FULLSCREENWINDOW> &Update(bool resync, GEOMETRY geometry, CANDIDATE candidate)
+	{
+		if (resync)
+		{
+			WINDOWID foreground = m_Backend.GetForegroundWindow();
+			m_Dirty = m_Dirty || foreground != m_Foreground;
+			m_Foreground = foreground;
+		}
+		if (!m_Dirty)
+		{
+			return m_Covering;
+		}
+		m_Dirty = false;
+		m_Stats.lookups++;
+
+		// The ones that still fill their monitor keep covering it
+		for (std::size_t i = m_Covering.size(); i-- > 0; )
+		{
+			MONITORID monitor = 0;
+			if (!Fills(m_Covering[i].window, geometry, candidate, monitor) || monitor != m_Covering[i].monitor)
+			{
+				m_Covering[i] = m_Covering.back();
+				m_Covering.pop_back();
+			}
+		}
+
+		if (m_Foreground)
+		{
+			MONITORID monitor = 0;
+			bool fills = Fills(m_Foreground, geometry, candidate, monitor);
+			if (!monitor)
+			{
+				return m_Covering;
+			}
+
+			std::size_t i = 0;
+			while (i < m_Covering.size() && m_Covering[i].monitor != monitor)
+			{
+				i++;
+			}
+			if (fills && i == m_Covering.size())
+			{
+				m_Stats.covers++;
+				m_Covering.push_back({ monitor, m_Foreground });
+			}
+			else if (fills)
+			{
+				m_Covering[i].window = m_Foreground;
+			}
+			else if (i != m_Covering.size())
+			{
+				// Something else is in front of it now, and the taskbar comes back with it
+				m_Covering[i] = m_Covering.back();
+				m_Covering.pop_back();
+			}
+		}
+		return m_Covering;
+	}
+
+	const FULLSCREENSTATS &Stats() const { return m_Stats; }
+
+private:
+	bool IsCovering(WINDOWID window) const
+	{
+		for (const FULLSCREENWINDOW &covering : m_Covering)
+		{
+			if (covering.window == window)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Whether `window` fills the whole of a monitor with a taskbar, which `monitor` is set
+	// to. `monitor` is left at 0 for windows that aren't there or don't count.
+	template<typename GEOMETRY, typename CANDIDATE>
+	bool Fills(WINDOWID window, GEOMETRY &geometry, CANDIDATE &candidate, MONITORID &monitor)
+	{
+		if (!m_Backend.IsWindow(window) || !m_Backend.IsWindowVisible(window))
+		{
+			return false;
+		}
+
+		monitor = m_Backend.GetWindowMonitor(window);
+		const MONITORGEOMETRY *bounds = geometry(monitor);
+		WINDOWRECT rect;
+		if (!bounds || !m_Backend.GetWindowRect(window, rect))
+		{
+			return false;
+		}
+
+		bool reserved = bounds->work.left != bounds->bounds.left || bounds->work.top != bounds->bounds.top ||
+			bounds->work.right != bounds->bounds.right || bounds->work.bottom != bounds->bounds.bottom;
+		return reserved &&
+			rect.left <= bounds->bounds.left && rect.top <= bounds->bounds.top &&
+			rect.right >= bounds->bounds.right && rect.bottom >= bounds->bounds.bottom &&
+			candidate(window); // Last, hardly any window gets this far
+	}
+
+	Backend &m_Backend;
+	WINDOWID m_Foreground;
+	bool m_Dirty;
+	std::vector<FULLSCREENWINDOW> m_Covering;
+	FULLSCREENSTATS m_Stats;
+};
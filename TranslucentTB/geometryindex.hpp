@@ -0,0 +1,273 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+#include "arena.hpp"
+#include "backend.hpp"
+#include "eventloop.hpp"
+
+enum TASKBAREDGE { EdgeBottom, EdgeTop, EdgeLeft, EdgeRight };
+
+struct MONITORGEOMETRY
+{
+	WINDOWRECT bounds;
+	WINDOWRECT work; // Without the taskbar
+};
+
+// Side of the monitor the taskbar takes room from. An auto-hide taskbar takes none,
+// it is assumed to be at the bottom.
+inline TASKBAREDGE TaskbarEdge(const MONITORGEOMETRY &geometry)
+{
+	if (geometry.work.top > geometry.bounds.top) { return EdgeTop; }
+	if (geometry.work.left > geometry.bounds.left) { return EdgeLeft; }
+	if (geometry.work.right < geometry.bounds.right) { return EdgeRight; }
+	return EdgeBottom;
+}
+
+inline bool Intersects(const WINDOWRECT &a, const WINDOWRECT &b)
+{
+	return a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom;
+}
+
+const int EDGE_TOLERANCE = 8; // How far (px) a window can stop short of the taskbar and still count as touching it
+
+struct GEOMETRYINDEXSTATS
+{
+	unsigned long long updates;     // Single window updates, from events
+	unsigned long long reconciles;  // Full enumerations checked against the index
+	unsigned long long corrections; // Windows a full enumeration found to be out of date
+	unsigned long long queries;     // Taskbar edges looked up
+};
+
+// Where a window is, and which monitor it counts for.
+struct WINDOWPLACE
+{
+	MONITORID monitor;
+	WINDOWRECT rect;
+};
+
+// For every monitor, how far the windows on it that can cover the taskbar (visible, on
+// the current virtual desktop and not excluded) reach towards each edge of the screen.
+// Unlike MaximisedWindowIndex, this doesn't care how a window got there: snapped,
+// borderless full screen and hand-sized windows all count once they touch the taskbar.
+//
+// Each monitor keeps one ordered set per edge, so moving or sizing a window costs
+// O(log n) and asking whether anything touches the taskbar only looks at the window
+// reaching furthest towards it, whichever edge the taskbar is on. Nodes come from a
+// pool, so a window being dragged around doesn't touch the heap.
+class WindowGeometryIndex
+{
+public:
+	WindowGeometryIndex() :
+		m_Windows(0, std::hash<WINDOWID>(), std::equal_to<WINDOWID>(), WINDOWMAP::allocator_type(m_Pool)),
+		m_Generation(0),
+		m_Stats()
+	{ }
+
+	// Records the current place of a window. O(log n).
+	void Update(WINDOWID window, bool qualifies, const WINDOWPLACE &place)
+	{
+		m_Stats.updates++;
+		Set(window, qualifies, place);
+	}
+
+	// A window was destroyed. O(log n).
+	void Remove(WINDOWID window)
+	{
+		auto it = m_Windows.find(window);
+		if (it != m_Windows.end())
+		{
+			Erase(it);
+		}
+	}
+
+	// Whether a window on `monitor` reaches the edge of the work area next to its taskbar.
+	bool TouchesTaskbar(MONITORID monitor, const MONITORGEOMETRY &geometry)
+	{
+		m_Stats.queries++;
+		auto it = m_Monitors.find(monitor);
+		if (it == m_Monitors.end())
+		{
+			return false;
+		}
+
+		TASKBAREDGE edge = TaskbarEdge(geometry);
+		const REACH &reach = it->second.reach[edge];
+		return !reach.empty() && *reach.rbegin() >= Reach(edge, geometry.work) - EDGE_TOLERANCE;
+	}
+
+	// Every monitor with at least one window on it, into any vector of MONITORID.
+	template<typename LIST>
+	void Monitors(LIST &monitors) const
+	{
+		monitors.clear();
+		for (const auto &monitor : m_Monitors)
+		{
+			if (!monitor.second.reach[EdgeBottom].empty())
+			{
+				monitors.push_back(monitor.first);
+			}
+		}
+	}
+
+	size_t Size() const { return m_Windows.size(); }
+
+	// Makes the index match the result of a full enumeration: every qualifying window
+	// along with its place, in any vector of pairs. Returns the number of windows that
+	// had to be corrected.
+	template<typename LIST>
+	size_t Reconcile(const LIST &qualifying)
+	{
+		m_Stats.reconciles++;
+		size_t corrections = 0;
+
+		// Windows still qualifying are stamped, the others are left behind
+		m_Generation++;
+		for (const auto &window : qualifying)
+		{
+			auto it = m_Windows.find(window.first);
+			if (it == m_Windows.end())
+			{
+				continue; // Added below
+			}
+			else if (!Same(it->second.place, window.second))
+			{
+				corrections++;
+				Set(window.first, true, window.second); // Stamps it
+			}
+			else
+			{
+				it->second.generation = m_Generation;
+			}
+		}
+
+		// Stale windows go before new ones come in, so their nodes are reused
+		for (auto it = m_Windows.begin(); it != m_Windows.end(); )
+		{
+			if (it->second.generation != m_Generation)
+			{
+				corrections++;
+				it = Erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		for (const auto &window : qualifying)
+		{
+			if (!m_Windows.count(window.first))
+			{
+				corrections++;
+				Set(window.first, true, window.second);
+			}
+		}
+
+		m_Stats.corrections += corrections;
+		return corrections;
+	}
+
+	// Makes room for as many windows as there are, so windows coming and going never
+	// make the index grow its hash table.
+	void Reserve(size_t windows)
+	{
+		m_Windows.reserve(windows);
+	}
+
+	void Clear()
+	{
+		m_Windows.clear();
+		m_Monitors.clear();
+	}
+
+	const GEOMETRYINDEXSTATS &Stats() const { return m_Stats; }
+
+private:
+	struct ENTRY
+	{
+		WINDOWPLACE place;
+		unsigned int generation; // Of the last Reconcile that saw it
+	};
+	typedef std::unordered_map<WINDOWID, ENTRY, std::hash<WINDOWID>, std::equal_to<WINDOWID>, PoolAllocator<std::pair<const WINDOWID, ENTRY>>> WINDOWMAP;
+	typedef std::multiset<int, std::less<int>, PoolAllocator<int>> REACH;
+
+	struct EDGES
+	{
+		explicit EDGES(NodePool &pool) :
+			reach { REACH(PoolAllocator<int>(pool)), REACH(PoolAllocator<int>(pool)), REACH(PoolAllocator<int>(pool)), REACH(PoolAllocator<int>(pool)) }
+		{ }
+
+		REACH reach[4]; // By TASKBAREDGE, bigger is closer to that edge
+	};
+
+	// How far a rectangle goes towards an edge, in a direction where bigger is closer.
+	static int Reach(TASKBAREDGE edge, const WINDOWRECT &rect)
+	{
+		switch (edge)
+		{
+		case EdgeTop: return -rect.top;
+		case EdgeLeft: return -rect.left;
+		case EdgeRight: return rect.right;
+		default: return rect.bottom;
+		}
+	}
+
+	static bool Same(const WINDOWPLACE &a, const WINDOWPLACE &b)
+	{
+		return a.monitor == b.monitor &&
+			a.rect.left == b.rect.left && a.rect.top == b.rect.top &&
+			a.rect.right == b.rect.right && a.rect.bottom == b.rect.bottom;
+	}
+
+	void Set(WINDOWID window, bool qualifies, const WINDOWPLACE &place)
+	{
+		auto it = m_Windows.find(window);
+		if (it != m_Windows.end())
+		{
+			if (qualifies && Same(it->second.place, place))
+			{
+				return; // Nothing changed
+			}
+			Erase(it);
+		}
+
+		if (qualifies)
+		{
+			m_Windows.emplace(window, ENTRY { place, m_Generation });
+			auto monitor = m_Monitors.find(place.monitor);
+			if (monitor == m_Monitors.end())
+			{
+				monitor = m_Monitors.emplace(place.monitor, EDGES(m_Pool)).first;
+			}
+			EDGES &edges = monitor->second;
+			for (int edge = EdgeBottom; edge <= EdgeRight; edge++)
+			{
+				edges.reach[edge].insert(Reach(static_cast<TASKBAREDGE>(edge), place.rect));
+			}
+		}
+	}
+
+	WINDOWMAP::iterator Erase(WINDOWMAP::iterator it)
+	{
+		auto monitor = m_Monitors.find(it->second.place.monitor);
+		if (monitor != m_Monitors.end())
+		{
+			for (int edge = EdgeBottom; edge <= EdgeRight; edge++)
+			{
+				REACH &reach = monitor->second.reach[edge];
+				reach.erase(reach.find(Reach(static_cast<TASKBAREDGE>(edge), it->second.place.rect))); // Only one of the equal values
+			}
+		}
+		return m_Windows.erase(it);
+	}
+
+	NodePool m_Pool; // Before the containers, which give their nodes back when destroyed
+	WINDOWMAP m_Windows; // Only windows that qualify
+	std::unordered_map<MONITORID, EDGES> m_Monitors; // Kept once seen, with empty sets when no window is left
+	unsigned int m_Generation;
+	GEOMETRYINDEXSTATS m_Stats;
+};
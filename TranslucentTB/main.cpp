@@ -1,15 +1,16 @@
 #include <windows.h>
 #include <iostream>
 #include <fstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <tchar.h>
 #include <map>
-#include <psapi.h>
 #include <ShlObj.h>
 #include <Shlwapi.h>
 
 #include <algorithm>
+#include <memory>
 
 // for making the menu show up better
 #include <ShellScalingAPI.h>
@@ -18,11 +19,21 @@
 #include <shellapi.h>
 #include "resource.h"
 
+#include "classificationworker.hpp"
+#include "configwatcher.hpp"
+#include "decisiontrace.hpp"
+#include "eventloop.hpp"
+#include "exclusionmatcher.hpp"
+#include "exclusionparser.hpp"
+#include "metricsserver.hpp"
+#include "taskbarcontroller.hpp"
+#include "tracerecorder.hpp"
+#include "win32backend.hpp"
+#include "win32eventsource.hpp"
+
 //we use a GUID for uniqueness
 const static LPCWSTR singleProcName = L"344635E9-9AE4-4E60-B128-D53E25AB70A7";
 
-//needed for tray exit
-bool run = true;
 bool hastray = true;
 
 // config file path (defaults to ./config.cfg)
@@ -34,39 +45,14 @@ bool explicitconfig;
 // defaults to -1 (not set).
 int forcedtransparency;
 
-HWND taskbar;
-HWND secondtaskbar;
 HMENU popup;
 
 #pragma region composition
 
-struct ACCENTPOLICY
-{
-	int nAccentState;
-	int nFlags;
-	int nColor;
-	int nAnimationId;
-};
-struct WINCOMPATTRDATA
-{
-	int nAttribute;
-	PVOID pData;
-	ULONG ulDataSize;
-};
+OPTIONS opt;
 
-struct OPTIONS
-{
-	int taskbar_appearance;
-	int color;
-	bool dynamicws;
-	bool dynamicstart;
-} opt;
-
-enum TASKBARSTATE { Normal, WindowMaximised, StartMenuOpen }; // Create a state to store all 
-															  // states of the Taskbar
-			// Normal           | Proceed as normal. If no dynamic options are set, act as it says in opt.taskbar_appearance
-			// WindowMaximised  | There is a window which is maximised on the monitor this HWND is in. Display as blurred.
-			// StartMenuOpen    | The Start Menu is open on the monitor this HWND is in. Display as it would be without TranslucentTB active.
+// How often passes run, from the latency and cpu config keys
+SCHEDULEROPTIONS scheduling;
 
 enum SAVECONFIGSTATES { DoNotSave, SaveTransparency, SaveAll } shouldsaveconfig;  // Create an enum to store all config states
 			// DoNotSave        | Fairly self-explanatory
@@ -81,62 +67,39 @@ struct READFROMCONFIG
 	bool tint;
 } configfileoptions; // Keep a struct, as we will need to save them later
 
-struct TASKBARPROPERTIES
-{
-	HMONITOR hmon;
-	TASKBARSTATE state;
-};
-
-std::vector<std::wstring> IgnoredClassNames;
-std::vector<std::wstring> IgnoredExeNames;
-std::vector<std::wstring> IgnoredWindowTitles;
-
-int counter = 0;
-const int ACCENT_DISABLED = 4; // Disables TTB for that taskbar
-const int ACCENT_ENABLE_GRADIENT = 1; // Makes the taskbar a solid color specified by nColor. This mode doesn't care about the alpha channel.
-const int ACCENT_ENABLE_TRANSPARENTGRADIENT = 2; // Makes the taskbar a tinted transparent overlay. nColor is the tint color, sending nothing results in it interpreted as 0x00000000 (totally transparent, blends in with desktop)
-const int ACCENT_ENABLE_BLURBEHIND = 3; // Makes the taskbar a tinted blurry overlay. nColor is same as above.
-const int ACCENT_ENABLE_TINTED = 5; // This is not a real state. We will handle it later.
-const int ACCENT_NORMAL_GRADIENT = 6; // Another fake value, handles the 
+// Key/value pairs of a config file, in file order
+typedef std::vector<std::pair<std::wstring, std::wstring>> CONFIGENTRIES;
+
+// Read from the config file by the watcher thread after it changed, waiting to be
+// applied on the UI thread. Always accessed through std::atomic_load/std::atomic_store.
+std::shared_ptr<const CONFIGENTRIES> pendingconfig;
+
+// Compiled from the exclusion file. Replaced as a whole when the file is loaded,
+// always read and written through std::atomic_load/std::atomic_store.
+std::shared_ptr<const ExclusionMatcher> exclusions;
+
 unsigned int WM_TASKBARCREATED;
 unsigned int NEW_TTB_INSTANCE;
-int DYNAMIC_WS_STATE = ACCENT_ENABLE_BLURBEHIND; // State to activate when d-ws is enabled
-std::map<HWND, TASKBARPROPERTIES> taskbars; // Create a map for all taskbars
 
 std::wstring ExcludeFile = L"dynamic-ws-exclude.csv";
 
+// Where to record a trace of the desktop (--record), empty when not recording
+std::wstring tracefile;
+
 IVirtualDesktopManager *desktop_manager;
 
-typedef BOOL(WINAPI*pSetWindowCompositionAttribute)(HWND, WINCOMPATTRDATA*);
-static pSetWindowCompositionAttribute SetWindowCompositionAttribute = (pSetWindowCompositionAttribute)GetProcAddress(GetModuleHandle(TEXT("user32.dll")), "SetWindowCompositionAttribute");
+TaskbarController *controller;
+ClassificationWorker *worker;
+Win32EventSource *eventsource;
+Scheduler *scheduler;
 
-void SetWindowBlur(HWND hWnd, int appearance = 0) // `appearance` can be 0, which means 'follow opt.taskbar_appearance'
-{
-	if (SetWindowCompositionAttribute)
-	{
-		ACCENTPOLICY policy;
+// Counted by every thread as it goes, read by --stats through the metrics pipe
+MetricsRegistry metrics;
 
-		if (appearance) // Custom taskbar appearance is set
-		{
-			if (DYNAMIC_WS_STATE == ACCENT_ENABLE_TINTED)
-			{ // dynamic-ws is set to tint
-				if (appearance == ACCENT_ENABLE_TINTED) { policy = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 2, opt.color, 0 }; } // Window is maximised
-				else { policy = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 2, 0x00000000, 0 }; } // Desktop is shown (this shouldn't ever be called tho, just in case)
-			}
-			else {  policy = { appearance, 2, opt.color, 0 };  }
-		} else { // Use the defaults
-			if (DYNAMIC_WS_STATE == ACCENT_ENABLE_TINTED) { policy = {ACCENT_ENABLE_TRANSPARENTGRADIENT, 2, 0x00000000, 0}; } // dynamic-ws is tint and desktop is shown
-			else if (opt.taskbar_appearance == ACCENT_NORMAL_GRADIENT) { policy = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 2, (int)0xd9000000, 0 }; } // normal gradient color
-			else { policy = { opt.taskbar_appearance, 2, opt.color, 0 }; }
-		}
-		
-		WINCOMPATTRDATA data = { 19, &policy, sizeof(ACCENTPOLICY) }; // WCA_ACCENT_POLICY=19
-		SetWindowCompositionAttribute(hWnd, &data);
-	}
-
-}
+// What the taskbars were told to do and why, read by --dump-decisions
+DecisionTrace decisions;
 
-#pragma endregion 
+#pragma endregion
 
 #pragma region IO help
 
@@ -205,6 +168,8 @@ void PrintHelp()
 			cout << "                          see explanation below." << endl;
 			cout << "  --dynamic-ws STATE    | will make the taskbar transparent when no windows are maximised in the current" << endl;
 			cout << "                          monitor, otherwise blurry. State can be from: (blur, opaque, tint). Blur is default." << endl;
+			cout << "  --dynamic-ws-mode MODE| what makes dynamic-ws kick in: maximised (default) for maximised windows," << endl;
+			cout << "                          geometry for any window touching the taskbar (snapped, sized or full screen)." << endl;
 			cout << "  --dynamic-start       | will make the taskbar return to it's normal state when the start menu is opened," << endl;
 			cout << "                          current setting otherwise." << endl;
 			cout << "  --exclude-file FILE   | CSV-format file to specify applications to exclude from dynamic-ws (By default" << endl;
@@ -215,6 +180,11 @@ void PrintHelp()
 			cout << "  --help                | Displays this help message." << endl;
 			cout << "  --startup             | Adds TranslucentTB to startup, via changing the registry." << endl;
 			cout << "  --no-tray             | will hide the taskbar tray icon." << endl;
+			cout << "  --record FILE         | records what happens on the desktop to FILE, so it can be replayed with" << endl;
+			cout << "                          Benchmarks.exe --replay FILE. An existing trace is appended to." << endl;
+			cout << "  --stats               | prints the counters and timings of the instance already running, then exits." << endl;
+			cout << "  --dump-decisions FILE | writes the last decisions of the instance already running to FILE, in the" << endl;
+			cout << "                          Chrome trace format that chrome://tracing or ui.perfetto.dev open, then exits." << endl;
 			cout << endl;
 
 			cout << "Color format:" << endl;
@@ -257,6 +227,82 @@ void PrintHelp()
 	}
 }
 
+// Prints what the running instance hands out through its metrics pipe.
+// Returns false if no instance is running.
+bool PrintStats()
+{
+	std::string text;
+	bool running = ReadMetrics(text);
+
+	BOOL hasconsole = true;
+	BOOL createdconsole = false;
+	// Same as PrintHelp
+	if (!AttachConsole(ATTACH_PARENT_PROCESS))
+	{
+		if (!AllocConsole())
+		{
+			hasconsole = false;
+		}
+		else
+		{
+			createdconsole = true;
+		}
+	}
+
+	if (hasconsole)
+	{
+		FILE* outstream;
+		FILE* instream;
+		freopen_s(&outstream, "CONOUT$", "w", stdout);
+		freopen_s(&instream, "CONIN$", "w", stdin);
+
+		if (outstream)
+		{
+			std::cout << std::endl;
+			if (running)
+			{
+				std::cout << text;
+			}
+			else
+			{
+				std::cout << "TranslucentTB isn't running." << std::endl;
+			}
+
+			if (createdconsole && instream)
+			{
+				std::string wait;
+
+				std::cout << "Press enter to exit the program." << std::endl;
+				if (!getline(std::cin, wait))
+				{
+					std::cout << "Press Ctrl + C, Alt + F4, or click the close button to exit the program." << std::endl;
+					Sleep(INFINITE);
+				}
+
+				FreeConsole();
+			}
+
+			fclose(outstream);
+		}
+	}
+	return running;
+}
+
+// Writes what the running instance hands out through its decisions pipe to `path`.
+// Returns false if no instance is running or the file can't be written.
+bool DumpDecisions(const std::wstring &path)
+{
+	std::string json;
+	if (path.empty() || !ReadMetrics(json, DECISIONS_PIPE))
+	{
+		return false;
+	}
+
+	std::ofstream dump(path, std::ios::binary);
+	dump << json;
+	return dump.good();
+}
+
 void add_to_startup()
 {
 	HMODULE hModule = GetModuleHandle(NULL);
@@ -269,6 +315,23 @@ void add_to_startup()
 	LONG status = RegSetValueEx(hkey, L"TranslucentTB", 0, REG_SZ, (BYTE *)progPath.c_str(), (DWORD)((progPath.size() + 1) * sizeof(wchar_t)));
 }
 
+// A duration from the config file, in ms with or without the unit. Throws like std::stoul
+// on anything else or on a value above `max`, so ApplyConfig skips the key.
+std::uint32_t ParseMilliseconds(const std::wstring &value, std::uint32_t max)
+{
+	size_t numchars = 0;
+	unsigned long parsed = std::stoul(value, &numchars, 10);
+
+	std::wstring unit = value.substr(numchars);
+	unit.erase(unit.find_last_not_of(L" \t") + 1);
+	if (!unit.empty() && unit != L"ms")
+		throw std::invalid_argument("unknown unit");
+	if (parsed > max) // Negative values too, they wrap around
+		throw std::out_of_range("duration out of range");
+
+	return static_cast<std::uint32_t>(parsed);
+}
+
 void ParseSingleConfigOption(std::wstring arg, std::wstring value)
 {
 	if (arg == L"accent")
@@ -293,21 +356,28 @@ void ParseSingleConfigOption(std::wstring arg, std::wstring value)
 		{
 			opt.taskbar_appearance = ACCENT_ENABLE_TRANSPARENTGRADIENT;
 			opt.dynamicws = true;
-			DYNAMIC_WS_STATE = ACCENT_ENABLE_TINTED;
+			opt.dynamicws_state = ACCENT_ENABLE_TINTED;
 		}
 		else if (value == L"blur")
 		{
 			opt.taskbar_appearance = ACCENT_ENABLE_TRANSPARENTGRADIENT;
 			opt.dynamicws = true;
-			DYNAMIC_WS_STATE = ACCENT_ENABLE_BLURBEHIND;
+			opt.dynamicws_state = ACCENT_ENABLE_BLURBEHIND;
 		}
 		else if (value == L"opaque")
 		{
 			opt.taskbar_appearance = ACCENT_ENABLE_TRANSPARENTGRADIENT;
 			opt.dynamicws = true;
-			DYNAMIC_WS_STATE = ACCENT_ENABLE_GRADIENT;
+			opt.dynamicws_state = ACCENT_ENABLE_GRADIENT;
 		}
 	}
+	else if (arg == L"dynamic-ws-mode")
+	{
+		if (value == L"maximised" || value == L"maximized")
+			opt.dynamicws_mode = DynamicWsMaximised;
+		else if (value == L"geometry")
+			opt.dynamicws_mode = DynamicWsGeometry;
+	}
 	else if (arg == L"dynamic-start")
 	{
 		if (value == L"true" ||
@@ -346,11 +416,47 @@ void ParseSingleConfigOption(std::wstring arg, std::wstring value)
 
 		forcedtransparency = parsed;
 	}
+	else if (arg == L"transition-dwell")
+	{
+		opt.transitions.dwell = ParseMilliseconds(value, MAX_TRANSITION_TIME);
+	}
+	else if (arg == L"transition-debounce")
+	{
+		opt.transitions.debounce = ParseMilliseconds(value, MAX_TRANSITION_TIME);
+	}
+	else if (arg == L"transition-edge")
+	{
+		if (value == L"leading")
+			opt.transitions.edge = LeadingEdge;
+		else if (value == L"trailing")
+			opt.transitions.edge = TrailingEdge;
+	}
+	else if (arg == L"latency")
+	{
+		scheduling.min_pass_interval = ParseMilliseconds(value, MAX_MIN_PASS_INTERVAL);
+	}
+	else if (arg == L"cpu")
+	{
+		const SCHEDULEROPTIONS *profile = NULL;
+		if (value == L"minimal")
+			profile = &MINIMAL_CPU_SCHEDULING;
+		else if (value == L"balanced")
+			profile = &DEFAULT_SCHEDULING;
+
+		// The latency is a key of its own
+		if (profile)
+		{
+			scheduling.refresh_interval = profile->refresh_interval;
+			scheduling.max_refresh_interval = profile->max_refresh_interval;
+		}
+	}
 }
 
-void ParseConfigFile(std::wstring path)
+// Doesn't touch any global, so it is safe to call from any thread.
+CONFIGENTRIES ReadConfigFile(std::wstring path)
 {
 	std::wifstream configstream(path);
+	CONFIGENTRIES entries;
 
 	for (std::wstring line; std::getline(configstream, line); )
 	{
@@ -365,7 +471,26 @@ void ParseConfigFile(std::wstring path)
 		std::wstring key = line.substr(0, split_index);
 		std::wstring val = line.substr(split_index + 1, line.length() - split_index - 1);
 
-		ParseSingleConfigOption(key, val);
+		entries.push_back(std::make_pair(key, val));
+	}
+	return entries;
+}
+
+// Also runs on every reload, so a key with a value that doesn't parse, be it mistyped or
+// the file still being written, is skipped and keeps its current value.
+void ApplyConfig(const CONFIGENTRIES &entries)
+{
+	for (const auto &entry : entries)
+	{
+		try
+		{
+			ParseSingleConfigOption(entry.first, entry.second);
+		}
+		catch (const std::exception &)
+		{
+			std::wstring message = L"Ignoring invalid config value: " + entry.first + L"=" + entry.second + L"\n";
+			OutputDebugStringW(message.c_str());
+		}
 	}
 
 	if (forcedtransparency >= 0)
@@ -375,6 +500,11 @@ void ParseConfigFile(std::wstring path)
 	}
 }
 
+void ParseConfigFile(std::wstring path)
+{
+	ApplyConfig(ReadConfigFile(path));
+}
+
 void SaveConfigFile()
 {
 	if (!configfile.empty())
@@ -397,6 +527,11 @@ void SaveConfigFile()
 			configstream << L"; Dynamic states: Window States and (WIP) Start Menu" << endl;
 			configstream << L"dynamic-ws=enable" << endl;
 		}
+		if (opt.dynamicws_mode != DynamicWsMaximised ||
+			shouldsaveconfig == SaveAll)
+		{
+			configstream << L"dynamic-ws-mode=" << (opt.dynamicws_mode == DynamicWsGeometry ? L"geometry" : L"maximised") << endl;
+		}
 		if (configfileoptions.dynamicstart == true ||
 			shouldsaveconfig == SaveAll)
 		{
@@ -417,6 +552,26 @@ void SaveConfigFile()
 			configstream << L"color=" << hex << bitreversed << L"    ; A color in hexadecimal notation. Described in usage.md." << endl;
 			configstream << L"opacity=" << to_wstring((opt.color & 0xFF000000) >> 24) << L"    ; A value in the range 0 to 255." << endl;
 		}
+		if (opt.transitions.dwell != DEFAULT_TRANSITIONS.dwell ||
+			opt.transitions.debounce != DEFAULT_TRANSITIONS.debounce ||
+			opt.transitions.edge != DEFAULT_TRANSITIONS.edge ||
+			shouldsaveconfig == SaveAll)
+		{
+			configstream << endl;
+			configstream << L"; Keeps the taskbar from flickering while windows are dragged or snapped." << endl;
+			configstream << L"transition-dwell=" << dec << opt.transitions.dwell << endl;
+			configstream << L"transition-debounce=" << dec << opt.transitions.debounce << endl;
+			configstream << L"transition-edge=" << (opt.transitions.edge == LeadingEdge ? L"leading" : L"trailing") << endl;
+		}
+		if (scheduling.min_pass_interval != DEFAULT_SCHEDULING.min_pass_interval ||
+			scheduling.refresh_interval != DEFAULT_SCHEDULING.refresh_interval ||
+			shouldsaveconfig == SaveAll)
+		{
+			configstream << endl;
+			configstream << L"; How quickly the taskbar follows the windows, and how much CPU it spends when nothing happens." << endl;
+			configstream << L"latency=" << dec << scheduling.min_pass_interval << L"ms" << endl;
+			configstream << L"cpu=" << (scheduling.refresh_interval == MINIMAL_CPU_SCHEDULING.refresh_interval ? L"minimal" : L"balanced") << endl;
+		}
 	}
 }
 
@@ -427,6 +582,15 @@ void ParseSingleOption(std::wstring arg, std::wstring value)
 		PrintHelp();
 		exit(0);
 	}
+	else if (arg == L"--stats")
+	{
+		// Before anything else happens, this must not replace the running instance
+		exit(PrintStats() ? 0 : 1);
+	}
+	else if (arg == L"--dump-decisions")
+	{
+		exit(DumpDecisions(value) ? 0 : 1);
+	}
 	else if (arg == L"--save-all")
 	{
 		shouldsaveconfig = SaveAll;
@@ -448,9 +612,14 @@ void ParseSingleOption(std::wstring arg, std::wstring value)
 		configfileoptions.dynamicws = true;
 		opt.taskbar_appearance = ACCENT_ENABLE_TRANSPARENTGRADIENT;
 		opt.dynamicws = true;
-		if (value == L"tint") { DYNAMIC_WS_STATE = ACCENT_ENABLE_TINTED; }
-		else if (value == L"blur") { DYNAMIC_WS_STATE = ACCENT_ENABLE_BLURBEHIND; }
-		else if (value == L"opaque") { DYNAMIC_WS_STATE = ACCENT_ENABLE_GRADIENT; }
+		if (value == L"tint") { opt.dynamicws_state = ACCENT_ENABLE_TINTED; }
+		else if (value == L"blur") { opt.dynamicws_state = ACCENT_ENABLE_BLURBEHIND; }
+		else if (value == L"opaque") { opt.dynamicws_state = ACCENT_ENABLE_GRADIENT; }
+	}
+	else if (arg == L"--dynamic-ws-mode")
+	{
+		if (value == L"maximised" || value == L"maximized") { opt.dynamicws_mode = DynamicWsMaximised; }
+		else if (value == L"geometry") { opt.dynamicws_mode = DynamicWsGeometry; }
 	}
 	else if (arg == L"--dynamic-start")
 	{
@@ -461,6 +630,10 @@ void ParseSingleOption(std::wstring arg, std::wstring value)
 	{
 		add_to_startup();
 	}
+	else if (arg == L"--record")
+	{
+		tracefile = value;
+	}
 	else if (arg == L"--exclude-file")
 	{
 		OutputDebugString(value.c_str());
@@ -557,6 +730,10 @@ void ParseCmdOptions(bool configonly=false)
 
 		opt.taskbar_appearance = ACCENT_ENABLE_BLURBEHIND;
 		opt.color = 0x00000000;
+		opt.dynamicws_state = ACCENT_ENABLE_BLURBEHIND;
+		opt.transitions = DEFAULT_TRANSITIONS;
+		opt.dynamicws_mode = DynamicWsMaximised;
+		scheduling = DEFAULT_SCHEDULING;
 	}
 
 	// Loop through command line arguments
@@ -608,101 +785,88 @@ void ParseCmdOptions(bool configonly=false)
 	LocalFree(szArglist);
 }
 
-void RefreshHandles()
+void ParseDWSExcludesFile(std::wstring filename)
 {
-	HWND _taskbar;
-	TASKBARPROPERTIES _properties;
-
-	taskbars.clear();
-	_taskbar = FindWindowW(L"Shell_TrayWnd", NULL);
+	std::wifstream excludesfilestream(filename);
+	EXCLUSIONRULES rules;
+	std::vector<PARSEERROR> errors;
+	ExclusionParser parser(rules, errors);
 
-	_properties.hmon = MonitorFromWindow(_taskbar, MONITOR_DEFAULTTOPRIMARY);
-	_properties.state = Normal;
-	taskbars.insert(std::make_pair(_taskbar, _properties));
-	while (secondtaskbar = FindWindowEx(0, secondtaskbar, L"Shell_SecondaryTrayWnd", NULL))
+	wchar_t buffer[4096];
+	while (excludesfilestream.read(buffer, _countof(buffer)) || excludesfilestream.gcount())
 	{
-		_properties.hmon = MonitorFromWindow(secondtaskbar, MONITOR_DEFAULTTOPRIMARY);
-		_properties.state = Normal;
-		taskbars.insert(std::make_pair(secondtaskbar, _properties));
+		parser.Feed(buffer, static_cast<size_t>(excludesfilestream.gcount()));
 	}
-}
+	parser.Finish();
 
-std::wstring trim(std::wstring& str)
-{
-    size_t first = str.find_first_not_of(' ');
-    size_t last = str.find_last_not_of(' ');
-
-	if (first == std::wstring::npos)
-	{ return std::wstring(L""); }
-    return str.substr(first, (last-first+1));
-}
+	for (const PARSEERROR &error : errors)
+	{
+		std::wstring message = filename + L"(" + std::to_wstring(error.line) + L"): " + error.message + L"\n";
+		OutputDebugStringW(message.c_str());
+	}
 
-std::vector<std::wstring> ParseByDelimiter(std::wstring row, std::wstring delimiter=L",")
-{
-	std::vector<std::wstring> result;
-	std::wstring token;
-	size_t pos = 0;
-	while ((pos = row.find(delimiter)) != std::string::npos)
+	// Class and executable names are case insensitive on Windows
+	std::shared_ptr<const ExclusionMatcher> matcher = std::make_shared<const ExclusionMatcher>(rules, FoldClassNames | FoldExeNames);
+	for (const std::wstring &error : matcher->Errors())
 	{
-		token = trim(row.substr(0, pos));
-		result.push_back(token);
-		row.erase(0, pos + delimiter.length());
+		std::wstring message = filename + L": " + error + L"\n";
+		OutputDebugStringW(message.c_str());
 	}
-	return result;
+	std::atomic_store(&exclusions, matcher);
 }
 
-void ParseDWSExcludesFile(std::wstring filename)
-{
-	std::wifstream excludesfilestream(filename);
+#pragma endregion
 
-	std::wstring delimiter = L","; // Change to change the char(s) used to split,
+#pragma region tray
 
-	for (std::wstring line; std::getline(excludesfilestream, line); )
-	{
-		size_t comment_index = line.find(L';');
-		if (comment_index == 0)
-			continue;
-		else
-			line = line.substr(0, comment_index);
+#define WM_NOTIFY_TB 3141
+#define WM_CONFIGCHANGED 3142 // Posted by the config watcher after it reloaded a file
+#define WM_STATEPUBLISHED 3143 // Posted by the classification worker after it published a new DESKTOPSTATE
+
+#define IDT_TRANSITION 1 // Fires when a taskbar transition held back by the transition filter is due
+
+HMENU menu;
+NOTIFYICONDATA Tray;
+HWND tray_hwnd;
 
-		if (line.length() > delimiter.length())
+void ApplyLatestState()
+{
+	if (controller && worker)
+	{
+		// Only as long as there are taskbars, however many windows are open
+		ULONGLONG now = GetTickCount64();
+		unsigned long long issued = controller->CompositionStats().issued;
+		std::shared_ptr<const DESKTOPSTATE> state = worker->Latest();
+		std::uint64_t due = controller->Apply(*state, now);
+		if (scheduler && controller->CompositionStats().issued != issued)
 		{
-			if (line.compare(line.length() - delimiter.length(), delimiter.length(), delimiter))
+			scheduler->Activity(); // A taskbar changed, maybe without any event saying so
+		}
+		if (scheduler && controller->AllParked())
+		{
+			// A game or a presentation covers every monitor, nothing needs doing until it goes away
+			std::vector<WINDOWID> fullscreen;
+			for (const FULLSCREENWINDOW &entry : state->fullscreen)
 			{
-				line.append(delimiter);
+				fullscreen.push_back(entry.window);
 			}
+			scheduler->Park(fullscreen);
 		}
-		std::wstring line_lowercase = line;
-		std::transform(line_lowercase.begin(), line_lowercase.end(), line_lowercase.begin(), tolower);
-		if (line_lowercase.substr(0, 5) == L"class")
+		else if (scheduler)
 		{
-			IgnoredClassNames = ParseByDelimiter(line, delimiter);
-			IgnoredClassNames.erase(IgnoredClassNames.begin());
+			scheduler->Unpark();
 		}
-		else if (line_lowercase.substr(0, 5) == L"title" ||
-				 line.substr(0, 13) == L"windowtitle")
+		if (due)
 		{
-			IgnoredWindowTitles = ParseByDelimiter(line, delimiter);
-			IgnoredWindowTitles.erase(IgnoredWindowTitles.begin());
+			SetTimer(tray_hwnd, IDT_TRANSITION, static_cast<UINT>(due > now ? due - now : 0), NULL);
 		}
-		else if (line_lowercase.substr(0, 7) == L"exename")
+		else
 		{
-			IgnoredExeNames = ParseByDelimiter(line, delimiter);
-			IgnoredExeNames.erase(IgnoredExeNames.begin());
+			KillTimer(tray_hwnd, IDT_TRANSITION);
 		}
 	}
 }
 
-#pragma endregion
-
-#pragma region tray
-
-#define WM_NOTIFY_TB 3141
-
-HMENU menu;
-NOTIFYICONDATA Tray;
-HWND tray_hwnd;
-
 void RefreshMenu()
 {
 	if (opt.dynamicws)
@@ -753,69 +917,6 @@ void initTray(HWND parent)
 	}
 }
 
-BOOL isBlacklisted(HWND hWnd)
-{
-	// Get respective attributes
-	TCHAR className[MAX_PATH];
-	TCHAR exeName_path[MAX_PATH];
-	TCHAR windowTitle[MAX_PATH];
-	GetClassName(hWnd, className, _countof(className));
-	GetWindowText(hWnd, windowTitle, _countof(windowTitle));
-
-	DWORD ProcessId;
-	GetWindowThreadProcessId(hWnd, &ProcessId);
-	HANDLE processhandle = OpenProcess(PROCESS_QUERY_INFORMATION, false, ProcessId);
-	GetModuleFileNameEx(processhandle, NULL, exeName_path, _countof(exeName_path));
-
-	std::wstring exeName = PathFindFileNameW(exeName_path);
-	std::wstring w_WindowTitle = windowTitle;
-
-	// Check if the different vars are in their respective vectors
-	for (auto & value: IgnoredClassNames)
-	{ if (className == value.c_str()) { return true; } }
-	for (auto & value: IgnoredExeNames)
-	{ if (exeName == value) { return true; } }
-	for (auto & value: IgnoredWindowTitles)
-	{
-		if (w_WindowTitle.find(value) != std::wstring::npos)
-		{
-			return true;
-		}
-	}
-	return false;
-}
-
-BOOL CALLBACK EnumWindowsProcess(HWND hWnd, LPARAM lParam) 
-{
-	HMONITOR _monitor;
-
-	if (opt.dynamicws)
-	{
-		WINDOWPLACEMENT result = {};
-		::GetWindowPlacement(hWnd, &result);
-		if (result.showCmd == SW_MAXIMIZE) {
-			BOOL on_current_desktop;
-			desktop_manager->IsWindowOnCurrentVirtualDesktop(hWnd, &on_current_desktop);
-			if (IsWindowVisible(hWnd) && on_current_desktop)
-			{
-				if (!isBlacklisted(hWnd))
-				{
-					_monitor = MonitorFromWindow(hWnd, MONITOR_DEFAULTTOPRIMARY);
-					for (auto &taskbar: taskbars)
-					{
-						if (taskbar.second.hmon == _monitor &&
-							taskbar.second.state != StartMenuOpen)
-						{
-							taskbar.second.state = WindowMaximised;
-						}
-					}
-				}
-			}
-		}
-	}
-	return true;
-}
-
 LRESULT CALLBACK TBPROCWND(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
 
@@ -858,7 +959,6 @@ LRESULT CALLBACK TBPROCWND(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam
 			case IDM_DYNAMICWS:
 				opt.taskbar_appearance = ACCENT_ENABLE_TRANSPARENTGRADIENT;
 				opt.dynamicws = true;
-				EnumWindows(&EnumWindowsProcess, NULL);
 				// TODO: shouldsaveconfig implementation
 				RefreshMenu();
 				break;
@@ -879,80 +979,77 @@ LRESULT CALLBACK TBPROCWND(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam
 				RefreshMenu();
 				break;
 			case IDM_EXIT:
-				run = false;
+				PostQuitMessage(0);
 				break;
 			}
+			if (scheduler)
+			{
+				scheduler->SetOptions(EffectiveScheduling(scheduling, opt.dynamicws)); // dynamic-ws may have been switched
+			}
+			if (eventsource)
+			{
+				eventsource->Push(SettingsChanged); // Apply the new settings right away
+			}
 		}
-	}
-	if (message == WM_TASKBARCREATED) // Unfortunately, WM_TASKBARCREATED is not a constant, so I can't include it in the switch.
-	{
-		RefreshHandles();
-		initTray(tray_hwnd);
-	} else if (message == NEW_TTB_INSTANCE){
-		shouldsaveconfig = DoNotSave;
-		run = false;
-	}
-	return DefWindowProc(hWnd, message, wParam, lParam);
-}
-
-void SetTaskbarBlur()
-{
-	// std::cout << opt.dynamicws << std::endl;	
-
-	
-	if (counter >= 10)   // Change this if you want to change the time it takes for the program to update
-	{                   // 100 = 1 second; we use 10, because the difference is less noticeable and it has
-						// no large impact on CPU. We can change this if we feel that CPU is more important
-						// than response time.
-		for (auto &taskbar: taskbars)
-		{
-			taskbar.second.state = Normal; // Reset taskbar state
-		}
-		if (opt.dynamicws) {
-			counter = 0;
-			EnumWindows(&EnumWindowsProcess, NULL);
-		}
-	
-		if (opt.dynamicstart)
+		break;
+	case WM_CONFIGCHANGED:
 		{
-			HWND foreground;
-			TCHAR ForehWndClass[MAX_PATH];
-			TCHAR ForehWndName[MAX_PATH];
-
-			foreground = GetForegroundWindow();
-			GetWindowText(foreground, ForehWndName, _countof(ForehWndName));
-			GetClassName(foreground, ForehWndClass, _countof(ForehWndClass));
-
-			if (!_tcscmp(ForehWndClass, _T("Windows.UI.Core.CoreWindow")) &&
-			(!_tcscmp(ForehWndName, _T("Search")) || !_tcscmp(ForehWndName, _T("Cortana"))))
+			// Keys removed from the file keep their current value, like after a tray menu change
+			std::shared_ptr<const CONFIGENTRIES> entries = std::atomic_exchange(&pendingconfig, std::shared_ptr<const CONFIGENTRIES>());
+			if (entries)
 			{
-				// Detect monitor Start Menu is open on
-				HMONITOR _monitor;
-				_monitor = MonitorFromWindow(foreground, MONITOR_DEFAULTTOPRIMARY);
-				for (auto &taskbar: taskbars)
+				forcedtransparency = -1;
+				ApplyConfig(*entries);
+				RefreshMenu();
+				if (scheduler)
 				{
-					if (taskbar.second.hmon == _monitor)
-					{
-						taskbar.second.state = StartMenuOpen;
-					} else {
-						taskbar.second.state = Normal;
-					}
+					scheduler->SetOptions(EffectiveScheduling(scheduling, opt.dynamicws));
 				}
 			}
+			if (eventsource)
+			{
+				eventsource->Push(SettingsChanged); // New exclusions are picked up by the next pass on their own
+			}
+		}
+		break;
+	case WM_STATEPUBLISHED:
+		ApplyLatestState();
+		break;
+	case WM_TIMER:
+		if (wParam == IDT_TRANSITION)
+		{
+			ApplyLatestState();
+		}
+		break;
+	case WM_DISPLAYCHANGE:
+		if (eventsource)
+		{
+			eventsource->Push(MonitorsChanged);
+		}
+		break;
+	case WM_SETTINGCHANGE:
+		if (wParam == SPI_SETWORKAREA && eventsource)
+		{
+			eventsource->Push(MonitorsChanged); // A taskbar was moved, resized or set to auto-hide
 		}
+		break;
 	}
-
-	for (auto const &taskbar: taskbars)
+	if (message == WM_TASKBARCREATED) // Unfortunately, WM_TASKBARCREATED is not a constant, so I can't include it in the switch.
 	{
-		if (taskbar.second.state == WindowMaximised) {
-			SetWindowBlur(taskbar.first, DYNAMIC_WS_STATE);
-											// A window is maximised; let's make sure that we blur the window.
-		} else if (taskbar.second.state == Normal) {
-			SetWindowBlur(taskbar.first);  // Taskbar should be normal, call using normal transparency settings
+		if (controller)
+		{
+			controller->RefreshHandles();
 		}
-
+		initTray(tray_hwnd);
+		if (eventsource)
+		{
+			eventsource->Push(SettingsChanged); // The new taskbar starts out with the default appearance
+		}
+	} else if (message == NEW_TTB_INSTANCE){
+		shouldsaveconfig = DoNotSave;
+		PostQuitMessage(0);
 	}
-	counter++;
+	return DefWindowProc(hWnd, message, wParam, lParam);
 }
 
 #pragma endregion
@@ -986,7 +1083,6 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPreInst, LPSTR pCmdLine, int
 		SendMessage(oldInstance, NEW_TTB_INSTANCE, NULL, NULL);
 	}
 
-	MSG msg; // for message translation and dispatch
 	popup = LoadMenu(hInstance, MAKEINTRESOURCE(IDR_POPUP_MENU));
 	menu = GetSubMenu(popup, 0);
 	WNDCLASSEX wnd = { 0 };
@@ -1009,35 +1105,173 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPreInst, LPSTR pCmdLine, int
 
 	ShowWindow(tray_hwnd, WM_SHOWWINDOW);
 	
-	//Virtual Desktop stuff
 	::CoInitialize(NULL);
-	HRESULT desktop_success = ::CoCreateInstance(__uuidof(VirtualDesktopManager), NULL, CLSCTX_INPROC_SERVER, IID_IVirtualDesktopManager, (void **)&desktop_manager);
-	if (!desktop_success) { OutputDebugStringW(L"Initialization of VirtualDesktopManager failed"); }
 
-	RefreshHandles();
-	if (opt.dynamicws)
-	{
-		EnumWindows(&EnumWindowsProcess, NULL); // Putting this here so there isn't a
-												// delay between when you start the
-												// program and when the taskbar goes blurry
-	}
+	// Taskbars are only touched from this thread. Windows are enumerated and classified
+	// on a worker, so a hung window or a slow process can't hold up the tray icon.
+	Win32Backend backend(NULL);
+	TaskbarController taskbarcontroller(backend, opt);
+	controller = &taskbarcontroller;
+
+	Win32Backend workerbackend(NULL);
+	std::FILE *trace = tracefile.empty() ? NULL : _wfopen(tracefile.c_str(), L"ab");
+	std::unique_ptr<TraceRecorder> recorder(trace ? new TraceRecorder(workerbackend, trace) : nullptr);
+	WindowClassifier classifier(recorder ? static_cast<Backend &>(*recorder) : workerbackend, exclusions);
+	classifier.SetRecorder(recorder.get());
+	classifier.SetMetrics(&metrics);
+	classifier.SetDecisionTrace(&decisions);
+	taskbarcontroller.SetMetrics(&metrics);
+	taskbarcontroller.SetDecisionTrace(&decisions);
+	ClassificationWorker classificationworker(classifier,
+		[]() { PostMessage(tray_hwnd, WM_STATEPUBLISHED, 0, 0); },
+		[&workerbackend]()
+		{
+			SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL); // Never take the CPU away from the UI thread
+
+			//Virtual Desktop stuff
+			::CoInitialize(NULL);
+			HRESULT desktop_success = ::CoCreateInstance(__uuidof(VirtualDesktopManager), NULL, CLSCTX_INPROC_SERVER, IID_IVirtualDesktopManager, (void **)&desktop_manager);
+			if (FAILED(desktop_success)) { OutputDebugStringW(L"Initialization of VirtualDesktopManager failed"); }
+			workerbackend.SetDesktopManager(desktop_manager);
+		},
+		[&workerbackend]()
+		{
+			workerbackend.SetDesktopManager(NULL);
+			if (desktop_manager)
+			{
+				desktop_manager->Release();
+				desktop_manager = NULL;
+			}
+			::CoUninitialize();
+		});
+	classificationworker.SetMetrics(&metrics);
+	worker = &classificationworker;
+
+	// Sleeps until a window is maximised or restored, the foreground window or the
+	// monitors change, or the refresh timer expires, instead of waking up every 10 ms.
+	Win32EventSource source;
+	eventsource = &source;
+
+	taskbarcontroller.RefreshHandles();
+	classificationworker.Start();
+	// Putting this here so there isn't a delay between when you start the program and
+	// when the taskbar goes blurry
+	classificationworker.Request(PassSettings, source.Now(), opt.dynamicws, opt.dynamicstart, opt.dynamicws_mode);
 	WM_TASKBARCREATED = RegisterWindowMessage(L"TaskbarCreated");
 
-	while (run) {
-		if (PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE)) {
-			TranslateMessage(&msg);
-			DispatchMessage(&msg);
-		}
-		SetTaskbarBlur();
-		Sleep(10);
-	}
+	// Pick up changes to the config and exclusion files without a restart
+	ConfigWatcher watcher(tray_hwnd, WM_CONFIGCHANGED);
+	watcher.Watch(configfile, [](const std::wstring &path) { std::atomic_store(&pendingconfig, std::make_shared<const CONFIGENTRIES>(ReadConfigFile(path))); metrics.Add(MetricReloads); });
+	watcher.Watch(ExcludeFile, [](const std::wstring &path) { ParseDWSExcludesFile(path); metrics.Add(MetricReloads); });
+	watcher.Start();
+
+	// Sleep until TranslucentTB.exe --stats or --dump-decisions asks for something
+	MetricsServer metricsserver(METRICS_PIPE, []() { return metrics.Snapshot(); });
+	metricsserver.Start();
+	MetricsServer decisionserver(DECISIONS_PIPE, []() { return decisions.ChromeTrace(); });
+	decisionserver.Start();
+
+	std::uint64_t started = source.Now();
+	// Refreshes less and less often while the desktop is idle, see SCHEDULEROPTIONS and EffectiveScheduling
+	Scheduler passscheduler(source, EffectiveScheduling(scheduling, opt.dynamicws));
+	scheduler = &passscheduler;
+	passscheduler.Run(
+		[&](unsigned int reason)
+		{
+			taskbarcontroller.Prepare(reason);
+			classificationworker.Request(reason, source.Now(), opt.dynamicws, opt.dynamicstart, opt.dynamicws_mode); // Applied once WM_STATEPUBLISHED comes back
+		},
+		[&](const EVENT &ev) { classificationworker.Post(ev); });
+	double minutes = (source.Now() - started) / 60000.0;
+	scheduler = nullptr;
+	eventsource = nullptr;
+	worker = nullptr;
+	classificationworker.Stop();
+	KillTimer(tray_hwnd, IDT_TRANSITION);
+	watcher.Stop(); // Before saving, we would only reload our own changes
+	metricsserver.Stop();
+	decisionserver.Stop();
+
 	Shell_NotifyIcon(NIM_DELETE, &Tray);
 
 	if (shouldsaveconfig != DoNotSave)
 		SaveConfigFile();
 
 	opt.taskbar_appearance = ACCENT_NORMAL_GRADIENT;
-	SetTaskbarBlur();
+	taskbarcontroller.SetTaskbarBlur();
+	controller = nullptr;
+
+	wchar_t stats[256];
+	const COMPOSITIONSTATS &compositionstats = taskbarcontroller.CompositionStats();
+	swprintf_s(stats, L"SetWindowCompositionAttribute calls: %llu issued, %llu skipped\n", compositionstats.issued, compositionstats.skipped);
+	OutputDebugStringW(stats);
+	const PROCESSCACHESTATS &processstats = classifier.ProcessCacheStats();
+	swprintf_s(stats, L"Process name cache: %llu hits, %llu from %llu snapshots, %llu misses, %llu evictions\n", processstats.hits, processstats.resolved, processstats.snapshots, processstats.misses, processstats.evictions);
+	OutputDebugStringW(stats);
+	const MAXIMISEDINDEXSTATS &indexstats = classifier.MaximisedWindowStats();
+	swprintf_s(stats, L"Maximised windows: %llu updates, %llu full enumerations, %llu corrections\n", indexstats.updates, indexstats.reconciles, indexstats.corrections);
+	OutputDebugStringW(stats);
+	const GEOMETRYINDEXSTATS &geometrystats = classifier.WindowGeometryStats();
+	swprintf_s(stats, L"Window geometry: %llu updates, %llu full enumerations, %llu corrections, %llu edge lookups\n", geometrystats.updates, geometrystats.reconciles, geometrystats.corrections, geometrystats.queries);
+	OutputDebugStringW(stats);
+	const STARTMENUSTATS &startstats = classifier.StartMenuStats();
+	const FULLSCREENSTATS &fullscreenstats = classifier.FullscreenStats();
+	const PARKSTATS &parkstats = taskbarcontroller.ParkStats();
+	swprintf_s(stats, L"Fullscreen: %llu covers, %llu lookups, taskbars parked %llu times for %llu ms, %llu applies skipped\n", fullscreenstats.covers, fullscreenstats.lookups, parkstats.parks, parkstats.parked_ms, parkstats.skipped);
+	OutputDebugStringW(stats);
+	swprintf_s(stats, L"Start menu: %llu foreground changes, %llu lookups, %llu identifications, %llu resyncs\n", startstats.foregroundchanges, startstats.lookups, startstats.identifications, startstats.resyncs);
+	OutputDebugStringW(stats);
+	const DESKTOPCACHESTATS &desktopstats = classifier.DesktopCacheStats();
+	swprintf_s(stats, L"Virtual desktops: %llu COM calls (%.1f per minute), %llu cached answers, %llu windows moved, %llu desktop switches\n", desktopstats.queries, minutes > 0 ? desktopstats.queries / minutes : 0.0, desktopstats.hits, desktopstats.moves, desktopstats.switches);
+	OutputDebugStringW(stats);
+	for (DYNAMICWSMODE mode : { DynamicWsMaximised, DynamicWsGeometry })
+	{
+		const QualifyPipeline &checks = classifier.QualifyChecks(mode);
+		for (QUALIFYSTAGE stage : checks.Order())
+		{
+			const STAGESTATS &stagestats = checks.Stats(stage);
+			swprintf_s(stats, L"Qualifying windows (%ls): %ls check, %llu runs, %llu rejections, %llu cached, %llu ns average\n", mode == DynamicWsGeometry ? L"geometry" : L"maximised", StageName(stage), stagestats.runs, stagestats.rejections, stagestats.cached, stagestats.timed ? stagestats.ns / stagestats.timed : 0);
+			OutputDebugStringW(stats);
+		}
+	}
+	const VERDICTCACHESTATS &verdictstats = classifier.VerdictCacheStats();
+	swprintf_s(stats, L"Exclusion verdicts: %llu hits, %llu revalidations, %llu misses, %llu ns per miss\n", verdictstats.hits, verdictstats.revalidations, verdictstats.misses, verdictstats.misses ? verdictstats.evaluation_ns / verdictstats.misses : 0);
+	OutputDebugStringW(stats);
+	ARENASTATS arenastats = classifier.ArenaStats();
+	swprintf_s(stats, L"Pass arena: %llu passes, %llu grows, %zu KB peak, %zu KB held\n", arenastats.resets, arenastats.grows, arenastats.peak / 1024, arenastats.capacity / 1024);
+	OutputDebugStringW(stats);
+	WORKERSTATS workerstats = classificationworker.Stats();
+	swprintf_s(stats, L"Classification worker: %llu requests, %llu published, %llu queue overflows, last %llu us, max %llu us\n", workerstats.requests, workerstats.published, workerstats.overflows, workerstats.lastclassify_us, workerstats.maxclassify_us);
+	OutputDebugStringW(stats);
+	const TASKBARTABLESTATS &tablestats = taskbarcontroller.Taskbars().Stats();
+	swprintf_s(stats, L"Taskbars: %llu refreshes, %llu added, %llu removed, %llu moved to another monitor\n", tablestats.refreshes, tablestats.added, tablestats.removed, tablestats.moved);
+	OutputDebugStringW(stats);
+	const APPLYSTATS &applystats = taskbarcontroller.ApplyStats();
+	swprintf_s(stats, L"UI thread: %llu states applied, %llu us average, %llu us max\n", applystats.applies, applystats.applies ? applystats.total_ns / applystats.applies / 1000 : 0, applystats.max_ns / 1000);
+	OutputDebugStringW(stats);
+	const SCHEDULERSTATS &schedulerstats = passscheduler.Stats();
+	swprintf_s(stats, L"Scheduler parked: %llu times, %llu ms in all, %llu events ignored\n", schedulerstats.parks, schedulerstats.parked_ms, schedulerstats.ignored);
+	OutputDebugStringW(stats);
+	unsigned long long passcost = (workerstats.published ? workerstats.totalclassify_us / workerstats.published : 0) + (applystats.applies ? applystats.total_ns / applystats.applies / 1000 : 0);
+	swprintf_s(stats, L"Scheduler: %llu passes, one every %llu ms on average, at most %llu ms apart, %llu refreshes, %llu backoffs, refreshing every %u ms at exit, %llu us per pass\n", schedulerstats.passes, schedulerstats.passes ? schedulerstats.totalinterval / schedulerstats.passes : 0, schedulerstats.maxinterval, schedulerstats.refreshes, schedulerstats.backoffs, passscheduler.RefreshInterval(), passcost);
+	OutputDebugStringW(stats);
+	const TRANSITIONSTATS &transitionstats = taskbarcontroller.TransitionStats();
+	swprintf_s(stats, L"Taskbar transitions: %llu shown, %llu suppressed, %llu delayed by %llu ms on average, max %llu ms\n", transitionstats.transitions, transitionstats.suppressed, transitionstats.delayed, transitionstats.delayed ? transitionstats.delay_ms / transitionstats.delayed : 0, transitionstats.maxdelay_ms);
+	OutputDebugStringW(stats);
+	RELOADSTATS reloadstats = watcher.Stats();
+	if (recorder)
+	{
+		const TRACESTATS &tracestats = recorder->Stats();
+		swprintf_s(stats, L"Trace: %llu records, %llu strings, %llu bytes\n", tracestats.records, tracestats.strings, tracestats.bytes);
+		OutputDebugStringW(stats);
+		recorder.reset();
+		fclose(trace);
+	}
+	swprintf_s(stats, L"Config reloads: %llu, last %llu us parse / %llu ms latency, max %llu us / %llu ms\n", reloadstats.reloads, reloadstats.lastparse_us, reloadstats.lastlatency_ms, reloadstats.maxparse_us, reloadstats.maxlatency_ms);
+	OutputDebugStringW(stats);
+	swprintf_s(stats, L"Metrics: %llu snapshots served, %llu decisions traced, %llu dumps served\n", metricsserver.Served(), decisions.Emitted(), decisionserver.Served());
+	OutputDebugStringW(stats);
+
 	CloseHandle(ev);
 	return 0;
 }
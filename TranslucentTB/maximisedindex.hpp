@@ -0,0 +1,190 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+
+#include "arena.hpp"
+#include "eventloop.hpp"
+
+struct MAXIMISEDINDEXSTATS
+{
+	unsigned long long updates;     // Single window updates, from events
+	unsigned long long reconciles;  // Full enumerations checked against the index
+	unsigned long long corrections; // Windows a full enumeration found to be out of date
+};
+
+// For every monitor, the set of windows on it that currently make dynamic-ws kick in
+// (maximised, visible, on the current virtual desktop and not excluded).
+//
+// It is kept up to date one window at a time as events come in, so the cost of an
+// event doesn't depend on how many windows are open. A full enumeration is only
+// needed once in a while to make sure no event was missed (Reconcile). Nodes come
+// from a pool, so windows being maximised and restored all day don't touch the heap.
+class MaximisedWindowIndex
+{
+public:
+	MaximisedWindowIndex() :
+		m_Windows(0, std::hash<WINDOWID>(), std::equal_to<WINDOWID>(), WINDOWMAP::allocator_type(m_Pool)),
+		m_Generation(0),
+		m_Stats()
+	{ }
+
+	// Records the current state of a window. O(1).
+	void Update(WINDOWID window, bool qualifies, MONITORID monitor)
+	{
+		m_Stats.updates++;
+		Set(window, qualifies, monitor);
+	}
+
+	// A window was destroyed. O(1).
+	void Remove(WINDOWID window)
+	{
+		auto it = m_Windows.find(window);
+		if (it != m_Windows.end())
+		{
+			Erase(it);
+		}
+	}
+
+	bool HasMaximised(MONITORID monitor) const
+	{
+		return Count(monitor) != 0;
+	}
+
+	size_t Count(MONITORID monitor) const
+	{
+		auto it = m_Monitors.find(monitor);
+		return it != m_Monitors.end() ? it->second : 0;
+	}
+
+	// Every monitor with at least one qualifying window on it, into any vector of MONITORID.
+	template<typename LIST>
+	void Monitors(LIST &monitors) const
+	{
+		monitors.clear();
+		for (const auto &monitor : m_Monitors)
+		{
+			if (monitor.second)
+			{
+				monitors.push_back(monitor.first);
+			}
+		}
+	}
+
+	size_t Size() const { return m_Windows.size(); }
+
+	// Makes the index match the result of a full enumeration: every qualifying window
+	// along with its monitor, in any vector of pairs. Returns the number of windows that
+	// had to be corrected.
+	template<typename LIST>
+	size_t Reconcile(const LIST &qualifying)
+	{
+		m_Stats.reconciles++;
+		size_t corrections = 0;
+
+		// Windows still qualifying are stamped, the others are left behind
+		m_Generation++;
+		for (const auto &window : qualifying)
+		{
+			auto it = m_Windows.find(window.first);
+			if (it == m_Windows.end())
+			{
+				continue; // Added below
+			}
+			else if (it->second.monitor != window.second)
+			{
+				corrections++;
+				Set(window.first, true, window.second); // Stamps it
+			}
+			else
+			{
+				it->second.generation = m_Generation;
+			}
+		}
+
+		// Stale windows go before new ones come in, so their nodes are reused
+		for (auto it = m_Windows.begin(); it != m_Windows.end(); )
+		{
+			if (it->second.generation != m_Generation)
+			{
+				corrections++;
+				it = Erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		for (const auto &window : qualifying)
+		{
+			if (!m_Windows.count(window.first))
+			{
+				corrections++;
+				Set(window.first, true, window.second);
+			}
+		}
+
+		m_Stats.corrections += corrections;
+		return corrections;
+	}
+
+	// Makes room for as many windows as there are, so windows coming and going never
+	// make the index grow its hash table.
+	void Reserve(size_t windows)
+	{
+		m_Windows.reserve(windows);
+	}
+
+	void Clear()
+	{
+		m_Windows.clear();
+		m_Monitors.clear();
+	}
+
+	const MAXIMISEDINDEXSTATS &Stats() const { return m_Stats; }
+
+private:
+	struct ENTRY
+	{
+		MONITORID monitor;
+		unsigned int generation; // Of the last Reconcile that saw it
+	};
+	typedef std::unordered_map<WINDOWID, ENTRY, std::hash<WINDOWID>, std::equal_to<WINDOWID>, PoolAllocator<std::pair<const WINDOWID, ENTRY>>> WINDOWMAP;
+
+	void Set(WINDOWID window, bool qualifies, MONITORID monitor)
+	{
+		auto it = m_Windows.find(window);
+		if (it != m_Windows.end())
+		{
+			if (qualifies && it->second.monitor == monitor)
+			{
+				return; // Nothing changed
+			}
+			Erase(it);
+		}
+
+		if (qualifies)
+		{
+			m_Windows.emplace(window, ENTRY { monitor, m_Generation });
+			m_Monitors[monitor]++;
+		}
+	}
+
+	WINDOWMAP::iterator Erase(WINDOWMAP::iterator it)
+	{
+		auto monitor = m_Monitors.find(it->second.monitor);
+		if (monitor != m_Monitors.end())
+		{
+			monitor->second--;
+		}
+		return m_Windows.erase(it);
+	}
+
+	NodePool m_Pool; // Before the map, which gives its nodes back when destroyed
+	WINDOWMAP m_Windows; // Only windows that qualify
+	std::unordered_map<MONITORID, size_t> m_Monitors; // How many qualifying windows each has, kept at 0 rather than erased
+	unsigned int m_Generation;
+	MAXIMISEDINDEXSTATS m_Stats;
+};
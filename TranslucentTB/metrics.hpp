@@ -0,0 +1,190 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <string>
+
+const std::size_t HISTOGRAM_BUCKETS = 24; // Bucket i holds values below 2^i, the last one also everything above
+
+// What the process counts, each from a single thread: the one named here.
+enum METRICCOUNTER
+{
+	MetricTicks,            // States applied to the taskbars (UI thread)
+	MetricPasses,           // Classifications run (worker)
+	MetricEnumerations,     // Passes that enumerated every window (worker)
+	MetricWindowsVisited,   // Windows looked at by a pass (worker)
+	MetricWindowsQualified, // ...that could change the taskbar of their monitor (worker)
+	MetricPoliciesIssued,   // SetAccentPolicy calls made (UI thread)
+	MetricPoliciesSkipped,  // ...and avoided, the taskbar already had that policy (UI thread)
+	MetricReloads,          // Config or exclusion files reloaded (config watcher)
+	METRIC_COUNTERS
+};
+
+// What the process times, from a single thread as well.
+enum METRICHISTOGRAM
+{
+	MetricTickTime,      // Applying a state to the taskbars, in us (UI thread)
+	MetricPassTime,      // Classifying the windows, in us (worker)
+	MetricExclusionTime, // Running the exclusion rules against a window, in ns (worker)
+	METRIC_HISTOGRAMS
+};
+
+// Names in the snapshot, plain ASCII so it reads the same in any console.
+inline const char *MetricName(METRICCOUNTER counter)
+{
+	switch (counter)
+	{
+	case MetricTicks: return "ticks";
+	case MetricPasses: return "passes";
+	case MetricEnumerations: return "enumerations";
+	case MetricWindowsVisited: return "windows_visited";
+	case MetricWindowsQualified: return "windows_qualified";
+	case MetricPoliciesIssued: return "policies_issued";
+	case MetricPoliciesSkipped: return "policies_skipped";
+	default: return "reloads";
+	}
+}
+
+inline const char *MetricName(METRICHISTOGRAM histogram)
+{
+	switch (histogram)
+	{
+	case MetricTickTime: return "tick_us";
+	case MetricPassTime: return "pass_us";
+	default: return "exclusion_ns";
+	}
+}
+
+// Only ever added to by one thread, so an increment is a plain load and store rather
+// than a locked read-modify-write. Any thread can read it, at worst one update behind.
+class MetricCounter
+{
+public:
+	MetricCounter() : m_Value(0) { }
+
+	void Add(unsigned long long value = 1)
+	{
+		m_Value.store(m_Value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	unsigned long long Value() const { return m_Value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<unsigned long long> m_Value;
+};
+
+// Counts values by power of two, which is as precise as a latency needs to be and
+// makes recording one a handful of counter updates. Same threading as MetricCounter.
+class LatencyHistogram
+{
+public:
+	LatencyHistogram() : m_Max(0) { }
+
+	void Record(unsigned long long value)
+	{
+		m_Buckets[Bucket(value)].Add();
+		m_Count.Add();
+		m_Sum.Add(value);
+		if (value > m_Max.load(std::memory_order_relaxed))
+		{
+			m_Max.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	unsigned long long Count() const { return m_Count.Value(); }
+	unsigned long long Sum() const { return m_Sum.Value(); }
+	unsigned long long Max() const { return m_Max.load(std::memory_order_relaxed); }
+	unsigned long long BucketCount(std::size_t bucket) const { return m_Buckets[bucket].Value(); }
+
+	// The value `fraction` of the recorded ones are at most, rounded up to the end of its
+	// bucket, but never past the largest one recorded. 0 when nothing was.
+	unsigned long long Percentile(double fraction) const
+	{
+		unsigned long long count = Count();
+		unsigned long long seen = 0;
+		for (std::size_t bucket = 0; bucket < HISTOGRAM_BUCKETS && count; bucket++)
+		{
+			seen += BucketCount(bucket);
+			if (seen >= fraction * count)
+			{
+				unsigned long long bound = (1ULL << bucket) - 1;
+				return bucket + 1 < HISTOGRAM_BUCKETS && bound < Max() ? bound : Max();
+			}
+		}
+		return Max(); // The buckets were read while values were still coming in
+	}
+
+	static std::size_t Bucket(unsigned long long value)
+	{
+		std::size_t bucket = 0;
+		while (value && bucket + 1 < HISTOGRAM_BUCKETS)
+		{
+			value >>= 1;
+			bucket++;
+		}
+		return bucket;
+	}
+
+private:
+	MetricCounter m_Buckets[HISTOGRAM_BUCKETS];
+	MetricCounter m_Count;
+	MetricCounter m_Sum;
+	std::atomic<unsigned long long> m_Max;
+};
+
+// Every counter and histogram of the process, updated as it goes and only looked at when
+// someone asks for a Snapshot(), so keeping them costs next to nothing. Components are
+// handed a pointer to it, and don't count anything without one.
+class MetricsRegistry
+{
+public:
+	void Add(METRICCOUNTER counter, unsigned long long value = 1) { m_Counters[counter].Add(value); }
+	void Record(METRICHISTOGRAM histogram, unsigned long long value) { m_Histograms[histogram].Record(value); }
+
+	const MetricCounter &Counter(METRICCOUNTER counter) const { return m_Counters[counter]; }
+	const LatencyHistogram &Histogram(METRICHISTOGRAM histogram) const { return m_Histograms[histogram]; }
+
+	// One `name value` line per counter, then one line per histogram followed by its
+	// non-empty buckets, each as the bound its values are below and how many there are.
+	// Safe from any thread, though counts taken while a pass runs may not all agree.
+	std::string Snapshot() const
+	{
+		std::string text;
+		char line[160];
+		for (int i = 0; i < METRIC_COUNTERS; i++)
+		{
+			METRICCOUNTER counter = static_cast<METRICCOUNTER>(i);
+			std::snprintf(line, sizeof(line), "%s %llu\n", MetricName(counter), m_Counters[counter].Value());
+			text += line;
+		}
+		for (int i = 0; i < METRIC_HISTOGRAMS; i++)
+		{
+			METRICHISTOGRAM histogram = static_cast<METRICHISTOGRAM>(i);
+			const LatencyHistogram &values = m_Histograms[histogram];
+			unsigned long long count = values.Count();
+			std::snprintf(line, sizeof(line), "%s count %llu mean %llu p50 %llu p90 %llu p99 %llu max %llu\n", MetricName(histogram),
+				count, count ? values.Sum() / count : 0, values.Percentile(0.5), values.Percentile(0.9), values.Percentile(0.99), values.Max());
+			text += line;
+			for (std::size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+			{
+				if (unsigned long long inbucket = values.BucketCount(bucket))
+				{
+					if (bucket + 1 < HISTOGRAM_BUCKETS)
+					{
+						std::snprintf(line, sizeof(line), "  < %llu %llu\n", 1ULL << bucket, inbucket);
+					}
+					else
+					{
+						std::snprintf(line, sizeof(line), "  >= %llu %llu\n", 1ULL << (bucket - 1), inbucket);
+					}
+					text += line;
+				}
+			}
+		}
+		return text;
+	}
+
+private:
+	MetricCounter m_Counters[METRIC_COUNTERS];
+	LatencyHistogram m_Histograms[METRIC_HISTOGRAMS];
+};
@@ -0,0 +1,238 @@
+#pragma once
+#include <windows.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics.hpp"
+
+const DWORD METRICS_PIPE_BUFFER = 64 * 1024; // Bigger than a metrics snapshot, so writing one never waits for the reader
+const DWORD METRICS_RETRY_DELAY = 1000;      // Before trying to create the pipe again (ms)
+const DWORD METRICS_CONNECT_TIMEOUT = 2000;  // How long --stats waits for the pipe to be free (ms)
+
+const wchar_t *const METRICS_PIPE = L"metrics";
+const wchar_t *const DECISIONS_PIPE = L"decisions"; // DecisionTrace::ChromeTrace
+
+// One pipe per session, so every user signed in to the machine gets their own instance's.
+inline std::wstring MetricsPipeName(const wchar_t *pipe = METRICS_PIPE)
+{
+	DWORD session = 0;
+	ProcessIdToSessionId(GetCurrentProcessId(), &session);
+	return L"\\\\.\\pipe\\TranslucentTB-" + std::wstring(pipe) + L"-" + std::to_wstring(session);
+}
+
+// The TOKEN_USER of this process, which holds its user's SID. False if it can't be read.
+inline bool CurrentUser(std::vector<BYTE> &user)
+{
+	HANDLE token = NULL;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+	{
+		return false;
+	}
+	DWORD size = 0;
+	GetTokenInformation(token, TokenUser, NULL, 0, &size);
+	user.resize(size);
+	bool read = size && GetTokenInformation(token, TokenUser, user.data(), size, &size);
+	CloseHandle(token);
+	return read;
+}
+
+inline PSID UserSid(std::vector<BYTE> &user)
+{
+	return reinterpret_cast<TOKEN_USER *>(user.data())->User.Sid;
+}
+
+// Whether the pipe belongs to this process' user, as MetricsServer makes it. The name is
+// known to everyone, so another user could have created it first.
+inline bool IsOwnPipe(HANDLE pipe)
+{
+	std::vector<BYTE> user;
+	DWORD size = 0;
+	GetKernelObjectSecurity(pipe, OWNER_SECURITY_INFORMATION, NULL, 0, &size);
+	std::vector<BYTE> descriptor(size);
+	PSID owner = NULL;
+	BOOL defaulted = FALSE;
+	return size && CurrentUser(user) &&
+		GetKernelObjectSecurity(pipe, OWNER_SECURITY_INFORMATION, descriptor.data(), size, &size) &&
+		GetSecurityDescriptorOwner(descriptor.data(), &owner, &defaulted) &&
+		owner && EqualSid(owner, UserSid(user));
+}
+
+// Asks the instance running in this session for what it serves on `what`, false if
+// there is none, or if the pipe isn't one of ours.
+inline bool ReadMetrics(std::string &text, const wchar_t *what = METRICS_PIPE)
+{
+	std::wstring name = MetricsPipeName(what);
+	HANDLE pipe = INVALID_HANDLE_VALUE;
+	while (WaitNamedPipeW(name.c_str(), METRICS_CONNECT_TIMEOUT))
+	{
+		pipe = CreateFileW(name.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING, 0, NULL);
+		if (pipe != INVALID_HANDLE_VALUE || GetLastError() != ERROR_PIPE_BUSY)
+		{
+			break; // Busy means another client got there first, wait for the next one
+		}
+	}
+	if (pipe == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	if (!IsOwnPipe(pipe))
+	{
+		CloseHandle(pipe);
+		return false;
+	}
+
+	text.clear();
+	char buffer[4096];
+	DWORD read = 0;
+	while (ReadFile(pipe, buffer, sizeof(buffer), &read, NULL) && read)
+	{
+		text.append(buffer, read);
+	}
+	CloseHandle(pipe);
+	return !text.empty();
+}
+
+// Hands a snapshot to whoever connects to MetricsPipeName(pipe), on a thread of its own
+// that sleeps in between, so nothing is formatted unless someone asks. The pipe rejects
+// remote clients, is only ever read from, and only this process' user can open it: it
+// is owned by that user, whose access is the only one its DACL grants. Another user
+// can still take the name first, the server then never gets to create the pipe and
+// serves nothing, and clients see it isn't ours from IsOwnPipe.
+class MetricsServer
+{
+public:
+	typedef std::function<std::string()> SNAPSHOT;
+
+	// `snapshot` runs on the server's thread, once per client.
+	MetricsServer(const wchar_t *pipe, const SNAPSHOT &snapshot) :
+		m_Snapshot(snapshot),
+		m_Name(MetricsPipeName(pipe)),
+		m_Stop(CreateEventW(NULL, TRUE, FALSE, NULL)),
+		m_Served(0)
+	{ }
+
+	~MetricsServer()
+	{
+		Stop();
+		CloseHandle(m_Stop);
+	}
+
+	void Start()
+	{
+		if (!m_Thread.joinable())
+		{
+			ResetEvent(m_Stop);
+			m_Thread = std::thread(&MetricsServer::Run, this);
+		}
+	}
+
+	// Gives up on a client still reading, if there is one.
+	void Stop()
+	{
+		if (m_Thread.joinable())
+		{
+			SetEvent(m_Stop);
+			m_Thread.join();
+		}
+	}
+
+	// Snapshots handed out so far.
+	unsigned long long Served() const { return m_Served; }
+
+private:
+	// Waits for an overlapped operation on `pipe` to end, false if asked to stop first.
+	// `succeeded` is whether it did.
+	bool Wait(HANDLE pipe, OVERLAPPED &overlapped, bool &succeeded)
+	{
+		DWORD transferred = 0;
+		HANDLE handles[] = { m_Stop, overlapped.hEvent };
+		if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1)
+		{
+			CancelIoEx(pipe, &overlapped);
+			GetOverlappedResult(pipe, &overlapped, &transferred, TRUE); // It must be over before `overlapped` goes away
+			return false;
+		}
+		succeeded = GetOverlappedResult(pipe, &overlapped, &transferred, FALSE) != FALSE;
+		return true;
+	}
+
+	// Owned by this process' user, who alone gets access. False if the user's SID can't be
+	// read, nothing is served then rather than the pipe being open to everyone.
+	static bool OwnerOnly(std::vector<BYTE> &user, std::vector<BYTE> &acl, SECURITY_DESCRIPTOR &descriptor)
+	{
+		if (!CurrentUser(user))
+		{
+			return false;
+		}
+		PSID sid = UserSid(user);
+		acl.resize(sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) - sizeof(DWORD) + GetLengthSid(sid));
+		PACL dacl = reinterpret_cast<PACL>(acl.data());
+		return InitializeAcl(dacl, static_cast<DWORD>(acl.size()), ACL_REVISION) &&
+			AddAccessAllowedAce(dacl, ACL_REVISION, GENERIC_ALL, sid) &&
+			InitializeSecurityDescriptor(&descriptor, SECURITY_DESCRIPTOR_REVISION) &&
+			SetSecurityDescriptorOwner(&descriptor, sid, FALSE) && // Rather than Administrators when elevated, for IsOwnPipe
+			SetSecurityDescriptorDacl(&descriptor, TRUE, dacl, FALSE);
+	}
+
+	void Run()
+	{
+		std::vector<BYTE> user, acl;
+		SECURITY_DESCRIPTOR descriptor;
+		if (!OwnerOnly(user, acl, descriptor))
+		{
+			return;
+		}
+		SECURITY_ATTRIBUTES attributes = { sizeof(attributes), &descriptor, FALSE };
+
+		HANDLE completed = CreateEventW(NULL, TRUE, FALSE, NULL);
+		for (;;)
+		{
+			// A single instance, created anew for every client so each gets the pipe to itself
+			HANDLE pipe = CreateNamedPipeW(m_Name.c_str(), PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+				PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, METRICS_PIPE_BUFFER, 0, 0, &attributes);
+			if (pipe == INVALID_HANDLE_VALUE)
+			{
+				// Most likely the instance this one replaces hasn't exited yet, or the name was taken
+				if (WaitForSingleObject(m_Stop, METRICS_RETRY_DELAY) == WAIT_OBJECT_0)
+				{
+					break;
+				}
+				continue;
+			}
+
+			OVERLAPPED overlapped = {};
+			overlapped.hEvent = completed;
+			bool connected = ConnectNamedPipe(pipe, &overlapped) != FALSE;
+			DWORD error = connected ? ERROR_SUCCESS : GetLastError();
+			connected = connected || error == ERROR_PIPE_CONNECTED; // The client was quicker than us
+			if (error == ERROR_IO_PENDING && !Wait(pipe, overlapped, connected))
+			{
+				CloseHandle(pipe);
+				break;
+			}
+
+			if (connected)
+			{
+				std::string text = m_Snapshot();
+				bool written = WriteFile(pipe, text.data(), static_cast<DWORD>(text.size()), NULL, &overlapped) != FALSE;
+				if (!written && GetLastError() == ERROR_IO_PENDING && !Wait(pipe, overlapped, written))
+				{
+					CloseHandle(pipe);
+					break;
+				}
+				m_Served++;
+			}
+			CloseHandle(pipe); // Not disconnected: the client still gets to read what is left in the pipe
+		}
+		CloseHandle(completed);
+	}
+
+	SNAPSHOT m_Snapshot;
+	std::wstring m_Name;
+	HANDLE m_Stop;
+	std::thread m_Thread;
+	std::atomic<unsigned long long> m_Served;
+};
@@ -0,0 +1,656 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cwctype>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Tells whether a text matches any of a set of regular expressions, by combining them
+// all into one automaton. Each character of the text is one table lookup, however many
+// patterns there are.
+//
+// Supported syntax: literals, '.', [classes] with ranges and [^negation], \d \w \s and
+// their negations, \n \r \t, a backslash before any other character that isn't a letter
+// or a digit for that character itself, groups with '(' ')' or '(?:' ')', '|', '*', '+',
+// '?', and the '^' and '$' anchors. Without anchors a pattern may match anywhere in the
+// text. Anything else, like \b, \1 or {n,m}, is an error rather than being taken
+// literally.
+//
+// The patterns are compiled to an NFA when loading. The equivalent DFA is built lazily,
+// one state at a time as texts need it, so patterns like ".*a.*b.*c" don't blow up in
+// size; once built, a state is reused by every later match. Building a state walks the
+// NFA of every pattern still alive in it though, so the first texts matched against
+// thousands of patterns take a while, about half a millisecond each for 10000.
+class PatternAutomaton
+{
+public:
+	// Invalid patterns are left out, with a message for each added to `errors`.
+	PatternAutomaton(const std::vector<std::wstring> &patterns, bool fold, std::vector<std::wstring> *errors = nullptr) :
+		m_Fold(fold),
+		m_Patterns(0),
+		m_Start(-1)
+	{
+		std::vector<int> starts;
+		int accept = AddState(NfaAccept, 0);
+		for (const std::wstring &pattern : patterns)
+		{
+			size_t states = m_States.size(), sets = m_Sets.size();
+			PARSER parser = { *this, pattern, 0, std::wstring() };
+
+			FRAGMENT fragment;
+			if (parser.ParseAlternation(fragment) && parser.position != pattern.length())
+			{
+				parser.error = L"unmatched ')'";
+			}
+
+			if (!parser.error.empty())
+			{
+				if (errors)
+				{
+					errors->push_back(L"'" + pattern + L"': " + parser.error);
+				}
+				m_States.resize(states); // Throw away what was built for it
+				m_Sets.resize(sets);
+				continue;
+			}
+
+			Patch(fragment.outs, accept);
+			starts.push_back(fragment.start);
+			m_Patterns++;
+		}
+
+		if (!m_Patterns)
+		{
+			return;
+		}
+
+		// Any of the patterns
+		int root = starts[0];
+		for (size_t i = 1; i < starts.size(); i++)
+		{
+			root = AddState(NfaSplit, 0, -1, root, starts[i]);
+		}
+
+		// The text is fed as SYMBOL_BEGIN, its characters, then SYMBOL_END; '^' and '$'
+		// match those. Patterns are tried right at the start, where only '^' gets past
+		// SYMBOL_BEGIN, and after any number of characters.
+		int skip = AddState(NfaSplit, 0);
+		int any = AddState(NfaSet, 0, AddSet(CHARSET{ {}, true }), skip);
+		m_States[skip].out = any;
+		m_States[skip].out1 = root;
+		int begin = AddState(NfaSymbol, SYMBOL_BEGIN, -1, skip);
+		int start = AddState(NfaSplit, 0, -1, root, begin);
+
+		std::vector<int> initial(1, start);
+		m_Start = DfaState(Closure(initial));
+	}
+
+	// Whether `pattern` only uses supported syntax, and if not, why in `error`.
+	static bool Check(const std::wstring &pattern, std::wstring &error)
+	{
+		PatternAutomaton automaton(std::vector<std::wstring>(), false); // Only to build into
+		PARSER parser = { automaton, pattern, 0, std::wstring() };
+		FRAGMENT fragment;
+		if (parser.ParseAlternation(fragment) && parser.position != pattern.length())
+		{
+			parser.error = L"unmatched ')'";
+		}
+		error = parser.error;
+		return error.empty();
+	}
+
+	bool Empty() const { return m_Patterns == 0; }
+
+	bool Matches(const wchar_t *text, size_t length) const
+	{
+		if (Empty())
+		{
+			return false;
+		}
+
+		std::lock_guard<std::mutex> guard(m_Lock);
+		if (m_Dfa.size() > MAX_DFA_STATES)
+		{
+			FlushDfa(); // Pathological patterns or texts, start over rather than keep growing
+		}
+
+		int state = Step(m_Start, SYMBOL_BEGIN);
+		for (size_t i = 0; i < length && !m_Dfa[state].accepting; i++)
+		{
+			std::uint32_t symbol = static_cast<std::uint32_t>(m_Fold ? std::towlower(text[i]) : text[i]);
+			state = Step(state, symbol);
+		}
+		if (!m_Dfa[state].accepting)
+		{
+			state = Step(state, SYMBOL_END);
+		}
+		return m_Dfa[state].accepting;
+	}
+
+	// Number of DFA states built so far.
+	size_t DfaSize() const
+	{
+		std::lock_guard<std::mutex> guard(m_Lock);
+		return m_Dfa.size();
+	}
+
+	// A glob matches a whole string: '*' is any number of characters, '?' any single
+	// one, and [classes] work as in regular expressions, except '!' negates them too.
+	static std::wstring GlobToRegex(const std::wstring &glob)
+	{
+		std::wstring regex = L"^";
+		for (size_t i = 0; i < glob.length(); i++)
+		{
+			wchar_t c = glob[i];
+			if (c == L'*')
+			{
+				regex += L".*";
+			}
+			else if (c == L'?')
+			{
+				regex += L'.';
+			}
+			else if (c == L'[' && glob.find(L']', i + 2) != std::wstring::npos)
+			{
+				size_t end = glob.find(L']', i + 2);
+				regex += L'[';
+				size_t first = i + 1;
+				if (glob[first] == L'!' || glob[first] == L'^')
+				{
+					regex += L'^';
+					first++;
+				}
+				regex.append(glob, first, end - first);
+				regex += L']';
+				i = end;
+			}
+			else
+			{
+				if (std::wstring(L"\\^$.|+()[]{}").find(c) != std::wstring::npos)
+				{
+					regex += L'\\';
+				}
+				regex += c;
+			}
+		}
+		return regex + L"$";
+	}
+
+private:
+	static const std::uint32_t SYMBOL_BEGIN = 0x110000; // Before the first character, past the last code point
+	static const std::uint32_t SYMBOL_END = 0x110001;   // After the last one
+	static const size_t MAX_DFA_STATES = 10000;
+
+	enum NFAKIND { NfaSymbol, NfaSet, NfaSplit, NfaAccept };
+
+	struct NFASTATE
+	{
+		NFAKIND kind;
+		std::uint32_t symbol; // NfaSymbol
+		int set;              // NfaSet, index in m_Sets
+		int out;              // Next state, -1 if none
+		int out1;             // Second choice of a NfaSplit, -1 if none
+	};
+
+	struct CHARSET
+	{
+		std::vector<std::pair<std::uint32_t, std::uint32_t>> ranges; // Inclusive
+		bool negated;
+	};
+
+	// Part of the NFA being built: where it starts, and the transitions still pointing
+	// nowhere, encoded as state * 2 + (0 for out, 1 for out1).
+	struct FRAGMENT
+	{
+		int start;
+		std::vector<int> outs;
+	};
+
+	struct DFASTATE
+	{
+		std::vector<int> nfa; // Sorted
+		bool accepting;
+		int ascii[128];       // Next state for each ASCII character, -1 until needed
+		std::unordered_map<std::uint32_t, int> other;
+	};
+
+	// Recursive descent over a single pattern
+	struct PARSER
+	{
+		PatternAutomaton &automaton;
+		const std::wstring &pattern;
+		size_t position;
+		std::wstring error;
+
+		bool AtEnd() const { return position >= pattern.length(); }
+		wchar_t Peek() const { return pattern[position]; }
+
+		bool ParseAlternation(FRAGMENT &result)
+		{
+			if (!ParseConcatenation(result))
+			{
+				return false;
+			}
+
+			while (!AtEnd() && Peek() == L'|')
+			{
+				position++;
+				FRAGMENT right;
+				if (!ParseConcatenation(right))
+				{
+					return false;
+				}
+				result.start = automaton.AddState(NfaSplit, 0, -1, result.start, right.start);
+				result.outs.insert(result.outs.end(), right.outs.begin(), right.outs.end());
+			}
+			return true;
+		}
+
+		bool ParseConcatenation(FRAGMENT &result)
+		{
+			int empty = automaton.AddState(NfaSplit, 0);
+			result = { empty, { empty * 2 } };
+
+			while (!AtEnd() && Peek() != L'|' && Peek() != L')')
+			{
+				FRAGMENT next;
+				if (!ParseRepetition(next))
+				{
+					return false;
+				}
+				automaton.Patch(result.outs, next.start);
+				result.outs = std::move(next.outs);
+			}
+			return true;
+		}
+
+		bool ParseRepetition(FRAGMENT &result)
+		{
+			if (!ParseAtom(result))
+			{
+				return false;
+			}
+
+			while (!AtEnd() && (Peek() == L'*' || Peek() == L'+' || Peek() == L'?'))
+			{
+				wchar_t op = pattern[position++];
+				int split = automaton.AddState(NfaSplit, 0, -1, result.start);
+				if (op == L'*')
+				{
+					automaton.Patch(result.outs, split);
+					result = { split, { split * 2 + 1 } };
+				}
+				else if (op == L'+')
+				{
+					automaton.Patch(result.outs, split);
+					result.outs.assign(1, split * 2 + 1);
+				}
+				else
+				{
+					result.start = split;
+					result.outs.push_back(split * 2 + 1);
+				}
+			}
+			return true;
+		}
+
+		bool ParseAtom(FRAGMENT &result)
+		{
+			wchar_t c = pattern[position++];
+			switch (c)
+			{
+			case L'(':
+				if (pattern.compare(position, 2, L"?:") == 0)
+				{
+					position += 2;
+				}
+				if (!ParseAlternation(result))
+				{
+					return false;
+				}
+				if (AtEnd() || Peek() != L')')
+				{
+					error = L"missing ')'";
+					return false;
+				}
+				position++;
+				return true;
+
+			case L'[':
+				return ParseClass(result);
+
+			case L'.':
+				return Set(CHARSET{ {}, true }, result);
+
+			case L'^':
+				return Symbol(SYMBOL_BEGIN, result);
+
+			case L'$':
+				return Symbol(SYMBOL_END, result);
+
+			case L'*': case L'+': case L'?':
+				error = L"nothing to repeat before '";
+				error += c;
+				error += L"'";
+				return false;
+
+			case L'\\':
+				if (AtEnd())
+				{
+					error = L"trailing '\\'";
+					return false;
+				}
+				c = pattern[position++];
+				{
+					CHARSET set = { {}, false };
+					if (EscapeClass(c, set))
+					{
+						return Set(set, result);
+					}
+					std::uint32_t symbol = 0;
+					return Escape(c, symbol) && Symbol(automaton.Fold(symbol), result);
+				}
+
+			case L'{':
+				error = L"{n,m} repetition isn't supported, use \\{ for a literal '{'";
+				return false;
+
+			default:
+				return Symbol(automaton.Fold(c), result);
+			}
+		}
+
+		bool ParseClass(FRAGMENT &result)
+		{
+			CHARSET set = { {}, false };
+			if (!AtEnd() && Peek() == L'^')
+			{
+				set.negated = true;
+				position++;
+			}
+
+			bool first = true;
+			while (!AtEnd() && (Peek() != L']' || first))
+			{
+				first = false;
+				std::uint32_t low = pattern[position++];
+				if (low == L'\\' && !AtEnd())
+				{
+					wchar_t escaped = pattern[position++];
+					if (escaped == L'D' || escaped == L'W' || escaped == L'S')
+					{
+						error = L"\\D, \\W and \\S can't be used in []";
+						return false;
+					}
+					if (EscapeClass(escaped, set))
+					{
+						continue;
+					}
+					if (!Escape(escaped, low))
+					{
+						return false;
+					}
+				}
+
+				std::uint32_t high = low;
+				if (position + 1 < pattern.length() && Peek() == L'-' && pattern[position + 1] != L']')
+				{
+					position++;
+					high = pattern[position++];
+					if (high == L'\\' && !AtEnd() && !Escape(pattern[position++], high))
+					{
+						return false;
+					}
+					if (high < low)
+					{
+						error = L"invalid range in []";
+						return false;
+					}
+				}
+				set.ranges.push_back(std::make_pair(low, high));
+			}
+
+			if (AtEnd())
+			{
+				error = L"missing ']'";
+				return false;
+			}
+			position++;
+			return Set(set, result);
+		}
+
+		// \d, \w and \s, and their negated forms \D, \W and \S
+		static bool EscapeClass(wchar_t c, CHARSET &set)
+		{
+			switch (c)
+			{
+			case L'D': set.negated = true; // fall through
+			case L'd':
+				set.ranges.push_back(std::make_pair(L'0', L'9'));
+				return true;
+			case L'W': set.negated = true; // fall through
+			case L'w':
+				set.ranges.push_back(std::make_pair(L'0', L'9'));
+				set.ranges.push_back(std::make_pair(L'A', L'Z'));
+				set.ranges.push_back(std::make_pair(L'_', L'_'));
+				set.ranges.push_back(std::make_pair(L'a', L'z'));
+				return true;
+			case L'S': set.negated = true; // fall through
+			case L's':
+				set.ranges.push_back(std::make_pair(L'\t', L'\r'));
+				set.ranges.push_back(std::make_pair(L' ', L' '));
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		// The character a backslash followed by `c` stands for. Other escapes of a letter
+		// or a digit, like \b or \1, mean something std::wregex would do and this can't.
+		bool Escape(wchar_t c, std::uint32_t &symbol)
+		{
+			switch (c)
+			{
+			case L'n': symbol = L'\n'; return true;
+			case L'r': symbol = L'\r'; return true;
+			case L't': symbol = L'\t'; return true;
+			}
+			if (std::iswalnum(c))
+			{
+				error = L"unsupported escape '\\";
+				error += c;
+				error += L"'";
+				return false;
+			}
+			symbol = c;
+			return true;
+		}
+
+		bool Symbol(std::uint32_t symbol, FRAGMENT &result)
+		{
+			int state = automaton.AddState(NfaSymbol, symbol);
+			result = { state, { state * 2 } };
+			return true;
+		}
+
+		bool Set(const CHARSET &set, FRAGMENT &result)
+		{
+			int state = automaton.AddState(NfaSet, 0, automaton.AddSet(set));
+			result = { state, { state * 2 } };
+			return true;
+		}
+	};
+
+	std::uint32_t Fold(wchar_t c) const
+	{
+		return static_cast<std::uint32_t>(m_Fold ? std::towlower(c) : c);
+	}
+
+	int AddState(NFAKIND kind, std::uint32_t symbol, int set = -1, int out = -1, int out1 = -1)
+	{
+		m_States.push_back({ kind, symbol, set, out, out1 });
+		return static_cast<int>(m_States.size() - 1);
+	}
+
+	int AddSet(const CHARSET &set)
+	{
+		m_Sets.push_back(set);
+		return static_cast<int>(m_Sets.size() - 1);
+	}
+
+	void Patch(const std::vector<int> &outs, int target)
+	{
+		for (int out : outs)
+		{
+			(out & 1 ? m_States[out / 2].out1 : m_States[out / 2].out) = target;
+		}
+	}
+
+	bool SetContains(const CHARSET &set, std::uint32_t symbol) const
+	{
+		if (symbol >= SYMBOL_BEGIN)
+		{
+			return false; // Not a character
+		}
+
+		bool found = false;
+		for (const auto &range : set.ranges)
+		{
+			// With folding the text is lower case, but the class may be written in upper case
+			std::uint32_t upper = m_Fold ? static_cast<std::uint32_t>(std::towupper(static_cast<wchar_t>(symbol))) : symbol;
+			if ((symbol >= range.first && symbol <= range.second) || (upper >= range.first && upper <= range.second))
+			{
+				found = true;
+				break;
+			}
+		}
+		return found != set.negated;
+	}
+
+	// Every NFA state reachable from `states` without reading a character, minus the splits.
+	std::vector<int> Closure(const std::vector<int> &states) const
+	{
+		// States seen during this call are marked with a new generation, rather than
+		// clearing a flag per NFA state every time.
+		if (m_Marks.size() != m_States.size() || ++m_Generation == 0)
+		{
+			m_Marks.assign(m_States.size(), 0);
+			m_Generation = 1;
+		}
+
+		std::vector<int> pending(states), result;
+		while (!pending.empty())
+		{
+			int state = pending.back();
+			pending.pop_back();
+			if (state < 0 || m_Marks[state] == m_Generation)
+			{
+				continue;
+			}
+			m_Marks[state] = m_Generation;
+
+			const NFASTATE &s = m_States[state];
+			if (s.kind == NfaSplit)
+			{
+				pending.push_back(s.out);
+				pending.push_back(s.out1);
+			}
+			else
+			{
+				result.push_back(state);
+			}
+		}
+		std::sort(result.begin(), result.end());
+		return result;
+	}
+
+	int DfaState(std::vector<int> nfa) const
+	{
+		auto it = m_DfaIndex.find(nfa);
+		if (it != m_DfaIndex.end())
+		{
+			return it->second;
+		}
+
+		DFASTATE state;
+		state.accepting = false;
+		for (int s : nfa)
+		{
+			state.accepting = state.accepting || m_States[s].kind == NfaAccept;
+		}
+		std::fill(std::begin(state.ascii), std::end(state.ascii), -1);
+		state.nfa = nfa;
+
+		int index = static_cast<int>(m_Dfa.size());
+		m_Dfa.push_back(std::move(state));
+		m_DfaIndex[std::move(nfa)] = index;
+		return index;
+	}
+
+	int Step(int state, std::uint32_t symbol) const
+	{
+		if (symbol < 128)
+		{
+			if (m_Dfa[state].ascii[symbol] >= 0)
+			{
+				return m_Dfa[state].ascii[symbol];
+			}
+		}
+		else
+		{
+			auto it = m_Dfa[state].other.find(symbol);
+			if (it != m_Dfa[state].other.end())
+			{
+				return it->second;
+			}
+		}
+
+		std::vector<int> next;
+		for (int s : m_Dfa[state].nfa)
+		{
+			const NFASTATE &n = m_States[s];
+			if ((n.kind == NfaSymbol && n.symbol == symbol) || (n.kind == NfaSet && SetContains(m_Sets[n.set], symbol)))
+			{
+				next.push_back(n.out);
+			}
+		}
+
+		int target = DfaState(Closure(next)); // May reallocate m_Dfa
+		if (symbol < 128)
+		{
+			m_Dfa[state].ascii[symbol] = target;
+		}
+		else
+		{
+			m_Dfa[state].other[symbol] = target;
+		}
+		return target;
+	}
+
+	void FlushDfa() const
+	{
+		std::vector<int> start = m_Dfa[m_Start].nfa;
+		m_Dfa.clear();
+		m_DfaIndex.clear();
+		m_Start = DfaState(start);
+	}
+
+	bool m_Fold;
+	size_t m_Patterns;
+	std::vector<NFASTATE> m_States;
+	std::vector<CHARSET> m_Sets;
+
+	// Built lazily by Matches, which can be called from several threads
+	mutable std::mutex m_Lock;
+	mutable int m_Start;
+	mutable std::vector<DFASTATE> m_Dfa;
+	mutable std::map<std::vector<int>, int> m_DfaIndex;
+	mutable std::vector<unsigned int> m_Marks; // Used by Closure
+	mutable unsigned int m_Generation = 0;
+};
@@ -0,0 +1,166 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+#include "backend.hpp"
+#include "processsnapshot.hpp"
+
+struct PROCESSCACHESTATS
+{
+	unsigned long long hits;      // Names found in the cache
+	unsigned long long misses;    // Processes opened and queried one by one, because no snapshot listed them
+	unsigned long long evictions; // Entries dropped because their process exited or the cache was full
+	unsigned long long resolved;  // Names found in a snapshot, cached when their process could be opened
+	unsigned long long snapshots; // Snapshots of every process taken
+};
+
+// Maps process IDs to executable names, so we don't have to open every process
+// again each time one of its windows is looked at.
+//
+// Names come from a ProcessSnapshot first: however many windows a pass asks about,
+// that is one snapshot, and none at all while the last one is fresh. Only a process
+// too new for any snapshot is opened to be queried on its own.
+//
+// Either way the name is cached with its process kept open. While that reference is
+// open Windows can't give the PID to another process, so a cached PID always refers
+// to the process the name was found for, and once it exits the entry is dropped. A
+// name from a snapshot is only as sure as the snapshot is fresh, though: a PID reused
+// between the snapshot and the process being opened, at most SNAPSHOT_MAX_AGE, gets
+// the name of the process that had it before. Processes that can't be opened at all,
+// protected ones, aren't cached and are looked up in a snapshot every time.
+class ProcessNameCache
+{
+public:
+	explicit ProcessNameCache(Backend &backend, size_t capacity = 128) :
+		m_Backend(backend),
+		m_Capacity(capacity),
+		m_Now(0),
+		m_Retake(true),
+		m_Stats()
+	{ }
+
+	~ProcessNameCache()
+	{
+		Clear();
+	}
+
+	// Called at the start of every pass, `now` is the time in milliseconds. A pass takes
+	// at most one snapshot for processes the last one didn't list.
+	void BeginPass(std::uint64_t now)
+	{
+		m_Now = now;
+		m_Retake = true;
+	}
+
+	// Returns false when the process can't be queried (for example because it already exited).
+	bool GetExeName(unsigned long pid, std::wstring &name)
+	{
+		auto it = m_Index.find(pid);
+		if (it != m_Index.end())
+		{
+			if (!m_Backend.HasProcessExited(it->second->process))
+			{
+				m_Stats.hits++;
+				m_Lru.splice(m_Lru.begin(), m_Lru, it->second); // Mark as most recently used
+				name = it->second->name;
+				return true;
+			}
+			Evict(it);
+		}
+
+		unsigned long long snapshots = m_Snapshot.Snapshots();
+		bool found = m_Snapshot.Find(m_Backend, pid, m_Now, m_Retake, name);
+		m_Stats.snapshots += m_Snapshot.Snapshots() - snapshots;
+		if (found)
+		{
+			m_Stats.resolved++;
+			if (PROCESSREF process = m_Backend.OpenProcess(pid))
+			{
+				Insert(pid, process, name); // Only to pin the PID, the name is already known
+			}
+			return true;
+		}
+
+		m_Stats.misses++;
+		PROCESSREF process = m_Backend.OpenProcess(pid);
+		if (!process)
+		{
+			return false;
+		}
+
+		if (!m_Backend.GetProcessExeName(process, name))
+		{
+			m_Backend.CloseProcess(process);
+			return false;
+		}
+
+		Insert(pid, process, name);
+		return true;
+	}
+
+	// Drops the entries of every process that exited since it was cached.
+	void Sweep()
+	{
+		for (auto it = m_Index.begin(); it != m_Index.end(); )
+		{
+			if (m_Backend.HasProcessExited(it->second->process))
+			{
+				it = Evict(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+
+	void Clear()
+	{
+		for (ENTRY &entry : m_Lru)
+		{
+			m_Backend.CloseProcess(entry.process);
+		}
+		m_Lru.clear();
+		m_Index.clear();
+	}
+
+	const PROCESSCACHESTATS &Stats() const { return m_Stats; }
+
+private:
+	struct ENTRY
+	{
+		unsigned long pid;
+		PROCESSREF process;
+		std::wstring name;
+	};
+	typedef std::unordered_map<unsigned long, std::list<ENTRY>::iterator> INDEX;
+
+	void Insert(unsigned long pid, PROCESSREF process, const std::wstring &name)
+	{
+		if (m_Index.size() >= m_Capacity)
+		{
+			Evict(m_Index.find(m_Lru.back().pid));
+		}
+		m_Lru.push_front({ pid, process, name });
+		m_Index[pid] = m_Lru.begin();
+	}
+
+	INDEX::iterator Evict(INDEX::iterator it)
+	{
+		m_Stats.evictions++;
+		m_Backend.CloseProcess(it->second->process);
+		m_Lru.erase(it->second);
+		return m_Index.erase(it);
+	}
+
+	Backend &m_Backend;
+	size_t m_Capacity;
+	ProcessSnapshot m_Snapshot;
+	std::uint64_t m_Now;
+	bool m_Retake; // Whether this pass may still take a snapshot for a PID the last one didn't list
+	PROCESSCACHESTATS m_Stats;
+	std::list<ENTRY> m_Lru; // Most recently used first
+	INDEX m_Index;
+};
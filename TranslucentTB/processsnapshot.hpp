@@ -0,0 +1,86 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "backend.hpp"
+
+const std::uint64_t SNAPSHOT_MAX_AGE = 1000; // A snapshot answers for this long (ms), then the next lookup takes another
+
+// The name of every running process, from one Backend::SnapshotProcesses call: a
+// single sweep instead of opening and querying each process in turn, and it names
+// protected and elevated processes that can't be opened.
+//
+// A PID only means the same process as long as that process runs, and nothing is
+// held open here to stop Windows from giving it to another one. So a snapshot is
+// only trusted while it is fresh, and a PID it doesn't know gets one more snapshot
+// per pass, in case the process is newer than it.
+class ProcessSnapshot
+{
+public:
+	ProcessSnapshot() : m_Taken(0), m_Valid(false), m_Snapshots(0) { }
+
+	// Copies the name of `pid` into `name` if a snapshot taken at most SNAPSHOT_MAX_AGE
+	// before `now` lists it, taking a new one if needed. `retake` is whether a new one
+	// may still be taken for a PID the current one doesn't list, it is cleared when one is.
+	bool Find(Backend &backend, unsigned long pid, std::uint64_t now, bool &retake, std::wstring &name)
+	{
+		if (m_Snapshots == 0 || now - m_Taken > SNAPSHOT_MAX_AGE)
+		{
+			Take(backend, now);
+			retake = false;
+		}
+
+		const PROCESSNAME *process = Lookup(pid);
+		if (!process && retake && m_Valid)
+		{
+			Take(backend, now);
+			retake = false;
+			process = Lookup(pid);
+		}
+
+		if (!process)
+		{
+			return false;
+		}
+		name = process->exe;
+		return true;
+	}
+
+	unsigned long long Snapshots() const { return m_Snapshots; }
+
+private:
+	void Take(Backend &backend, std::uint64_t now)
+	{
+		m_Snapshots++;
+		m_Taken = now;
+		m_Valid = backend.SnapshotProcesses(m_Processes);
+		m_Order.clear();
+		if (!m_Valid)
+		{
+			return; // Nothing is found until SNAPSHOT_MAX_AGE went by and the system is asked again
+		}
+
+		// Sorted by PID rather than hashed, it is rebuilt every time and this doesn't allocate
+		for (std::size_t i = 0; i < m_Processes.size(); i++)
+		{
+			m_Order.push_back(std::make_pair(m_Processes[i].pid, i));
+		}
+		std::sort(m_Order.begin(), m_Order.end());
+	}
+
+	const PROCESSNAME *Lookup(unsigned long pid) const
+	{
+		auto it = std::lower_bound(m_Order.begin(), m_Order.end(), std::make_pair(pid, static_cast<std::size_t>(0)));
+		return it != m_Order.end() && it->first == pid ? &m_Processes[it->second] : nullptr;
+	}
+
+	std::vector<PROCESSNAME> m_Processes;                    // As the backend listed them
+	std::vector<std::pair<unsigned long, std::size_t>> m_Order; // PID and position in m_Processes, by PID
+	std::uint64_t m_Taken;
+	bool m_Valid;
+	unsigned long long m_Snapshots;
+};
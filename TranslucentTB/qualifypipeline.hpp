@@ -0,0 +1,190 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+// The checks a window goes through before it can change the taskbar of its monitor.
+enum QUALIFYSTAGE
+{
+	StageMaximised, // GetWindowPlacement
+	StageVisible,   // IsWindowVisible
+	StageDesktop,   // IsWindowOnCurrentVirtualDesktop, cached (desktopcache.hpp)
+	StagePlaced,    // Window and monitor rectangles, for DynamicWsGeometry
+	StageShell,     // Not part of the shell, cached per window
+	StageExcluded,  // Not excluded by the rules, cached per window (verdictcache.hpp)
+	STAGE_COUNT
+};
+
+inline const wchar_t *StageName(QUALIFYSTAGE stage)
+{
+	switch (stage)
+	{
+	case StageMaximised: return L"maximised";
+	case StageVisible: return L"visible";
+	case StageDesktop: return L"desktop";
+	case StagePlaced: return L"placed";
+	case StageShell: return L"shell";
+	default: return L"excluded";
+	}
+}
+
+// What a check costs, in nanoseconds on a typical Windows 10 machine: when it has to ask
+// Windows, and when a cache answers instead. IsWindowVisible only reads the desktop heap,
+// GetWindowPlacement and the rectangles are system calls, and the virtual desktop manager
+// is a COM call into Explorer.
+struct STAGECOST
+{
+	double uncached;
+	double cached;
+};
+
+const STAGECOST STAGE_COSTS[STAGE_COUNT] = {
+	{ 800, 800 },     // StageMaximised
+	{ 60, 60 },       // StageVisible
+	{ 25000, 150 },   // StageDesktop
+	{ 3000, 3000 },   // StagePlaced
+	{ 1500, 80 },     // StageShell
+	{ 6000, 250 }     // StageExcluded
+};
+
+struct STAGESTATS
+{
+	unsigned long long runs;       // Times the check ran
+	unsigned long long rejections; // Times it turned the window down, ending the pipeline
+	unsigned long long cached;     // Times a cache answered it
+	unsigned long long timed;      // Runs that were timed...
+	unsigned long long ns;         // ...and how long they took altogether
+};
+
+const unsigned int PIPELINE_REORDER_INTERVAL = 256; // Windows checked between two reorderings
+const unsigned int PIPELINE_TIME_SAMPLE = 16;       // Only one window in this many is timed, reading the clock isn't free
+
+// Runs a set of checks against a window, stopping at the first one that fails, in the
+// order that costs the least on average: a check goes early when it is cheap and
+// turns many windows down. Costs come from STAGE_COSTS, depending on whether a cache
+// answered, and how often each check rejects a window is counted as windows go
+// through, so the order follows the desktop: a user who never maximises anything gets
+// the maximised check first, one with ten virtual desktops the desktop check.
+//
+// The order only depends on what the checks answered, never on timing, so the same
+// desktop always gives the same order. Measured times are only there to be looked at.
+class QualifyPipeline
+{
+public:
+	explicit QualifyPipeline(std::initializer_list<QUALIFYSTAGE> stages) :
+		m_Order(stages),
+		m_Evaluations(0),
+		m_Reorders(0),
+		m_LastRejection(STAGE_COUNT),
+		m_Stats(),
+		m_Recent()
+	{
+		Reorder(); // From the cost model alone, until there is something to go on
+	}
+
+	// `check(stage, cached)` runs one check, setting `cached` when it didn't need to ask
+	// Windows. Returns whether every check passed.
+	template<typename CHECK>
+	bool Evaluate(CHECK check)
+	{
+		bool timed = m_Evaluations % PIPELINE_TIME_SAMPLE == 0;
+		bool passed = true;
+		m_LastRejection = STAGE_COUNT;
+		for (QUALIFYSTAGE stage : m_Order)
+		{
+			std::chrono::steady_clock::time_point start;
+			if (timed)
+			{
+				start = std::chrono::steady_clock::now();
+			}
+
+			bool cached = false;
+			passed = check(stage, cached);
+
+			STAGESTATS &stats = m_Stats[stage];
+			stats.runs++;
+			stats.cached += cached;
+			stats.rejections += !passed;
+			if (timed)
+			{
+				stats.timed++;
+				stats.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			}
+
+			RECENT &recent = m_Recent[stage];
+			recent.runs++;
+			recent.rejections += !passed;
+			recent.cost += cached ? STAGE_COSTS[stage].cached : STAGE_COSTS[stage].uncached;
+			if (!passed)
+			{
+				m_LastRejection = stage;
+				break;
+			}
+		}
+
+		if (++m_Evaluations % PIPELINE_REORDER_INTERVAL == 0)
+		{
+			Reorder();
+		}
+		return passed;
+	}
+
+	const std::vector<QUALIFYSTAGE> &Order() const { return m_Order; }
+	const STAGESTATS &Stats(QUALIFYSTAGE stage) const { return m_Stats[stage]; }
+	unsigned long long Evaluations() const { return m_Evaluations; }
+	unsigned long long Reorders() const { return m_Reorders; }
+
+	// The check that turned the last window down, STAGE_COUNT if it passed them all.
+	QUALIFYSTAGE LastRejection() const { return m_LastRejection; }
+
+private:
+	// Counts since the last few reorderings, halved every time so old behaviour fades.
+	struct RECENT
+	{
+		double runs;
+		double rejections;
+		double cost;
+	};
+
+	// Expected cost of running a check for every window it rejects. A check that never
+	// rejects anything goes last, in the order of the cost model.
+	double Rank(QUALIFYSTAGE stage) const
+	{
+		const RECENT &recent = m_Recent[stage];
+		double cost = recent.runs > 0 ? recent.cost / recent.runs : STAGE_COSTS[stage].uncached;
+		double rejected = recent.runs > 0 ? recent.rejections / recent.runs : 0.5; // Prior: no idea
+		return rejected > 0 ? cost / rejected : 1e12 + cost;
+	}
+
+	void Reorder()
+	{
+		m_Reorders++;
+		// Insertion sort: stable, and unlike std::stable_sort it doesn't allocate a buffer
+		for (std::size_t i = 1; i < m_Order.size(); i++)
+		{
+			QUALIFYSTAGE stage = m_Order[i];
+			double rank = Rank(stage);
+			std::size_t j = i;
+			for (; j > 0 && Rank(m_Order[j - 1]) > rank; j--)
+			{
+				m_Order[j] = m_Order[j - 1];
+			}
+			m_Order[j] = stage;
+		}
+		for (RECENT &recent : m_Recent)
+		{
+			recent.runs /= 2;
+			recent.rejections /= 2;
+			recent.cost /= 2;
+		}
+	}
+
+	std::vector<QUALIFYSTAGE> m_Order;
+	unsigned long long m_Evaluations;
+	unsigned long long m_Reorders;
+	QUALIFYSTAGE m_LastRejection;
+	STAGESTATS m_Stats[STAGE_COUNT];
+	RECENT m_Recent[STAGE_COUNT];
+};
@@ -0,0 +1,444 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cwchar>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "backend.hpp"
+#include "eventloop.hpp"
+
+struct BACKENDCALLS
+{
+	unsigned long long enumerations;   // EnumerateWindows
+	unsigned long long windowqueries;  // IsWindow, IsWindowMaximised, IsWindowVisible, GetWindowMonitor, GetWindowProcessId, GetWindowRect, GetMonitorRects
+	unsigned long long stringqueries;  // GetWindowClass, GetWindowTitle
+	unsigned long long processqueries; // OpenProcess, HasProcessExited, GetProcessExeName
+	unsigned long long snapshots;      // SnapshotProcesses
+	unsigned long long desktopqueries; // IsWindowOnCurrentDesktop
+	unsigned long long compositions;   // SetAccentPolicy
+};
+
+// Every simulated monitor is this big, side by side, with a taskbar at the bottom.
+const int SIMULATED_MONITOR_WIDTH = 1920;
+const int SIMULATED_MONITOR_HEIGHT = 1080;
+const int SIMULATED_TASKBAR_HEIGHT = 40;
+
+// An in-memory desktop. Scripts change it through the methods below, which queue
+// the same events Win32EventSource would see; TakeEvents hands them over.
+// Nothing in here depends on timing, so the same script always gives the same result.
+class SimulatedBackend : public Backend
+{
+public:
+	SimulatedBackend() : m_NextId(1), m_Desktop(0), m_Foreground(0), m_Snapshots(true), m_Calls() { }
+
+	#pragma region Scripting
+
+	// Adds a monitor along with its taskbar. The first one is the primary monitor.
+	MONITORID AddMonitor()
+	{
+		MONITORID monitor = NewId();
+		WINDOWID taskbar = NewId();
+		m_Monitors.push_back(monitor);
+		m_Taskbars.push_back(taskbar);
+		m_TaskbarMonitors[taskbar] = monitor;
+		Queue(MonitorsChanged);
+		return monitor;
+	}
+
+	// Unplugs a monitor, its taskbar goes with it. Its windows end up on the primary
+	// monitor, and the monitors after it shift left.
+	void RemoveMonitor(MONITORID monitor)
+	{
+		auto it = std::find(m_Monitors.begin(), m_Monitors.end(), monitor);
+		WINDOWID taskbar = m_Taskbars[it - m_Monitors.begin()];
+		m_Taskbars.erase(m_Taskbars.begin() + (it - m_Monitors.begin()));
+		m_Monitors.erase(it);
+		m_TaskbarMonitors.erase(taskbar);
+		m_Applied.erase(taskbar);
+		Queue(WindowDestroyed, taskbar);
+		Queue(MonitorsChanged);
+	}
+
+	// Explorer putting its own accent back on a taskbar, without telling anyone.
+	void ResetAccent(WINDOWID taskbar)
+	{
+		m_Applied.erase(taskbar);
+	}
+
+	// A `guarded` process can't be opened, like a protected process or an elevated one
+	// seen from a process that isn't. Snapshots still list it.
+	void AddProcess(unsigned long pid, const std::wstring &exe, bool guarded = false)
+	{
+		m_Processes[pid] = { exe, false, guarded };
+	}
+
+	// Without snapshots, processes can only be opened one by one.
+	void SetSnapshots(bool enabled) { m_Snapshots = enabled; }
+
+	void ExitProcess(unsigned long pid)
+	{
+		m_Processes[pid].exited = true;
+	}
+
+	WINDOWID AddWindow(const std::wstring &className, const std::wstring &title, unsigned long pid, MONITORID monitor)
+	{
+		WINDOWID window = NewId();
+		WINDOW &data = m_Windows[window];
+		data.className = className;
+		data.title = title;
+		data.pid = pid;
+		data.monitor = monitor;
+		data.maximised = false;
+		data.visible = true;
+		data.desktop = m_Desktop;
+		data.rect = { 100, 100, 900, 700 };
+		m_ZOrder.insert(m_ZOrder.begin(), window);
+		Queue(WindowChanged, window);
+		return window;
+	}
+
+	void Maximise(WINDOWID window) { Change(window).maximised = true; }
+	void Restore(WINDOWID window) { Change(window).maximised = false; }
+	void Show(WINDOWID window) { Change(window).visible = true; }
+	void Hide(WINDOWID window) { Change(window).visible = false; }
+	void Move(WINDOWID window, MONITORID monitor) { Change(window).monitor = monitor; }
+	// `rect` is relative to the top left corner of the window's monitor. Maximised windows fill the work area instead.
+	void SetRect(WINDOWID window, const WINDOWRECT &rect) { Change(window).rect = rect; }
+	void SetTitle(WINDOWID window, const std::wstring &title)
+	{
+		m_Windows.at(window).title = title;
+		Queue(WindowRenamed, window);
+	}
+
+	// Moves a window to another virtual desktop. It gets cloaked or uncloaked if that
+	// makes it leave or join the current one.
+	void MoveToDesktop(WINDOWID window, unsigned int desktop)
+	{
+		WINDOW &data = m_Windows.at(window);
+		if ((data.desktop == m_Desktop) != (desktop == m_Desktop))
+		{
+			Queue(WindowCloaked, window);
+		}
+		data.desktop = desktop;
+	}
+
+	void Destroy(WINDOWID window)
+	{
+		m_Windows.erase(window);
+		m_ZOrder.erase(std::remove(m_ZOrder.begin(), m_ZOrder.end(), window), m_ZOrder.end());
+		if (m_Foreground == window)
+		{
+			m_Foreground = 0;
+		}
+		Queue(WindowDestroyed, window);
+	}
+
+	void SetForeground(WINDOWID window)
+	{
+		m_Foreground = window;
+		Queue(ForegroundChanged, window);
+	}
+
+	// Every window that appears or disappears gets cloaked or uncloaked, just like on Windows.
+	void SwitchDesktop(unsigned int desktop)
+	{
+		unsigned int previous = m_Desktop;
+		m_Desktop = desktop;
+		for (WINDOWID window : m_ZOrder)
+		{
+			unsigned int on = m_Windows[window].desktop;
+			if (on == previous || on == desktop)
+			{
+				Queue(WindowCloaked, window);
+			}
+		}
+		Queue(DesktopSwitched);
+	}
+
+	// Hands the events queued since the last call over to the caller.
+	void TakeEvents(std::vector<EVENT> &events)
+	{
+		events.clear();
+		events.swap(m_Events);
+	}
+
+	#pragma endregion
+
+	#pragma region Inspection
+
+	const std::vector<MONITORID> &Monitors() const { return m_Monitors; }
+	WINDOWID TaskbarOf(MONITORID monitor) const
+	{
+		auto it = std::find(m_Monitors.begin(), m_Monitors.end(), monitor);
+		return it != m_Monitors.end() ? m_Taskbars[it - m_Monitors.begin()] : 0;
+	}
+
+	// Returns false if nothing was applied to that taskbar yet.
+	bool AppliedPolicy(WINDOWID taskbar, ACCENTPOLICY &policy) const
+	{
+		auto it = m_Applied.find(taskbar);
+		if (it == m_Applied.end())
+		{
+			return false;
+		}
+		policy = it->second;
+		return true;
+	}
+
+	std::size_t WindowCount() const { return m_Windows.size(); }
+	const BACKENDCALLS &Calls() const { return m_Calls; }
+	void ResetCalls() { m_Calls = BACKENDCALLS(); }
+
+	#pragma endregion
+
+	#pragma region Backend
+
+	void EnumerateWindows(std::vector<WINDOWID> &windows) override
+	{
+		m_Calls.enumerations++;
+		windows = m_ZOrder;
+	}
+
+	bool IsWindow(WINDOWID window) override
+	{
+		m_Calls.windowqueries++;
+		return m_Windows.count(window) != 0;
+	}
+
+	bool IsWindowMaximised(WINDOWID window) override
+	{
+		m_Calls.windowqueries++;
+		const WINDOW *data = Find(window);
+		return data && data->maximised;
+	}
+
+	bool IsWindowVisible(WINDOWID window) override
+	{
+		m_Calls.windowqueries++;
+		const WINDOW *data = Find(window);
+		return data && data->visible;
+	}
+
+	std::size_t GetWindowClass(WINDOWID window, wchar_t *buffer, std::size_t size) override
+	{
+		m_Calls.stringqueries++;
+		const WINDOW *data = Find(window);
+		return data ? Copy(data->className, buffer, size) : Copy(std::wstring(), buffer, size); // Not copying the string on the way
+	}
+
+	std::size_t GetWindowTitle(WINDOWID window, wchar_t *buffer, std::size_t size) override
+	{
+		m_Calls.stringqueries++;
+		const WINDOW *data = Find(window);
+		return data ? Copy(data->title, buffer, size) : Copy(std::wstring(), buffer, size); // Not copying the string on the way
+	}
+
+	unsigned long GetWindowProcessId(WINDOWID window) override
+	{
+		m_Calls.windowqueries++;
+		const WINDOW *data = Find(window);
+		return data ? data->pid : 0;
+	}
+
+	WINDOWID GetForegroundWindow() override
+	{
+		m_Calls.windowqueries++;
+		return m_Foreground;
+	}
+
+	MONITORID GetWindowMonitor(WINDOWID window) override
+	{
+		m_Calls.windowqueries++;
+		auto taskbar = m_TaskbarMonitors.find(window);
+		if (taskbar != m_TaskbarMonitors.end())
+		{
+			return taskbar->second;
+		}
+
+		const WINDOW *data = Find(window);
+		if (data && std::find(m_Monitors.begin(), m_Monitors.end(), data->monitor) != m_Monitors.end())
+		{
+			return data->monitor;
+		}
+		return m_Monitors.empty() ? 0 : m_Monitors.front();
+	}
+
+	void FindTaskbars(std::vector<WINDOWID> &taskbars) override
+	{
+		taskbars = m_Taskbars;
+	}
+
+	bool GetWindowRect(WINDOWID window, WINDOWRECT &rect) override
+	{
+		m_Calls.windowqueries++;
+		const WINDOW *data = Find(window);
+		WINDOWRECT bounds, work;
+		if (!data || !MonitorRects(data->monitor, bounds, work))
+		{
+			return false;
+		}
+
+		rect = data->maximised ? work : WINDOWRECT{ bounds.left + data->rect.left, bounds.top + data->rect.top, bounds.left + data->rect.right, bounds.top + data->rect.bottom };
+		return true;
+	}
+
+	bool GetMonitorRects(MONITORID monitor, WINDOWRECT &bounds, WINDOWRECT &work) override
+	{
+		m_Calls.windowqueries++;
+		return MonitorRects(monitor, bounds, work);
+	}
+
+	PROCESSREF OpenProcess(unsigned long pid) override
+	{
+		m_Calls.processqueries++;
+		auto it = m_Processes.find(pid);
+		return it != m_Processes.end() && !it->second.exited && !it->second.guarded ? pid : 0;
+	}
+
+	bool HasProcessExited(PROCESSREF process) override
+	{
+		m_Calls.processqueries++;
+		auto it = m_Processes.find(static_cast<unsigned long>(process));
+		return it == m_Processes.end() || it->second.exited;
+	}
+
+	bool GetProcessExeName(PROCESSREF process, std::wstring &name) override
+	{
+		m_Calls.processqueries++;
+		auto it = m_Processes.find(static_cast<unsigned long>(process));
+		if (it == m_Processes.end())
+		{
+			return false;
+		}
+		name = it->second.exe;
+		return true;
+	}
+
+	void CloseProcess(PROCESSREF) override { }
+
+	bool SnapshotProcesses(std::vector<PROCESSNAME> &processes) override
+	{
+		m_Calls.snapshots++;
+		processes.clear();
+		if (!m_Snapshots)
+		{
+			return false;
+		}
+		for (const auto &process : m_Processes)
+		{
+			if (!process.second.exited)
+			{
+				processes.push_back(PROCESSNAME());
+				processes.back().pid = process.first;
+				Copy(process.second.exe, processes.back().exe, MAX_EXE_NAME);
+			}
+		}
+		return true;
+	}
+
+	bool IsWindowOnCurrentDesktop(WINDOWID window) override
+	{
+		m_Calls.desktopqueries++;
+		const WINDOW *data = Find(window);
+		return !data || data->desktop == m_Desktop;
+	}
+
+	bool SetAccentPolicy(WINDOWID taskbar, const ACCENTPOLICY &policy) override
+	{
+		m_Calls.compositions++;
+		if (!m_TaskbarMonitors.count(taskbar))
+		{
+			return false;
+		}
+		m_Applied[taskbar] = policy;
+		return true;
+	}
+
+	#pragma endregion
+
+private:
+	struct WINDOW
+	{
+		std::wstring className;
+		std::wstring title;
+		unsigned long pid;
+		MONITORID monitor;
+		bool maximised;
+		bool visible;
+		unsigned int desktop;
+		WINDOWRECT rect; // Relative to the monitor, when not maximised
+	};
+
+	struct PROCESS
+	{
+		std::wstring exe;
+		bool exited;
+		bool guarded; // Can't be opened
+	};
+
+	std::uintptr_t NewId()
+	{
+		return m_NextId++;
+	}
+
+	void Queue(EVENTTYPE type, WINDOWID window = 0)
+	{
+		m_Events.push_back({ type, window });
+	}
+
+	bool MonitorRects(MONITORID monitor, WINDOWRECT &bounds, WINDOWRECT &work) const
+	{
+		auto it = std::find(m_Monitors.begin(), m_Monitors.end(), monitor);
+		if (it == m_Monitors.end())
+		{
+			return false;
+		}
+
+		int left = static_cast<int>(it - m_Monitors.begin()) * SIMULATED_MONITOR_WIDTH;
+		bounds = { left, 0, left + SIMULATED_MONITOR_WIDTH, SIMULATED_MONITOR_HEIGHT };
+		work = bounds;
+		work.bottom -= SIMULATED_TASKBAR_HEIGHT;
+		return true;
+	}
+
+	const WINDOW *Find(WINDOWID window) const
+	{
+		auto it = m_Windows.find(window);
+		return it != m_Windows.end() ? &it->second : nullptr;
+	}
+
+	WINDOW &Change(WINDOWID window)
+	{
+		WINDOW &data = m_Windows.at(window);
+		Queue(WindowChanged, window);
+		return data;
+	}
+
+	static std::size_t Copy(const std::wstring &value, wchar_t *buffer, std::size_t size)
+	{
+		if (size == 0)
+		{
+			return 0;
+		}
+		std::size_t length = std::min(value.length(), size - 1);
+		std::wmemcpy(buffer, value.c_str(), length);
+		buffer[length] = L'\0';
+		return length;
+	}
+
+	std::uintptr_t m_NextId;
+	unsigned int m_Desktop;
+	WINDOWID m_Foreground;
+	bool m_Snapshots;
+	BACKENDCALLS m_Calls;
+	std::vector<MONITORID> m_Monitors;
+	std::vector<WINDOWID> m_Taskbars; // Same order as m_Monitors, so the main taskbar is first
+	std::map<WINDOWID, MONITORID> m_TaskbarMonitors;
+	std::map<WINDOWID, WINDOW> m_Windows;
+	std::vector<WINDOWID> m_ZOrder; // Topmost first
+	std::map<unsigned long, PROCESS> m_Processes;
+	std::map<WINDOWID, ACCENTPOLICY> m_Applied;
+	std::vector<EVENT> m_Events;
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "eventloop.hpp"
+
+// A headless event source running on a virtual clock. Events are scripted ahead
+// of time, and waiting never actually sleeps: the clock simply jumps to the next
+// event or to the end of the timeout. Once the clock reaches the end of the
+// script, QuitRequested is returned.
+class SimulatedEventSource : public EventSource
+{
+public:
+	explicit SimulatedEventSource(std::uint64_t duration) : m_Now(0), m_End(duration), m_Next(0) { }
+
+	void Schedule(std::uint64_t time, EVENTTYPE type, WINDOWID window = 0)
+	{
+		TIMEDEVENT timed = { time, { type, window } };
+
+		// Keep the script sorted, but stable for events scheduled at the same time.
+		auto it = std::upper_bound(m_Script.begin(), m_Script.end(), timed, [](const TIMEDEVENT &a, const TIMEDEVENT &b)
+		{
+			return a.time < b.time;
+		});
+		m_Script.insert(it, timed);
+	}
+
+	std::uint64_t Now() override { return m_Now; }
+
+	bool WaitForEvent(std::uint32_t timeout, EVENT &ev) override
+	{
+		std::uint64_t deadline = m_Now + timeout;
+
+		if (m_Next < m_Script.size() && m_Script[m_Next].time <= deadline && m_Script[m_Next].time < m_End)
+		{
+			m_Now = std::max(m_Now, m_Script[m_Next].time);
+			ev = m_Script[m_Next++].ev;
+			return true;
+		}
+
+		if (deadline >= m_End)
+		{
+			m_Now = m_End;
+			ev = { QuitRequested, 0 };
+			return true;
+		}
+
+		m_Now = deadline;
+		return false;
+	}
+
+private:
+	struct TIMEDEVENT
+	{
+		std::uint64_t time;
+		EVENT ev;
+	};
+
+	std::uint64_t m_Now;
+	std::uint64_t m_End;
+	std::size_t m_Next;
+	std::vector<TIMEDEVENT> m_Script;
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cwchar>
+#include <functional>
+#include <unordered_map>
+
+#include "arena.hpp"
+#include "backend.hpp"
+#include "eventloop.hpp"
+
+const std::size_t MAX_START_CACHE = 256; // Windows remembered as being or not being the Start menu
+
+struct STARTMENUSTATS
+{
+	unsigned long long foregroundchanges; // ForegroundChanged events seen
+	unsigned long long lookups;           // Times the foreground window had to be looked at again
+	unsigned long long identifications;   // Class and title fetched to tell whether a window is the Start menu
+	unsigned long long resyncs;           // GetForegroundWindow calls, in case an event was missed
+};
+
+// Knows whether the Start menu (or Search, or Cortana) is open, and on which monitor,
+// from ForegroundChanged events alone. Whether a window is one of those is worked out
+// once from its class and title, then remembered until it is renamed or destroyed, so
+// opening the Start menu for the hundredth time costs no backend call at all.
+class StartMenuTracker
+{
+public:
+	explicit StartMenuTracker(Backend &backend) :
+		m_Backend(backend),
+		m_Foreground(0),
+		m_Dirty(true), // Nothing is known until the first resync
+		m_Open(false),
+		m_Monitor(0),
+		m_Surfaces(0, std::hash<WINDOWID>(), std::equal_to<WINDOWID>(), SURFACEMAP::allocator_type(m_Pool)),
+		m_Stats()
+	{ }
+
+	void OnEvent(const EVENT &ev)
+	{
+		switch (ev.type)
+		{
+		case ForegroundChanged:
+			m_Stats.foregroundchanges++;
+			m_Foreground = ev.window;
+			m_Dirty = true;
+			break;
+		case WindowRenamed:
+			m_Surfaces.erase(ev.window); // Search becomes Cortana and the other way around
+			m_Dirty = m_Dirty || ev.window == m_Foreground;
+			break;
+		case WindowChanged:
+			m_Dirty = m_Dirty || (m_Open && ev.window == m_Foreground); // Might have moved to another monitor
+			break;
+		case WindowDestroyed:
+			m_Surfaces.erase(ev.window);
+			m_Dirty = m_Dirty || ev.window == m_Foreground;
+			break;
+		default:
+			break;
+		}
+	}
+
+	// Returns whether the Start menu is open, and if so on which monitor. `resync` asks
+	// the backend for the foreground window again rather than trusting the events.
+	bool Update(bool resync, MONITORID &monitor)
+	{
+		if (resync)
+		{
+			m_Stats.resyncs++;
+			WINDOWID foreground = m_Backend.GetForegroundWindow();
+			m_Dirty = m_Dirty || foreground != m_Foreground;
+			m_Foreground = foreground;
+			if (m_Surfaces.size() > MAX_START_CACHE)
+			{
+				m_Surfaces.clear(); // Some destroyed windows were missed
+			}
+		}
+
+		if (m_Dirty)
+		{
+			m_Stats.lookups++;
+			m_Open = m_Foreground && IsStartSurface(m_Foreground);
+			m_Monitor = m_Open ? m_Backend.GetWindowMonitor(m_Foreground) : 0;
+			m_Dirty = false;
+		}
+
+		monitor = m_Monitor;
+		return m_Open;
+	}
+
+	const STARTMENUSTATS &Stats() const { return m_Stats; }
+
+private:
+	bool IsStartSurface(WINDOWID window)
+	{
+		auto it = m_Surfaces.find(window);
+		if (it != m_Surfaces.end())
+		{
+			return it->second;
+		}
+
+		m_Stats.identifications++;
+		wchar_t className[MAX_START_STRING];
+		wchar_t title[MAX_START_STRING];
+		m_Backend.GetWindowClass(window, className, MAX_START_STRING);
+		m_Backend.GetWindowTitle(window, title, MAX_START_STRING);
+		bool surface = !std::wcscmp(className, L"Windows.UI.Core.CoreWindow") &&
+			(!std::wcscmp(title, L"Search") || !std::wcscmp(title, L"Cortana"));
+		m_Surfaces.emplace(window, surface);
+		return surface;
+	}
+
+	static const std::size_t MAX_START_STRING = 32; // Longer than any of the names compared against
+
+	// Every window that gets focus ends up in here, and it is emptied once it gets too big
+	typedef std::unordered_map<WINDOWID, bool, std::hash<WINDOWID>, std::equal_to<WINDOWID>, PoolAllocator<std::pair<const WINDOWID, bool>>> SURFACEMAP;
+
+	Backend &m_Backend;
+	WINDOWID m_Foreground;
+	bool m_Dirty;
+	bool m_Open;
+	MONITORID m_Monitor;
+	NodePool m_Pool; // Before the map, which gives its nodes back when destroyed
+	SURFACEMAP m_Surfaces;
+	STARTMENUSTATS m_Stats;
+};
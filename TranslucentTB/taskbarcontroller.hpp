@@ -0,0 +1,283 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "backend.hpp"
+#include "decisiontrace.hpp"
+#include "eventloop.hpp"
+#include "metrics.hpp"
+#include "taskbartable.hpp"
+#include "transitionfilter.hpp"
+#include "windowclassifier.hpp"
+
+const int ACCENT_DISABLED = 4; // Disables TTB for that taskbar
+const int ACCENT_ENABLE_GRADIENT = 1; // Makes the taskbar a solid color specified by nColor. This mode doesn't care about the alpha channel.
+const int ACCENT_ENABLE_TRANSPARENTGRADIENT = 2; // Makes the taskbar a tinted transparent overlay. nColor is the tint color, sending nothing results in it interpreted as 0x00000000 (totally transparent, blends in with desktop)
+const int ACCENT_ENABLE_BLURBEHIND = 3; // Makes the taskbar a tinted blurry overlay. nColor is same as above.
+const int ACCENT_ENABLE_TINTED = 5; // This is not a real state. We will handle it later.
+const int ACCENT_NORMAL_GRADIENT = 6; // Another fake value, handles the
+
+struct OPTIONS
+{
+	int taskbar_appearance;
+	int color;
+	bool dynamicws;
+	bool dynamicstart;
+	int dynamicws_state; // State to activate when d-ws is enabled
+	TRANSITIONOPTIONS transitions;
+	DYNAMICWSMODE dynamicws_mode; // What counts as a window covering the taskbar
+};
+
+struct COMPOSITIONSTATS
+{
+	unsigned long long issued;  // SetAccentPolicy calls made
+	unsigned long long skipped; // Calls avoided because the taskbar already had the same policy
+};
+
+struct PARKSTATS
+{
+	unsigned long long parks;     // Times a taskbar got covered by a fullscreen window and was left alone
+	unsigned long long parked_ms; // Time taskbars spent covered, added up over all of them
+	unsigned long long skipped;   // Applies that didn't look at a taskbar because it was covered
+};
+
+struct APPLYSTATS
+{
+	unsigned long long applies;
+	unsigned long long total_ns; // Time spent applying states, divide by applies for the average
+	unsigned long long max_ns;   // Longest the thread owning the taskbars was kept busy by one
+};
+
+// Makes every taskbar look the way a DESKTOPSTATE says. It never talks to the OS
+// directly, so it runs the same against the real desktop or a simulated one.
+// Its cost only depends on the number of taskbars: finding out which windows are
+// maximised is left to a WindowClassifier, possibly on another thread.
+class TaskbarController
+{
+public:
+	// `options` is owned by the caller and may be changed between passes.
+	TaskbarController(Backend &backend, const OPTIONS &options) :
+		m_Backend(backend),
+		m_Options(options),
+		m_Transitions(options.transitions),
+		m_Metrics(nullptr),
+		m_Decisions(nullptr),
+		m_CompositionStats(),
+		m_ParkStats(),
+		m_ApplyStats()
+	{ }
+
+	// Looks for the taskbars again. Only the ones that appeared, went away or changed
+	// monitor are touched, the others carry on with their transitions.
+	void RefreshHandles()
+	{
+		m_Handles.clear();
+		m_Backend.FindTaskbars(m_Handles);
+		m_HandleMonitors.clear();
+		for (WINDOWID handle : m_Handles)
+		{
+			m_HandleMonitors.push_back(m_Backend.GetWindowMonitor(handle));
+		}
+		m_Taskbars.Update(m_Handles, m_HandleMonitors);
+		m_Taskbars.ForgetApplied(); // Explorer lays its taskbars out again, and might reset them
+	}
+
+	// The part of a pass that doesn't need to know about windows. `reason` is a
+	// combination of PASSREASON flags.
+	void Prepare(unsigned int reason)
+	{
+		if (reason & PassMonitors)
+		{
+			RefreshHandles(); // Taskbars come and go with monitors
+		}
+		else if (reason & (PassForeground | PassRefresh))
+		{
+			// Explorer puts its own accent back when the Start menu, Action Center or a
+			// taskbar flyout takes the foreground, so the cached policies can't be trusted.
+			// Nor after a refresh, which is there for the times it does so on its own, on a
+			// theme change or when DWM recomposes: a call per taskbar every few seconds.
+			m_Taskbars.ForgetApplied();
+		}
+	}
+
+	// `now` is the time in milliseconds. Returns when a transition the filter held back is
+	// due, or 0 if there is none: the same state should be applied again then, even if
+	// nothing else happened. Taskbars a fullscreen window hides are parked: neither
+	// their transitions nor their policies are touched until they come back.
+	std::uint64_t Apply(const DESKTOPSTATE &state, std::uint64_t now)
+	{
+		auto start = std::chrono::steady_clock::now();
+		unsigned long long issued = m_CompositionStats.issued;
+		if (m_Decisions)
+		{
+			m_Decisions->Emit(DecisionTickBegin);
+		}
+		std::uint64_t due = 0;
+		m_Taskbars.SetTargets(state);
+		for (std::size_t row = 0; row < m_Taskbars.Size(); row++)
+		{
+			bool covered = m_Taskbars.Covered(row);
+			if (covered != m_Taskbars.Parked(row))
+			{
+				if (covered)
+				{
+					m_ParkStats.parks++;
+				}
+				else
+				{
+					m_ParkStats.parked_ms += now - m_Taskbars.ParkedSince(row);
+				}
+				m_Taskbars.SetParked(row, covered, now);
+			}
+			if (covered)
+			{
+				m_ParkStats.skipped++;
+				continue;
+			}
+
+			TASKBARSTATE previous = m_Taskbars.State(row);
+			m_Taskbars.State(row) = m_Transitions.Filter(m_Taskbars.Transition(row), m_Taskbars.Target(row), now, due);
+			if (m_Decisions && m_Taskbars.State(row) != previous)
+			{
+				m_Decisions->Emit(DecisionTransition, m_Taskbars.Handle(row), m_Taskbars.State(row), TransitionDetail(previous, m_Taskbars.Target(row)));
+			}
+			SetTaskbarBlur(row);
+		}
+
+		unsigned long long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		m_ApplyStats.applies++;
+		m_ApplyStats.total_ns += elapsed;
+		if (elapsed > m_ApplyStats.max_ns)
+		{
+			m_ApplyStats.max_ns = elapsed;
+		}
+		if (m_Metrics)
+		{
+			m_Metrics->Add(MetricTicks);
+			m_Metrics->Record(MetricTickTime, elapsed / 1000);
+		}
+		if (m_Decisions)
+		{
+			m_Decisions->Emit(DecisionTickEnd, 0, static_cast<std::uint32_t>(m_CompositionStats.issued - issued));
+		}
+		return due;
+	}
+
+	// A whole pass, when windows are classified on the same thread.
+	std::uint64_t Pass(unsigned int reason, const DESKTOPSTATE &state, std::uint64_t now)
+	{
+		Prepare(reason);
+		return Apply(state, now);
+	}
+
+	// Every taskbar, parked or not.
+	void SetTaskbarBlur()
+	{
+		for (std::size_t row = 0; row < m_Taskbars.Size(); row++)
+		{
+			SetTaskbarBlur(row);
+		}
+	}
+
+	// Whether every taskbar is hidden behind a fullscreen window, as of the last apply.
+	bool AllParked() const
+	{
+		for (std::size_t row = 0; row < m_Taskbars.Size(); row++)
+		{
+			if (!m_Taskbars.Parked(row))
+			{
+				return false;
+			}
+		}
+		return m_Taskbars.Size() != 0;
+	}
+
+	const TaskbarTable &Taskbars() const { return m_Taskbars; }
+	const COMPOSITIONSTATS &CompositionStats() const { return m_CompositionStats; }
+	const PARKSTATS &ParkStats() const { return m_ParkStats; }
+	const APPLYSTATS &ApplyStats() const { return m_ApplyStats; }
+	const TRANSITIONSTATS &TransitionStats() const { return m_Transitions.Stats(); }
+
+	// Counts applies, how long they take and the policies they issue or skip.
+	void SetMetrics(MetricsRegistry *metrics) { m_Metrics = metrics; }
+
+	// Writes down every apply, every state change and every policy set or skipped.
+	void SetDecisionTrace(DecisionTrace *decisions) { m_Decisions = decisions; }
+
+private:
+	ACCENTPOLICY ComputePolicy(int appearance) const // `appearance` can be 0, which means 'follow opt.taskbar_appearance'
+	{
+		ACCENTPOLICY policy;
+
+		if (appearance) // Custom taskbar appearance is set
+		{
+			if (m_Options.dynamicws_state == ACCENT_ENABLE_TINTED)
+			{ // dynamic-ws is set to tint
+				if (appearance == ACCENT_ENABLE_TINTED) { policy = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 2, m_Options.color, 0 }; } // Window is maximised
+				else { policy = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 2, 0x00000000, 0 }; } // Desktop is shown (this shouldn't ever be called tho, just in case)
+			}
+			else {  policy = { appearance, 2, m_Options.color, 0 };  }
+		} else { // Use the defaults
+			if (m_Options.dynamicws_state == ACCENT_ENABLE_TINTED) { policy = {ACCENT_ENABLE_TRANSPARENTGRADIENT, 2, 0x00000000, 0}; } // dynamic-ws is tint and desktop is shown
+			else if (m_Options.taskbar_appearance == ACCENT_NORMAL_GRADIENT) { policy = { ACCENT_ENABLE_TRANSPARENTGRADIENT, 2, (int)0xd9000000, 0 }; } // normal gradient color
+			else { policy = { m_Options.taskbar_appearance, 2, m_Options.color, 0 }; }
+		}
+		return policy;
+	}
+
+	void SetTaskbarBlur(std::size_t row)
+	{
+		if (m_Taskbars.State(row) == WindowMaximised) {
+			SetWindowBlur(row, m_Options.dynamicws_state);
+											// A window is maximised; let's make sure that we blur the window.
+		} else if (m_Taskbars.State(row) == Normal) {
+			SetWindowBlur(row);  // Taskbar should be normal, call using normal transparency settings
+		}
+	}
+
+	void SetWindowBlur(std::size_t row, int appearance = 0)
+	{
+		ACCENTPOLICY policy = ComputePolicy(appearance);
+		if (m_Taskbars.HasApplied(row) && m_Taskbars.Applied(row) == policy)
+		{
+			m_CompositionStats.skipped++; // Nothing changed, don't make DWM recompose the taskbar
+			if (m_Metrics)
+			{
+				m_Metrics->Add(MetricPoliciesSkipped);
+			}
+			if (m_Decisions)
+			{
+				m_Decisions->Emit(DecisionPolicySkipped, m_Taskbars.Handle(row), policy.nAccentState, policy.nColor);
+			}
+			return;
+		}
+
+		if (m_Backend.SetAccentPolicy(m_Taskbars.Handle(row), policy))
+		{
+			m_Taskbars.SetApplied(row, policy);
+		}
+		m_CompositionStats.issued++;
+		if (m_Metrics)
+		{
+			m_Metrics->Add(MetricPoliciesIssued);
+		}
+		if (m_Decisions)
+		{
+			m_Decisions->Emit(DecisionPolicyIssued, m_Taskbars.Handle(row), policy.nAccentState, policy.nColor);
+		}
+	}
+
+	Backend &m_Backend;
+	const OPTIONS &m_Options;
+	TaskbarTable m_Taskbars;
+	std::vector<WINDOWID> m_Handles;         // Scratch space for RefreshHandles
+	std::vector<MONITORID> m_HandleMonitors;
+	TransitionFilter m_Transitions;
+	MetricsRegistry *m_Metrics;
+	DecisionTrace *m_Decisions;
+	COMPOSITIONSTATS m_CompositionStats;
+	PARKSTATS m_ParkStats;
+	APPLYSTATS m_ApplyStats;
+};
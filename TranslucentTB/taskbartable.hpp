@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "backend.hpp"
+#include "transitionfilter.hpp"
+#include "windowclassifier.hpp"
+
+const std::size_t NO_TASKBAR = static_cast<std::size_t>(-1);
+
+struct TASKBARTABLESTATS
+{
+	unsigned long long refreshes; // Times the taskbars were looked for again
+	unsigned long long added;     // Taskbars that appeared, with a monitor or a restarted Explorer
+	unsigned long long removed;   // Taskbars that went away
+	unsigned long long moved;     // Taskbars that ended up on another monitor
+};
+
+// Every taskbar, one row each, stored column by column so a pass walks contiguous
+// arrays: the monitors, then the states, then the policies. A monitor finds its row
+// through a hash index, so telling the taskbars what a DESKTOPSTATE says costs the
+// same per monitor with one screen or sixteen.
+//
+// Rows are only added, removed or moved when the taskbars really changed: a taskbar
+// that survives a display change keeps its row, and with it its transition.
+class TaskbarTable
+{
+public:
+	TaskbarTable() : m_Shared(false), m_Stats() { }
+
+	// Makes the table match `handles`, each taskbar on the monitor at the same position
+	// in `monitors`. Returns whether anything changed.
+	bool Update(const std::vector<WINDOWID> &handles, const std::vector<MONITORID> &monitors)
+	{
+		m_Stats.refreshes++;
+		bool changed = false;
+
+		for (std::size_t row = m_Handles.size(); row-- > 0; )
+		{
+			if (Position(handles, m_Handles[row]) == NO_TASKBAR)
+			{
+				m_Stats.removed++;
+				Remove(row);
+				changed = true;
+			}
+		}
+
+		for (std::size_t i = 0; i < handles.size(); i++)
+		{
+			std::size_t row = Position(m_Handles, handles[i]);
+			if (row == NO_TASKBAR)
+			{
+				m_Stats.added++;
+				Add(handles[i], monitors[i]);
+				changed = true;
+			}
+			else if (m_Monitors[row] != monitors[i])
+			{
+				m_Stats.moved++;
+				m_Monitors[row] = monitors[i];
+				changed = true;
+			}
+		}
+
+		if (changed)
+		{
+			Reindex();
+		}
+		return changed;
+	}
+
+	// The row of the taskbar on `monitor`, or NO_TASKBAR.
+	std::size_t Find(MONITORID monitor) const
+	{
+		auto it = m_Index.find(monitor);
+		return it != m_Index.end() ? it->second : NO_TASKBAR;
+	}
+
+	// What every taskbar should show according to `state`, before the transition filter,
+	// and whether a fullscreen window hides it.
+	void SetTargets(const DESKTOPSTATE &state)
+	{
+		if (m_Shared)
+		{
+			// Two taskbars claim the same monitor, for a moment during a display change:
+			// the index only knows one of them.
+			for (std::size_t row = 0; row < m_Targets.size(); row++)
+			{
+				m_Targets[row] = state.StateOf(m_Monitors[row]);
+				m_Covered[row] = state.IsCovered(m_Monitors[row]);
+			}
+			return;
+		}
+
+		std::fill(m_Targets.begin(), m_Targets.end(), Normal);
+		for (const MONITORSTATE &entry : state.monitors)
+		{
+			std::size_t row = Find(entry.monitor);
+			if (row != NO_TASKBAR)
+			{
+				m_Targets[row] = entry.state;
+			}
+		}
+
+		std::fill(m_Covered.begin(), m_Covered.end(), false);
+		for (const FULLSCREENWINDOW &entry : state.fullscreen)
+		{
+			std::size_t row = Find(entry.monitor);
+			if (row != NO_TASKBAR)
+			{
+				m_Covered[row] = true;
+			}
+		}
+	}
+
+	// Explorer may have put its own accent back, the next pass applies them all again.
+	void ForgetApplied()
+	{
+		std::fill(m_HasApplied.begin(), m_HasApplied.end(), false);
+	}
+
+	std::size_t Size() const { return m_Handles.size(); }
+	WINDOWID Handle(std::size_t row) const { return m_Handles[row]; }
+	MONITORID Monitor(std::size_t row) const { return m_Monitors[row]; }
+	TASKBARSTATE Target(std::size_t row) const { return m_Targets[row]; }
+	TASKBARSTATE State(std::size_t row) const { return m_States[row]; }
+	TASKBARSTATE &State(std::size_t row) { return m_States[row]; }
+	TRANSITION &Transition(std::size_t row) { return m_Transitions[row]; }
+	bool HasApplied(std::size_t row) const { return m_HasApplied[row]; }
+	bool Covered(std::size_t row) const { return m_Covered[row]; }
+	bool Parked(std::size_t row) const { return m_Parked[row]; }
+	std::uint64_t ParkedSince(std::size_t row) const { return m_ParkedSince[row]; }
+	const ACCENTPOLICY &Applied(std::size_t row) const { return m_Applied[row]; }
+
+	void SetApplied(std::size_t row, const ACCENTPOLICY &policy)
+	{
+		m_Applied[row] = policy;
+		m_HasApplied[row] = true;
+	}
+
+	// A parked taskbar is left alone. It is given its policy again once it comes back, in
+	// case Explorer redrew it in the meantime.
+	void SetParked(std::size_t row, bool parked, std::uint64_t now)
+	{
+		m_Parked[row] = parked;
+		m_ParkedSince[row] = now;
+		m_HasApplied[row] = m_HasApplied[row] && parked;
+	}
+
+	const TASKBARTABLESTATS &Stats() const { return m_Stats; }
+
+private:
+	static std::size_t Position(const std::vector<WINDOWID> &handles, WINDOWID handle)
+	{
+		// A handful of taskbars at most, and only looked for when they change
+		for (std::size_t i = 0; i < handles.size(); i++)
+		{
+			if (handles[i] == handle)
+			{
+				return i;
+			}
+		}
+		return NO_TASKBAR;
+	}
+
+	void Add(WINDOWID handle, MONITORID monitor)
+	{
+		m_Handles.push_back(handle);
+		m_Monitors.push_back(monitor);
+		m_Targets.push_back(Normal);
+		m_States.push_back(Normal);
+		m_Transitions.push_back(TRANSITION());
+		m_Applied.push_back(ACCENTPOLICY());
+		m_HasApplied.push_back(false);
+		m_Covered.push_back(false);
+		m_Parked.push_back(false);
+		m_ParkedSince.push_back(0);
+	}
+
+	// The last row takes its place.
+	void Remove(std::size_t row)
+	{
+		std::size_t last = m_Handles.size() - 1;
+		m_Handles[row] = m_Handles[last];
+		m_Monitors[row] = m_Monitors[last];
+		m_Targets[row] = m_Targets[last];
+		m_States[row] = m_States[last];
+		m_Transitions[row] = m_Transitions[last];
+		m_Applied[row] = m_Applied[last];
+		m_HasApplied[row] = m_HasApplied[last];
+		m_Covered[row] = m_Covered[last];
+		m_Parked[row] = m_Parked[last];
+		m_ParkedSince[row] = m_ParkedSince[last];
+
+		m_Handles.pop_back();
+		m_Monitors.pop_back();
+		m_Targets.pop_back();
+		m_States.pop_back();
+		m_Transitions.pop_back();
+		m_Applied.pop_back();
+		m_HasApplied.pop_back();
+		m_Covered.pop_back();
+		m_Parked.pop_back();
+		m_ParkedSince.pop_back();
+	}
+
+	void Reindex()
+	{
+		m_Index.clear();
+		m_Shared = false;
+		for (std::size_t row = 0; row < m_Monitors.size(); row++)
+		{
+			m_Shared = !m_Index.emplace(m_Monitors[row], row).second || m_Shared;
+		}
+	}
+
+	std::vector<WINDOWID> m_Handles;
+	std::vector<MONITORID> m_Monitors;
+	std::vector<TASKBARSTATE> m_Targets;   // What the latest DESKTOPSTATE says
+	std::vector<TASKBARSTATE> m_States;    // What the taskbar shows, once through the transition filter
+	std::vector<TRANSITION> m_Transitions;
+	std::vector<ACCENTPOLICY> m_Applied;   // Last policy given to SetAccentPolicy
+	std::vector<bool> m_HasApplied;        // false until a policy is applied, and whenever Explorer may have reset it
+	std::vector<bool> m_Covered;           // A fullscreen window hides it, according to the latest DESKTOPSTATE
+	std::vector<bool> m_Parked;            // Left alone because it was covered, as of the last apply
+	std::vector<std::uint64_t> m_ParkedSince;
+	std::unordered_map<MONITORID, std::size_t> m_Index;
+	bool m_Shared;                         // Some monitor has more than one taskbar
+	TASKBARTABLESTATS m_Stats;
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary traces of what TranslucentTB saw on a desktop (tracerecorder.hpp), which can
+// be replayed anywhere (tracereplay.hpp).
+//
+// A trace starts with TRACE_MAGIC, then is a plain sequence of records, so recording
+// can append to an existing file. A record is a TRACERECORD byte followed by fields,
+// every number is an unsigned LEB128 varint and every string is interned: it is written
+// once in a TraceString record, then referred to by its number (the first one is 1, 0
+// is the empty string).
+//
+// Facts (TraceWindow*, TraceForeground, TraceEnumeration, TraceProcess) are only
+// written when the answer a backend gave differs from the one recorded last, and
+// always before the TracePass that asked for them, so a replay has them at hand when
+// the same pass asks again.
+
+const char TRACE_MAGIC[8] = { 'T', 'T', 'B', 'T', 'R', 'A', 'C', '1' };
+
+enum TRACERECORD
+{
+	TraceString = 1,    // length, UTF-16 code units       Interns the next string
+	TraceRules,         // folding, 6 x (count, strings)  The exclusion rules, in EXCLUSIONRULES order
+	TraceEvent,         // type, window
+	TraceWindowFlags,   // window, TRACEWINDOWFLAGS
+	TraceWindowClass,   // window, string
+	TraceWindowTitle,   // window, string
+	TraceWindowProcess, // window, pid
+	TraceWindowMonitor, // window, monitor
+	TraceForeground,    // window
+	TraceEnumeration,   // count, windows                  Topmost first
+	TraceProcess,       // pid, TRACEPROCESSFLAGS, string  Exe name, only meaningful with TraceProcessNamed
+	TracePass,          // time since the last pass, reason, TRACEPASSFLAGS
+	TraceWindowRect,    // window, left, top, right, bottom     Only meaningful with TraceWindowHasRect
+	TraceMonitorRects   // monitor, valid, bounds, work area    Same order as WINDOWRECT, 0 for valid when it couldn't be had
+};
+
+enum TRACEWINDOWFLAGS
+{
+	TraceWindowExists    = 1 << 0,
+	TraceWindowMaximised = 1 << 1,
+	TraceWindowVisible   = 1 << 2,
+	TraceWindowOnDesktop = 1 << 3, // On the current virtual desktop
+	TraceWindowHasRect   = 1 << 4
+};
+
+enum TRACEPROCESSFLAGS
+{
+	TraceProcessOpened = 1 << 0,
+	TraceProcessExited = 1 << 1,
+	TraceProcessNamed  = 1 << 2,
+	TraceProcessListed = 1 << 3  // In the last snapshot of every process, under its name
+};
+
+enum TRACEPASSFLAGS
+{
+	TracePassDynamicWs    = 1 << 0,
+	TracePassDynamicStart = 1 << 1,
+	TracePassGeometry     = 1 << 2  // DynamicWsGeometry
+};
+
+inline void WriteVarint(std::vector<unsigned char> &out, std::uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back(static_cast<unsigned char>(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back(static_cast<unsigned char>(value));
+}
+
+// Coordinates can be negative, zigzag encoding keeps small ones short either way.
+inline void WriteSigned(std::vector<unsigned char> &out, int value)
+{
+	std::uint32_t bits = static_cast<std::uint32_t>(value);
+	WriteVarint(out, static_cast<std::uint32_t>(bits << 1) ^ (value < 0 ? 0xFFFFFFFFU : 0));
+}
+
+// Returns false, and leaves `pos` alone, if the varint runs past `end`.
+inline bool ReadVarint(const unsigned char *&pos, const unsigned char *end, std::uint64_t &value)
+{
+	std::uint64_t result = 0;
+	for (const unsigned char *p = pos; p != end && p - pos < 10; p++)
+	{
+		result |= static_cast<std::uint64_t>(*p & 0x7F) << (7 * (p - pos));
+		if (!(*p & 0x80))
+		{
+			value = result;
+			pos = p + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+inline bool ReadSigned(const unsigned char *&pos, const unsigned char *end, int &value)
+{
+	std::uint64_t encoded;
+	if (!ReadVarint(pos, end, encoded))
+	{
+		return false;
+	}
+	value = static_cast<int>(static_cast<std::uint32_t>(encoded >> 1) ^ (encoded & 1 ? 0xFFFFFFFFU : 0));
+	return true;
+}
@@ -0,0 +1,416 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "backend.hpp"
+#include "eventloop.hpp"
+#include "exclusionmatcher.hpp"
+#include "traceformat.hpp"
+
+struct TRACESTATS
+{
+	unsigned long long records;
+	unsigned long long strings; // Distinct strings interned
+	unsigned long long bytes;   // Written to the file so far
+};
+
+// Sits between a WindowClassifier and the real backend, and writes down everything the
+// classifier is told, in the format described in traceformat.hpp. Only answers that
+// changed since they were last recorded are written, so a trace grows with what
+// happens on the desktop rather than with the number of queries.
+//
+// Records are buffered and written out at the end of every pass, so a trace cut short
+// by a crash still ends on a whole pass.
+class TraceRecorder : public Backend
+{
+public:
+	// `file` is opened for binary appending by the caller, and must outlive the recorder.
+	TraceRecorder(Backend &backend, std::FILE *file) :
+		m_Backend(backend),
+		m_File(file),
+		m_LastPass(0),
+		m_Foreground(0),
+		m_Snapshots(0),
+		m_Stats()
+	{
+		std::fseek(m_File, 0, SEEK_END);
+		if (std::ftell(m_File) == 0)
+		{
+			m_Buffer.insert(m_Buffer.end(), TRACE_MAGIC, TRACE_MAGIC + sizeof(TRACE_MAGIC));
+		}
+		else
+		{
+			m_Stats.bytes = std::ftell(m_File);
+		}
+	}
+
+	~TraceRecorder()
+	{
+		Flush();
+	}
+
+	void RecordEvent(const EVENT &ev)
+	{
+		Begin(TraceEvent);
+		WriteVarint(m_Buffer, ev.type);
+		WriteVarint(m_Buffer, ev.window);
+		if (ev.type == WindowDestroyed)
+		{
+			m_Windows.erase(ev.window); // Handles get reused, start over with whoever gets it next
+		}
+	}
+
+	void RecordRules(const EXCLUSIONRULES &rules, unsigned int folding)
+	{
+		const std::vector<std::wstring> *lists[] = { &rules.classes, &rules.exes, &rules.titles, &rules.classglobs, &rules.exeglobs, &rules.titleregexes };
+		std::vector<std::uint64_t> strings;
+		for (const std::vector<std::wstring> *list : lists)
+		{
+			for (const std::wstring &value : *list)
+			{
+				strings.push_back(Intern(value));
+			}
+		}
+
+		Begin(TraceRules);
+		WriteVarint(m_Buffer, folding);
+		std::size_t next = 0;
+		for (const std::vector<std::wstring> *list : lists)
+		{
+			WriteVarint(m_Buffer, list->size());
+			for (std::size_t i = 0; i < list->size(); i++)
+			{
+				WriteVarint(m_Buffer, strings[next++]);
+			}
+		}
+	}
+
+	// Ends the records of a pass, and writes them out.
+	void RecordPass(unsigned int reason, std::uint64_t now, bool dynamicws, bool dynamicstart, bool geometry)
+	{
+		Begin(TracePass);
+		WriteVarint(m_Buffer, now >= m_LastPass ? now - m_LastPass : 0);
+		WriteVarint(m_Buffer, reason);
+		WriteVarint(m_Buffer, (dynamicws ? TracePassDynamicWs : 0) | (dynamicstart ? TracePassDynamicStart : 0) | (geometry ? TracePassGeometry : 0));
+		m_LastPass = now;
+		Flush();
+	}
+
+	const TRACESTATS &Stats() const { return m_Stats; }
+
+	#pragma region Backend
+
+	void EnumerateWindows(std::vector<WINDOWID> &windows) override
+	{
+		m_Backend.EnumerateWindows(windows);
+		if (windows != m_Enumeration)
+		{
+			m_Enumeration = windows;
+			Begin(TraceEnumeration);
+			WriteVarint(m_Buffer, windows.size());
+			for (WINDOWID window : windows)
+			{
+				WriteVarint(m_Buffer, window);
+			}
+		}
+	}
+
+	bool IsWindow(WINDOWID window) override
+	{
+		return Flag(window, TraceWindowExists, m_Backend.IsWindow(window));
+	}
+
+	bool IsWindowMaximised(WINDOWID window) override
+	{
+		return Flag(window, TraceWindowMaximised, m_Backend.IsWindowMaximised(window));
+	}
+
+	bool IsWindowVisible(WINDOWID window) override
+	{
+		return Flag(window, TraceWindowVisible, m_Backend.IsWindowVisible(window));
+	}
+
+	bool IsWindowOnCurrentDesktop(WINDOWID window) override
+	{
+		return Flag(window, TraceWindowOnDesktop, m_Backend.IsWindowOnCurrentDesktop(window));
+	}
+
+	std::size_t GetWindowClass(WINDOWID window, wchar_t *buffer, std::size_t size) override
+	{
+		std::size_t length = m_Backend.GetWindowClass(window, buffer, size);
+		Fact(TraceWindowClass, window, m_Windows[window].classname, Intern(std::wstring(buffer, length)));
+		return length;
+	}
+
+	std::size_t GetWindowTitle(WINDOWID window, wchar_t *buffer, std::size_t size) override
+	{
+		std::size_t length = m_Backend.GetWindowTitle(window, buffer, size);
+		Fact(TraceWindowTitle, window, m_Windows[window].title, Intern(std::wstring(buffer, length)));
+		return length;
+	}
+
+	unsigned long GetWindowProcessId(WINDOWID window) override
+	{
+		unsigned long pid = m_Backend.GetWindowProcessId(window);
+		Fact(TraceWindowProcess, window, m_Windows[window].pid, pid);
+		return pid;
+	}
+
+	bool GetWindowRect(WINDOWID window, WINDOWRECT &rect) override
+	{
+		bool valid = m_Backend.GetWindowRect(window, rect);
+		WINDOWFACTS &facts = m_Windows[window];
+		if (valid && !Same(facts.rect, rect))
+		{
+			facts.rect = rect;
+			Begin(TraceWindowRect);
+			WriteVarint(m_Buffer, window);
+			WriteRect(rect);
+		}
+		return Flag(window, TraceWindowHasRect, valid);
+	}
+
+	MONITORID GetWindowMonitor(WINDOWID window) override
+	{
+		MONITORID monitor = m_Backend.GetWindowMonitor(window);
+		Fact(TraceWindowMonitor, window, m_Windows[window].monitor, monitor);
+		return monitor;
+	}
+
+	WINDOWID GetForegroundWindow() override
+	{
+		WINDOWID foreground = m_Backend.GetForegroundWindow();
+		if (foreground != m_Foreground)
+		{
+			m_Foreground = foreground;
+			Begin(TraceForeground);
+			WriteVarint(m_Buffer, foreground);
+		}
+		return foreground;
+	}
+
+	void FindTaskbars(std::vector<WINDOWID> &taskbars) override
+	{
+		m_Backend.FindTaskbars(taskbars); // Taskbars are replayed from the monitors windows were seen on
+	}
+
+	bool GetMonitorRects(MONITORID monitor, WINDOWRECT &bounds, WINDOWRECT &work) override
+	{
+		bool valid = m_Backend.GetMonitorRects(monitor, bounds, work);
+		auto it = m_Monitors.find(monitor);
+		if (it == m_Monitors.end() || it->second.valid != valid ||
+			(valid && (!Same(it->second.bounds, bounds) || !Same(it->second.work, work))))
+		{
+			MONITORFACTS &facts = m_Monitors[monitor];
+			facts.valid = valid;
+			facts.bounds = valid ? bounds : WINDOWRECT();
+			facts.work = valid ? work : WINDOWRECT();
+			Begin(TraceMonitorRects);
+			WriteVarint(m_Buffer, monitor);
+			WriteVarint(m_Buffer, valid);
+			WriteRect(facts.bounds);
+			WriteRect(facts.work);
+		}
+		return valid;
+	}
+
+	PROCESSREF OpenProcess(unsigned long pid) override
+	{
+		PROCESSREF process = m_Backend.OpenProcess(pid);
+		if (process)
+		{
+			m_Handles[process] = pid;
+		}
+		PROCESSFACTS &facts = m_Processes[pid];
+		ProcessFact(pid, facts, process ? facts.flags | TraceProcessOpened : facts.flags & ~TraceProcessOpened, facts.name);
+		return process;
+	}
+
+	bool HasProcessExited(PROCESSREF process) override
+	{
+		bool exited = m_Backend.HasProcessExited(process);
+		auto handle = m_Handles.find(process);
+		if (handle != m_Handles.end())
+		{
+			PROCESSFACTS &facts = m_Processes[handle->second];
+			ProcessFact(handle->second, facts, exited ? facts.flags | TraceProcessExited : facts.flags & ~TraceProcessExited, facts.name);
+		}
+		return exited;
+	}
+
+	bool GetProcessExeName(PROCESSREF process, std::wstring &name) override
+	{
+		bool named = m_Backend.GetProcessExeName(process, name);
+		auto handle = m_Handles.find(process);
+		if (handle != m_Handles.end())
+		{
+			PROCESSFACTS &facts = m_Processes[handle->second];
+			ProcessFact(handle->second, facts, named ? facts.flags | TraceProcessNamed : facts.flags & ~TraceProcessNamed, named ? Intern(name) : 0);
+		}
+		return named;
+	}
+
+	void CloseProcess(PROCESSREF process) override
+	{
+		m_Handles.erase(process);
+		m_Backend.CloseProcess(process);
+	}
+
+	bool SnapshotProcesses(std::vector<PROCESSNAME> &processes) override
+	{
+		bool listed = m_Backend.SnapshotProcesses(processes);
+		m_Snapshots++;
+		for (const PROCESSNAME &process : processes)
+		{
+			PROCESSFACTS &facts = m_Processes[process.pid];
+			facts.snapshot = m_Snapshots;
+			ProcessFact(process.pid, facts, facts.flags | TraceProcessListed, Intern(process.exe));
+		}
+
+		// Processes that were in the last one and aren't any more
+		for (auto &process : m_Processes)
+		{
+			if ((process.second.flags & TraceProcessListed) && process.second.snapshot != m_Snapshots)
+			{
+				ProcessFact(process.first, process.second, process.second.flags & ~TraceProcessListed, process.second.name);
+			}
+		}
+		return listed;
+	}
+
+	bool SetAccentPolicy(WINDOWID taskbar, const ACCENTPOLICY &policy) override
+	{
+		return m_Backend.SetAccentPolicy(taskbar, policy); // Worked out again by the replay
+	}
+
+	#pragma endregion
+
+private:
+	// What was last recorded about a window. Everything starts out as a replay would
+	// assume for a window it knows nothing about.
+	struct WINDOWFACTS
+	{
+		std::uint64_t flags;
+		std::uint64_t classname;
+		std::uint64_t title;
+		std::uint64_t pid;
+		std::uint64_t monitor;
+		WINDOWRECT rect;
+	};
+
+	struct MONITORFACTS
+	{
+		bool valid;
+		WINDOWRECT bounds;
+		WINDOWRECT work;
+	};
+
+	struct PROCESSFACTS
+	{
+		std::uint64_t flags;
+		std::uint64_t name;
+		std::uint64_t snapshot; // The last one that listed it, not recorded
+	};
+
+	void Begin(TRACERECORD record)
+	{
+		m_Buffer.push_back(static_cast<unsigned char>(record));
+		m_Stats.records++;
+	}
+
+	static bool Same(const WINDOWRECT &a, const WINDOWRECT &b)
+	{
+		return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+	}
+
+	void WriteRect(const WINDOWRECT &rect)
+	{
+		WriteSigned(m_Buffer, rect.left);
+		WriteSigned(m_Buffer, rect.top);
+		WriteSigned(m_Buffer, rect.right);
+		WriteSigned(m_Buffer, rect.bottom);
+	}
+
+	std::uint64_t Intern(const std::wstring &value)
+	{
+		if (value.empty())
+		{
+			return 0;
+		}
+
+		auto it = m_Strings.find(value);
+		if (it != m_Strings.end())
+		{
+			return it->second;
+		}
+
+		Begin(TraceString);
+		WriteVarint(m_Buffer, value.length());
+		for (wchar_t c : value)
+		{
+			WriteVarint(m_Buffer, static_cast<std::uint16_t>(c));
+		}
+		std::uint64_t index = ++m_Stats.strings;
+		m_Strings[value] = index;
+		return index;
+	}
+
+	bool Flag(WINDOWID window, TRACEWINDOWFLAGS flag, bool value)
+	{
+		WINDOWFACTS &facts = m_Windows[window];
+		Fact(TraceWindowFlags, window, facts.flags, value ? facts.flags | flag : facts.flags & ~flag);
+		return value;
+	}
+
+	void Fact(TRACERECORD record, WINDOWID window, std::uint64_t &recorded, std::uint64_t value)
+	{
+		if (recorded != value)
+		{
+			recorded = value;
+			Begin(record);
+			WriteVarint(m_Buffer, window);
+			WriteVarint(m_Buffer, value);
+		}
+	}
+
+	void ProcessFact(unsigned long pid, PROCESSFACTS &facts, std::uint64_t flags, std::uint64_t name)
+	{
+		if (facts.flags != flags || facts.name != name)
+		{
+			facts.flags = flags;
+			facts.name = name;
+			Begin(TraceProcess);
+			WriteVarint(m_Buffer, pid);
+			WriteVarint(m_Buffer, flags);
+			WriteVarint(m_Buffer, name);
+		}
+	}
+
+	void Flush()
+	{
+		if (!m_Buffer.empty())
+		{
+			std::fwrite(m_Buffer.data(), 1, m_Buffer.size(), m_File);
+			std::fflush(m_File);
+			m_Stats.bytes += m_Buffer.size();
+			m_Buffer.clear();
+		}
+	}
+
+	Backend &m_Backend;
+	std::FILE *m_File;
+	std::vector<unsigned char> m_Buffer;
+	std::uint64_t m_LastPass;
+	WINDOWID m_Foreground;
+	std::uint64_t m_Snapshots;
+	std::vector<WINDOWID> m_Enumeration;
+	std::unordered_map<WINDOWID, WINDOWFACTS> m_Windows;
+	std::unordered_map<unsigned long, PROCESSFACTS> m_Processes;
+	std::unordered_map<MONITORID, MONITORFACTS> m_Monitors;
+	std::unordered_map<PROCESSREF, unsigned long> m_Handles;
+	std::unordered_map<std::wstring, std::uint64_t> m_Strings;
+	TRACESTATS m_Stats;
+};
@@ -0,0 +1,599 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "backend.hpp"
+#include "eventloop.hpp"
+#include "exclusionmatcher.hpp"
+#include "taskbarcontroller.hpp"
+#include "traceformat.hpp"
+#include "windowclassifier.hpp"
+
+// A whole file mapped read-only into memory.
+class MappedFile
+{
+public:
+	explicit MappedFile(const char *path) : m_Data(nullptr), m_Size(0)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+
+		LARGE_INTEGER size;
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		{
+			HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping)
+			{
+				m_Data = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				m_Size = m_Data ? static_cast<std::size_t>(size.QuadPart) : 0;
+				CloseHandle(mapping); // The view keeps it alive
+			}
+		}
+		CloseHandle(file);
+#else
+		int file = open(path, O_RDONLY);
+		if (file < 0)
+		{
+			return;
+		}
+
+		struct stat info;
+		if (fstat(file, &info) == 0 && info.st_size > 0)
+		{
+			void *data = mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+			if (data != MAP_FAILED)
+			{
+				m_Data = static_cast<const unsigned char *>(data);
+				m_Size = static_cast<std::size_t>(info.st_size);
+			}
+		}
+		close(file);
+#endif
+	}
+
+	~MappedFile()
+	{
+		if (m_Data)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(m_Data);
+#else
+			munmap(const_cast<unsigned char *>(m_Data), m_Size);
+#endif
+		}
+	}
+
+	const unsigned char *Data() const { return m_Data; }
+	std::size_t Size() const { return m_Size; }
+
+private:
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator =(const MappedFile &) = delete;
+
+	const unsigned char *m_Data;
+	std::size_t m_Size;
+};
+
+// Answers every query with what the trace recorded last. Taskbars aren't recorded,
+// there is one for every monitor a window was seen on.
+class ReplayBackend : public Backend
+{
+public:
+	ReplayBackend() : m_Foreground(0), m_MonitorsChanged(false), m_Compositions(0) { }
+
+	#pragma region Trace
+
+	void SetWindowFact(TRACERECORD record, WINDOWID window, std::uint64_t value)
+	{
+		WINDOW &data = m_Windows[window];
+		switch (record)
+		{
+		case TraceWindowFlags: data.flags = value; break;
+		case TraceWindowClass: data.classname = value; break;
+		case TraceWindowTitle: data.title = value; break;
+		case TraceWindowProcess: data.pid = static_cast<unsigned long>(value); break;
+		case TraceWindowMonitor:
+			data.monitor = static_cast<MONITORID>(value);
+			NoteMonitor(data.monitor);
+			break;
+		default: break;
+		}
+	}
+
+	void SetWindowRect(WINDOWID window, const WINDOWRECT &rect) { m_Windows[window].rect = rect; }
+
+	void SetMonitorRects(MONITORID monitor, bool valid, const WINDOWRECT &bounds, const WINDOWRECT &work)
+	{
+		m_MonitorRects[monitor] = { valid, bounds, work };
+		NoteMonitor(monitor);
+	}
+
+	// Same as the recorder: a destroyed handle starts over.
+	void ForgetWindow(WINDOWID window) { m_Windows.erase(window); }
+	void SetForeground(WINDOWID window) { m_Foreground = window; }
+	std::vector<WINDOWID> &Enumeration() { return m_ZOrder; }
+	std::vector<std::wstring> &Strings() { return m_Strings; }
+
+	void SetProcess(unsigned long pid, std::uint64_t flags, std::uint64_t name)
+	{
+		m_Processes[pid] = { flags, name };
+	}
+
+	// Whether a monitor showed up since the last call.
+	bool TakeMonitorsChanged()
+	{
+		bool changed = m_MonitorsChanged;
+		m_MonitorsChanged = false;
+		return changed;
+	}
+
+	unsigned long long Compositions() const { return m_Compositions; }
+
+	#pragma endregion
+
+	#pragma region Backend
+
+	void EnumerateWindows(std::vector<WINDOWID> &windows) override { windows = m_ZOrder; }
+	bool IsWindow(WINDOWID window) override { return HasFlag(window, TraceWindowExists); }
+	bool IsWindowMaximised(WINDOWID window) override { return HasFlag(window, TraceWindowMaximised); }
+	bool IsWindowVisible(WINDOWID window) override { return HasFlag(window, TraceWindowVisible); }
+	bool IsWindowOnCurrentDesktop(WINDOWID window) override { return HasFlag(window, TraceWindowOnDesktop); }
+
+	std::size_t GetWindowClass(WINDOWID window, wchar_t *buffer, std::size_t size) override
+	{
+		const WINDOW *data = Find(window);
+		return Copy(data ? data->classname : 0, buffer, size);
+	}
+
+	std::size_t GetWindowTitle(WINDOWID window, wchar_t *buffer, std::size_t size) override
+	{
+		const WINDOW *data = Find(window);
+		return Copy(data ? data->title : 0, buffer, size);
+	}
+
+	unsigned long GetWindowProcessId(WINDOWID window) override
+	{
+		const WINDOW *data = Find(window);
+		return data ? data->pid : 0;
+	}
+
+	WINDOWID GetForegroundWindow() override { return m_Foreground; }
+
+	bool GetWindowRect(WINDOWID window, WINDOWRECT &rect) override
+	{
+		const WINDOW *data = Find(window);
+		if (!data || !(data->flags & TraceWindowHasRect))
+		{
+			return false;
+		}
+		rect = data->rect;
+		return true;
+	}
+
+	MONITORID GetWindowMonitor(WINDOWID window) override
+	{
+		if (window & TASKBAR_BIT)
+		{
+			return window & ~TASKBAR_BIT;
+		}
+		const WINDOW *data = Find(window);
+		return data ? data->monitor : 0;
+	}
+
+	void FindTaskbars(std::vector<WINDOWID> &taskbars) override
+	{
+		taskbars.clear();
+		for (MONITORID monitor : m_Monitors)
+		{
+			taskbars.push_back(monitor | TASKBAR_BIT);
+		}
+	}
+
+	bool GetMonitorRects(MONITORID monitor, WINDOWRECT &bounds, WINDOWRECT &work) override
+	{
+		auto it = m_MonitorRects.find(monitor);
+		if (it == m_MonitorRects.end() || !it->second.valid)
+		{
+			return false;
+		}
+		bounds = it->second.bounds;
+		work = it->second.work;
+		return true;
+	}
+
+	PROCESSREF OpenProcess(unsigned long pid) override
+	{
+		auto it = m_Processes.find(pid);
+		return it != m_Processes.end() && (it->second.flags & TraceProcessOpened) ? pid : 0;
+	}
+
+	bool HasProcessExited(PROCESSREF process) override
+	{
+		auto it = m_Processes.find(static_cast<unsigned long>(process));
+		return it != m_Processes.end() && (it->second.flags & TraceProcessExited);
+	}
+
+	bool GetProcessExeName(PROCESSREF process, std::wstring &name) override
+	{
+		auto it = m_Processes.find(static_cast<unsigned long>(process));
+		if (it == m_Processes.end() || !(it->second.flags & TraceProcessNamed))
+		{
+			return false;
+		}
+		name = String(it->second.name);
+		return true;
+	}
+
+	void CloseProcess(PROCESSREF) override { }
+
+	bool SnapshotProcesses(std::vector<PROCESSNAME> &processes) override
+	{
+		processes.clear();
+		for (const auto &process : m_Processes)
+		{
+			if (process.second.flags & TraceProcessListed)
+			{
+				processes.push_back(PROCESSNAME());
+				processes.back().pid = process.first;
+				Copy(process.second.name, processes.back().exe, MAX_EXE_NAME);
+			}
+		}
+		return !processes.empty(); // A snapshot that failed listed nothing
+	}
+
+	bool SetAccentPolicy(WINDOWID, const ACCENTPOLICY &) override
+	{
+		m_Compositions++;
+		return true;
+	}
+
+	#pragma endregion
+
+private:
+	static const WINDOWID TASKBAR_BIT = static_cast<WINDOWID>(1) << (sizeof(WINDOWID) * 8 - 1); // Never set on a real handle
+
+	struct WINDOW
+	{
+		std::uint64_t flags;
+		std::uint64_t classname;
+		std::uint64_t title;
+		unsigned long pid;
+		MONITORID monitor;
+		WINDOWRECT rect;
+	};
+
+	struct MONITOR
+	{
+		bool valid;
+		WINDOWRECT bounds;
+		WINDOWRECT work;
+	};
+
+	struct PROCESS
+	{
+		std::uint64_t flags;
+		std::uint64_t name;
+	};
+
+	void NoteMonitor(MONITORID monitor)
+	{
+		if (monitor && std::find(m_Monitors.begin(), m_Monitors.end(), monitor) == m_Monitors.end())
+		{
+			m_Monitors.push_back(monitor);
+			m_MonitorsChanged = true;
+		}
+	}
+
+	const WINDOW *Find(WINDOWID window) const
+	{
+		auto it = m_Windows.find(window);
+		return it != m_Windows.end() ? &it->second : nullptr;
+	}
+
+	bool HasFlag(WINDOWID window, TRACEWINDOWFLAGS flag) const
+	{
+		const WINDOW *data = Find(window);
+		return data && (data->flags & flag);
+	}
+
+	const std::wstring &String(std::uint64_t number) const
+	{
+		static const std::wstring empty;
+		return number && number <= m_Strings.size() ? m_Strings[static_cast<std::size_t>(number - 1)] : empty;
+	}
+
+	std::size_t Copy(std::uint64_t number, wchar_t *buffer, std::size_t size) const
+	{
+		if (size == 0)
+		{
+			return 0;
+		}
+		const std::wstring &value = String(number);
+		std::size_t length = value.length() < size ? value.length() : size - 1;
+		std::wmemcpy(buffer, value.c_str(), length);
+		buffer[length] = L'\0';
+		return length;
+	}
+
+	WINDOWID m_Foreground;
+	bool m_MonitorsChanged;
+	unsigned long long m_Compositions;
+	std::vector<MONITORID> m_Monitors;
+	std::vector<WINDOWID> m_ZOrder;
+	std::vector<std::wstring> m_Strings;
+	std::unordered_map<WINDOWID, WINDOW> m_Windows;
+	std::unordered_map<unsigned long, PROCESS> m_Processes;
+	std::unordered_map<MONITORID, MONITOR> m_MonitorRects;
+};
+
+// Folds a state into a running digest, so a whole run can be compared with a replay of
+// it. The order the monitors are listed in doesn't matter.
+inline std::uint64_t DigestState(std::uint64_t digest, const DESKTOPSTATE &state)
+{
+	std::uint64_t hash = 0;
+	for (const MONITORSTATE &monitor : state.monitors)
+	{
+		hash += (static_cast<std::uint64_t>(monitor.monitor) * 0x9E3779B97F4A7C15ULL) ^ (monitor.state + 1);
+	}
+	return (digest ^ hash) * 1099511628211ULL;
+}
+
+struct REPLAYSTATS
+{
+	unsigned long long records;
+	unsigned long long events;
+	unsigned long long passes;
+	unsigned long long compositions;
+	std::uint64_t digest;   // Of every state the passes came up with: two replays of one trace always agree
+	std::uint64_t duration; // Desktop time covered by the trace (ms)
+	bool complete;          // false if the trace is cut short or damaged, everything up to there was still replayed
+};
+
+// Feeds a trace through the same WindowClassifier and TaskbarController the real desktop
+// goes through, as fast as it can read it. Nothing depends on the clock or the machine,
+// so a trace replays the same way everywhere.
+class TraceReplayer
+{
+public:
+	TraceReplayer() :
+		m_Options(),
+		m_Classifier(m_Backend, m_Exclusions),
+		m_Controller(m_Backend, m_Options),
+		m_Stats()
+	{
+		m_Options.taskbar_appearance = ACCENT_ENABLE_TRANSPARENTGRADIENT;
+		m_Options.dynamicws_state = ACCENT_ENABLE_BLURBEHIND;
+		m_Options.transitions = { 0, 0, LeadingEdge }; // Its timer isn't part of the trace
+	}
+
+	// Returns false if this isn't a trace at all.
+	bool Replay(const unsigned char *data, std::size_t size)
+	{
+		if (size < sizeof(TRACE_MAGIC) || std::memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC)))
+		{
+			return false;
+		}
+
+		m_Pos = data + sizeof(TRACE_MAGIC);
+		m_End = data + size;
+		TRACERECORD last = TracePass;
+		m_Stats.complete = false;
+		while (m_Pos != m_End)
+		{
+			last = static_cast<TRACERECORD>(*m_Pos++);
+			if (!Record(last))
+			{
+				break;
+			}
+			m_Stats.records++;
+		}
+		m_Stats.complete = m_Pos == m_End && last == TracePass; // The recorder always writes whole passes
+		m_Stats.compositions = m_Backend.Compositions();
+		return true;
+	}
+
+	const REPLAYSTATS &Stats() const { return m_Stats; }
+	const WindowClassifier &Classifier() const { return m_Classifier; }
+
+private:
+	bool Read(std::uint64_t &value)
+	{
+		return ReadVarint(m_Pos, m_End, value);
+	}
+
+	bool Record(TRACERECORD record)
+	{
+		std::uint64_t a, b, c;
+		switch (record)
+		{
+		case TraceString:
+		{
+			if (!Read(a) || a > static_cast<std::uint64_t>(m_End - m_Pos))
+			{
+				return false;
+			}
+			std::wstring value(static_cast<std::size_t>(a), L'\0');
+			for (wchar_t &character : value)
+			{
+				if (!Read(b))
+				{
+					return false;
+				}
+				character = static_cast<wchar_t>(b);
+			}
+			m_Backend.Strings().push_back(value);
+			return true;
+		}
+		case TraceRules:
+			return Rules();
+		case TraceEvent:
+			if (!Read(a) || !Read(b) || a > DesktopSwitched) // The last EVENTTYPE
+			{
+				return false;
+			}
+			m_Classifier.OnEvent({ static_cast<EVENTTYPE>(a), static_cast<WINDOWID>(b) });
+			if (a == WindowDestroyed)
+			{
+				m_Backend.ForgetWindow(static_cast<WINDOWID>(b));
+			}
+			m_Stats.events++;
+			return true;
+		case TraceWindowFlags:
+		case TraceWindowClass:
+		case TraceWindowTitle:
+		case TraceWindowProcess:
+		case TraceWindowMonitor:
+			if (!Read(a) || !Read(b))
+			{
+				return false;
+			}
+			m_Backend.SetWindowFact(record, static_cast<WINDOWID>(a), b);
+			return true;
+		case TraceForeground:
+			if (!Read(a))
+			{
+				return false;
+			}
+			m_Backend.SetForeground(static_cast<WINDOWID>(a));
+			return true;
+		case TraceEnumeration:
+		{
+			if (!Read(a) || a > static_cast<std::uint64_t>(m_End - m_Pos))
+			{
+				return false;
+			}
+			std::vector<WINDOWID> &windows = m_Backend.Enumeration();
+			windows.resize(static_cast<std::size_t>(a));
+			for (WINDOWID &window : windows)
+			{
+				if (!Read(b))
+				{
+					return false;
+				}
+				window = static_cast<WINDOWID>(b);
+			}
+			return true;
+		}
+		case TraceProcess:
+			if (!Read(a) || !Read(b) || !Read(c))
+			{
+				return false;
+			}
+			m_Backend.SetProcess(static_cast<unsigned long>(a), b, c);
+			return true;
+		case TraceWindowRect:
+		{
+			WINDOWRECT rect;
+			if (!Read(a) || !ReadRect(rect))
+			{
+				return false;
+			}
+			m_Backend.SetWindowRect(static_cast<WINDOWID>(a), rect);
+			return true;
+		}
+		case TraceMonitorRects:
+		{
+			WINDOWRECT bounds, work;
+			if (!Read(a) || !Read(b) || !ReadRect(bounds) || !ReadRect(work))
+			{
+				return false;
+			}
+			m_Backend.SetMonitorRects(static_cast<MONITORID>(a), b != 0, bounds, work);
+			return true;
+		}
+		case TracePass:
+			if (!Read(a) || !Read(b) || !Read(c))
+			{
+				return false;
+			}
+			Pass(a, static_cast<unsigned int>(b), c);
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	bool ReadRect(WINDOWRECT &rect)
+	{
+		return ReadSigned(m_Pos, m_End, rect.left) && ReadSigned(m_Pos, m_End, rect.top) &&
+			ReadSigned(m_Pos, m_End, rect.right) && ReadSigned(m_Pos, m_End, rect.bottom);
+	}
+
+	bool Rules()
+	{
+		std::uint64_t folding;
+		if (!Read(folding))
+		{
+			return false;
+		}
+
+		EXCLUSIONRULES rules;
+		std::vector<std::wstring> *lists[] = { &rules.classes, &rules.exes, &rules.titles, &rules.classglobs, &rules.exeglobs, &rules.titleregexes };
+		const std::vector<std::wstring> &strings = m_Backend.Strings();
+		for (std::vector<std::wstring> *list : lists)
+		{
+			std::uint64_t count, number;
+			if (!Read(count))
+			{
+				return false;
+			}
+			for (std::uint64_t i = 0; i < count; i++)
+			{
+				if (!Read(number) || number > strings.size())
+				{
+					return false;
+				}
+				list->push_back(number ? strings[static_cast<std::size_t>(number - 1)] : std::wstring());
+			}
+		}
+		std::atomic_store(&m_Exclusions, std::make_shared<const ExclusionMatcher>(rules, static_cast<unsigned int>(folding)));
+		return true;
+	}
+
+	void Pass(std::uint64_t elapsed, unsigned int reason, std::uint64_t flags)
+	{
+		m_Stats.duration += elapsed;
+		m_Options.dynamicws = (flags & TracePassDynamicWs) != 0;
+		m_Options.dynamicstart = (flags & TracePassDynamicStart) != 0;
+		m_Options.dynamicws_mode = flags & TracePassGeometry ? DynamicWsGeometry : DynamicWsMaximised;
+		if (m_Backend.TakeMonitorsChanged())
+		{
+			m_Controller.RefreshHandles();
+		}
+
+		std::shared_ptr<const DESKTOPSTATE> state = m_Classifier.Classify(reason, m_Stats.duration, m_Options.dynamicws, m_Options.dynamicstart, m_Options.dynamicws_mode);
+		m_Controller.Pass(reason, *state, m_Stats.duration);
+
+		m_Stats.digest = DigestState(m_Stats.digest, *state);
+		m_Stats.passes++;
+	}
+
+	ReplayBackend m_Backend;
+	std::shared_ptr<const ExclusionMatcher> m_Exclusions;
+	OPTIONS m_Options;
+	WindowClassifier m_Classifier;
+	TaskbarController m_Controller;
+	REPLAYSTATS m_Stats;
+	const unsigned char *m_Pos;
+	const unsigned char *m_End;
+};
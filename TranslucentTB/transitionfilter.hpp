@@ -0,0 +1,120 @@
+#pragma once
+#include <cstdint>
+
+#include "windowclassifier.hpp"
+
+enum TRANSITIONEDGE
+{
+	LeadingEdge, // A change shows right away, the ones following it too closely are held back
+	TrailingEdge // A change only shows once nothing changed for the debounce time
+};
+
+struct TRANSITIONOPTIONS
+{
+	std::uint32_t dwell;    // Minimum time a state stays on a taskbar before it can change again (ms)
+	std::uint32_t debounce; // How long the wanted state must stop changing for (ms), 0 to show every change
+	TRANSITIONEDGE edge;
+};
+
+const TRANSITIONOPTIONS DEFAULT_TRANSITIONS = { 0, 200, LeadingEdge };
+const std::uint32_t MAX_TRANSITION_TIME = 10000; // Longest dwell or debounce the config file can set (ms), past it the taskbar looks stuck
+
+struct TRANSITIONSTATS
+{
+	unsigned long long transitions;  // State changes that made it to a taskbar
+	unsigned long long suppressed;   // State changes that were undone or replaced before they could show
+	unsigned long long delayed;      // Transitions that showed later than they were wanted
+	unsigned long long delay_ms;     // Total time those were held back
+	unsigned long long maxdelay_ms;
+};
+
+// Where one taskbar is in its transitions. Zero initialised until the first state shows.
+struct TRANSITION
+{
+	TASKBARSTATE shown;
+	std::uint64_t shown_since;
+	TASKBARSTATE wanted;        // What the latest classification said
+	std::uint64_t wanted_since; // When that last changed
+	bool started;
+};
+
+// Sits between the classification and the taskbar, so a window being dragged, snapped or
+// animated in and out of the maximised state doesn't make the taskbar flicker, and DWM
+// recompose it, with every step.
+class TransitionFilter
+{
+public:
+	// `options` is owned by the caller and may be changed at any time.
+	explicit TransitionFilter(const TRANSITIONOPTIONS &options) : m_Options(options), m_Stats() { }
+
+	// Returns the state the taskbar should show now. When a change is held back, `due` is
+	// lowered to the time it should be looked at again; 0 means no time was set yet.
+	TASKBARSTATE Filter(TRANSITION &transition, TASKBARSTATE wanted, std::uint64_t now, std::uint64_t &due)
+	{
+		if (!transition.started)
+		{
+			transition = { wanted, now, wanted, now, true };
+			return wanted;
+		}
+
+		if (wanted != transition.wanted)
+		{
+			if (transition.wanted != transition.shown)
+			{
+				m_Stats.suppressed++; // Changed again before the previous change could show
+			}
+
+			bool quiet = now - transition.wanted_since >= m_Options.debounce;
+			transition.wanted = wanted;
+			transition.wanted_since = now;
+			if (m_Options.edge == LeadingEdge && quiet && wanted != transition.shown && now - transition.shown_since >= m_Options.dwell)
+			{
+				return Show(transition, now);
+			}
+		}
+
+		if (transition.wanted != transition.shown)
+		{
+			std::uint64_t ready = transition.wanted_since + m_Options.debounce;
+			if (transition.shown_since + m_Options.dwell > ready)
+			{
+				ready = transition.shown_since + m_Options.dwell;
+			}
+
+			if (now >= ready)
+			{
+				return Show(transition, now);
+			}
+			if (!due || ready < due)
+			{
+				due = ready;
+			}
+		}
+		return transition.shown;
+	}
+
+	const TRANSITIONSTATS &Stats() const { return m_Stats; }
+
+private:
+	TASKBARSTATE Show(TRANSITION &transition, std::uint64_t now)
+	{
+		std::uint64_t delay = now - transition.wanted_since;
+		if (delay)
+		{
+			m_Stats.delayed++;
+			m_Stats.delay_ms += delay;
+			if (delay > m_Stats.maxdelay_ms)
+			{
+				m_Stats.maxdelay_ms = delay;
+			}
+		}
+		m_Stats.transitions++;
+
+		transition.shown = transition.wanted;
+		transition.shown_since = now;
+		return transition.shown;
+	}
+
+	const TRANSITIONOPTIONS &m_Options;
+	TRANSITIONSTATS m_Stats;
+};
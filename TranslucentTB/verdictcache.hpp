@@ -0,0 +1,131 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "arena.hpp"
+#include "eventloop.hpp"
+
+struct VERDICTCACHESTATS
+{
+	unsigned long long hits;          // Verdicts reused without fetching anything
+	unsigned long long revalidations; // Renamed windows whose title turned out the same, only the title was fetched
+	unsigned long long misses;        // Verdicts that had to be worked out again
+	unsigned long long evaluation_ns; // Time spent working them out, divide by misses for the average
+};
+
+enum VERDICTLOOKUP
+{
+	VerdictUnknown,     // Never classified, or from another process: classify it
+	VerdictKnown,       // Still valid
+	VerdictTitleChanged // The window was renamed since: fetch the title and compare its hash
+};
+
+// Remembers whether each window is excluded, so a long lived window isn't matched
+// against the rules on every pass. A verdict holds until the window is renamed or
+// destroyed, or its handle shows up owned by another process; the owner of the
+// cache clears it when the rules change.
+class VerdictCache
+{
+public:
+	VerdictCache() : m_Stats() { }
+
+	VERDICTLOOKUP Lookup(WINDOWID window, unsigned long pid, bool &excluded, std::uint64_t &titlehash)
+	{
+		auto it = m_Entries.find(window);
+		if (it == m_Entries.end() || it->second.pid != pid)
+		{
+			return VerdictUnknown; // Counted as a miss by Store
+		}
+
+		excluded = it->second.excluded;
+		titlehash = it->second.titlehash;
+		if (it->second.renamed)
+		{
+			return VerdictTitleChanged;
+		}
+
+		m_Stats.hits++;
+		return VerdictKnown;
+	}
+
+	// The title of a renamed window hashes the same as before, the verdict stands.
+	void Confirm(WINDOWID window)
+	{
+		auto it = m_Entries.find(window);
+		if (it != m_Entries.end())
+		{
+			it->second.renamed = false;
+			m_Stats.revalidations++;
+		}
+	}
+
+	// `cost_ns` is how long working out the verdict took.
+	void Store(WINDOWID window, unsigned long pid, std::uint64_t titlehash, bool excluded, std::uint64_t cost_ns)
+	{
+		m_Entries[window] = { pid, titlehash, excluded, false };
+		m_Stats.misses++;
+		m_Stats.evaluation_ns += cost_ns;
+	}
+
+	void Renamed(WINDOWID window)
+	{
+		auto it = m_Entries.find(window);
+		if (it != m_Entries.end())
+		{
+			it->second.renamed = true;
+		}
+	}
+
+	void Remove(WINDOWID window)
+	{
+		m_Entries.erase(window);
+	}
+
+	// Forgets every window that isn't in `alive`, in case a destroy event was missed.
+	// The lookup table is made in `arena`.
+	void Prune(const std::vector<WINDOWID> &alive, TickArena &arena)
+	{
+		typedef std::unordered_set<WINDOWID, std::hash<WINDOWID>, std::equal_to<WINDOWID>, ArenaAllocator<WINDOWID>> WINDOWSET;
+		WINDOWSET windows(alive.begin(), alive.end(), alive.size(), std::hash<WINDOWID>(), std::equal_to<WINDOWID>(), WINDOWSET::allocator_type(arena));
+		for (auto it = m_Entries.begin(); it != m_Entries.end(); )
+		{
+			it = windows.count(it->first) ? std::next(it) : m_Entries.erase(it);
+		}
+	}
+
+	void Clear()
+	{
+		m_Entries.clear();
+	}
+
+	size_t Size() const { return m_Entries.size(); }
+	const VERDICTCACHESTATS &Stats() const { return m_Stats; }
+
+	// FNV-1a
+	static std::uint64_t HashTitle(const wchar_t *title, size_t length)
+	{
+		std::uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < length; i++)
+		{
+			hash = (hash ^ static_cast<std::uint64_t>(title[i])) * 1099511628211ULL;
+		}
+		return hash;
+	}
+
+private:
+	struct ENTRY
+	{
+		unsigned long pid;
+		std::uint64_t titlehash;
+		bool excluded;
+		bool renamed;
+	};
+
+	std::unordered_map<WINDOWID, ENTRY> m_Entries;
+	VERDICTCACHESTATS m_Stats;
+};
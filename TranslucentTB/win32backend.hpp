@@ -0,0 +1,228 @@
+#pragma once
+#include <windows.h>
+#include <dwmapi.h>
+#include <ShlObj.h>
+#include <Shlwapi.h>
+#include <TlHelp32.h>
+
+#include "backend.hpp"
+
+// The real thing.
+class Win32Backend : public Backend
+{
+public:
+	// desktop_manager may be null, every window is then considered on the current desktop.
+	explicit Win32Backend(IVirtualDesktopManager *desktop_manager) :
+		m_DesktopManager(desktop_manager),
+		m_SetWindowCompositionAttribute(reinterpret_cast<pSetWindowCompositionAttribute>(GetProcAddress(GetModuleHandle(TEXT("user32.dll")), "SetWindowCompositionAttribute")))
+	{ }
+
+	// COM objects can only be called from the apartment that created them, so a backend
+	// used by another thread gets its own desktop manager, created on that thread.
+	void SetDesktopManager(IVirtualDesktopManager *desktop_manager)
+	{
+		m_DesktopManager = desktop_manager;
+	}
+
+	void EnumerateWindows(std::vector<WINDOWID> &windows) override
+	{
+		windows.clear();
+		EnumWindows(&EnumWindowsProcess, reinterpret_cast<LPARAM>(&windows));
+	}
+
+	bool IsWindow(WINDOWID window) override
+	{
+		return ::IsWindow(Hwnd(window)) != FALSE;
+	}
+
+	bool IsWindowMaximised(WINDOWID window) override
+	{
+		WINDOWPLACEMENT result = {};
+		return ::GetWindowPlacement(Hwnd(window), &result) && result.showCmd == SW_MAXIMIZE;
+	}
+
+	bool IsWindowVisible(WINDOWID window) override
+	{
+		return ::IsWindowVisible(Hwnd(window)) != FALSE;
+	}
+
+	std::size_t GetWindowClass(WINDOWID window, wchar_t *buffer, std::size_t size) override
+	{
+		int length = GetClassName(Hwnd(window), buffer, static_cast<int>(size));
+		return length > 0 ? length : Terminate(buffer, size);
+	}
+
+	std::size_t GetWindowTitle(WINDOWID window, wchar_t *buffer, std::size_t size) override
+	{
+		int length = GetWindowText(Hwnd(window), buffer, static_cast<int>(size));
+		return length > 0 ? length : Terminate(buffer, size);
+	}
+
+	unsigned long GetWindowProcessId(WINDOWID window) override
+	{
+		DWORD pid = 0;
+		GetWindowThreadProcessId(Hwnd(window), &pid);
+		return pid;
+	}
+
+	WINDOWID GetForegroundWindow() override
+	{
+		return reinterpret_cast<WINDOWID>(::GetForegroundWindow());
+	}
+
+	bool GetWindowRect(WINDOWID window, WINDOWRECT &rect) override
+	{
+		// Since Windows 10, GetWindowRect includes resize borders that are drawn invisible
+		RECT result;
+		if (FAILED(DwmGetWindowAttribute(Hwnd(window), DWMWA_EXTENDED_FRAME_BOUNDS, &result, sizeof(result))) &&
+			!::GetWindowRect(Hwnd(window), &result))
+		{
+			return false;
+		}
+		rect = Rect(result);
+		return true;
+	}
+
+	MONITORID GetWindowMonitor(WINDOWID window) override
+	{
+		return reinterpret_cast<MONITORID>(MonitorFromWindow(Hwnd(window), MONITOR_DEFAULTTOPRIMARY));
+	}
+
+	void FindTaskbars(std::vector<WINDOWID> &taskbars) override
+	{
+		taskbars.clear();
+		HWND taskbar = FindWindowW(L"Shell_TrayWnd", NULL);
+		if (taskbar)
+		{
+			taskbars.push_back(reinterpret_cast<WINDOWID>(taskbar));
+		}
+
+		HWND secondtaskbar = NULL;
+		while ((secondtaskbar = FindWindowEx(0, secondtaskbar, L"Shell_SecondaryTrayWnd", NULL)) != NULL)
+		{
+			taskbars.push_back(reinterpret_cast<WINDOWID>(secondtaskbar));
+		}
+	}
+
+	bool GetMonitorRects(MONITORID monitor, WINDOWRECT &bounds, WINDOWRECT &work) override
+	{
+		MONITORINFO info = { sizeof(info) };
+		if (!GetMonitorInfo(reinterpret_cast<HMONITOR>(monitor), &info))
+		{
+			return false;
+		}
+		bounds = Rect(info.rcMonitor);
+		work = Rect(info.rcWork);
+		return true;
+	}
+
+	PROCESSREF OpenProcess(unsigned long pid) override
+	{
+		// SYNCHRONIZE lets HasProcessExited wait on the handle
+		return reinterpret_cast<PROCESSREF>(::OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, FALSE, pid));
+	}
+
+	bool HasProcessExited(PROCESSREF process) override
+	{
+		return WaitForSingleObject(reinterpret_cast<HANDLE>(process), 0) != WAIT_TIMEOUT;
+	}
+
+	bool GetProcessExeName(PROCESSREF process, std::wstring &name) override
+	{
+		wchar_t path[MAX_PATH];
+		DWORD size = _countof(path);
+		if (!QueryFullProcessImageNameW(reinterpret_cast<HANDLE>(process), 0, path, &size))
+		{
+			return false;
+		}
+		name = PathFindFileNameW(path);
+		return true;
+	}
+
+	void CloseProcess(PROCESSREF process) override
+	{
+		CloseHandle(reinterpret_cast<HANDLE>(process));
+	}
+
+	bool SnapshotProcesses(std::vector<PROCESSNAME> &processes) override
+	{
+		// Unlike OpenProcess, this also names protected processes and elevated ones
+		// when we aren't elevated ourselves.
+		processes.clear();
+		HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+		if (snapshot == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+
+		PROCESSENTRY32W entry;
+		entry.dwSize = sizeof(entry);
+		for (BOOL more = Process32FirstW(snapshot, &entry); more; more = Process32NextW(snapshot, &entry))
+		{
+			processes.push_back(PROCESSNAME());
+			processes.back().pid = entry.th32ProcessID;
+			wcscpy_s(processes.back().exe, entry.szExeFile);
+		}
+		CloseHandle(snapshot);
+		return !processes.empty();
+	}
+
+	bool IsWindowOnCurrentDesktop(WINDOWID window) override
+	{
+		BOOL on_current_desktop = true;
+		if (m_DesktopManager)
+		{
+			m_DesktopManager->IsWindowOnCurrentVirtualDesktop(Hwnd(window), &on_current_desktop);
+		}
+		return on_current_desktop != FALSE;
+	}
+
+	bool SetAccentPolicy(WINDOWID taskbar, const ACCENTPOLICY &policy) override
+	{
+		if (!m_SetWindowCompositionAttribute)
+		{
+			return false;
+		}
+
+		ACCENTPOLICY copy = policy;
+		WINCOMPATTRDATA data = { 19, &copy, sizeof(ACCENTPOLICY) }; // WCA_ACCENT_POLICY=19
+		return m_SetWindowCompositionAttribute(Hwnd(taskbar), &data) != FALSE;
+	}
+
+private:
+	struct WINCOMPATTRDATA
+	{
+		int nAttribute;
+		PVOID pData;
+		ULONG ulDataSize;
+	};
+	typedef BOOL(WINAPI*pSetWindowCompositionAttribute)(HWND, WINCOMPATTRDATA*);
+
+	static HWND Hwnd(WINDOWID window)
+	{
+		return reinterpret_cast<HWND>(window);
+	}
+
+	static WINDOWRECT Rect(const RECT &rect)
+	{
+		return { static_cast<int>(rect.left), static_cast<int>(rect.top), static_cast<int>(rect.right), static_cast<int>(rect.bottom) };
+	}
+
+	static std::size_t Terminate(wchar_t *buffer, std::size_t size)
+	{
+		if (size > 0)
+		{
+			buffer[0] = L'\0';
+		}
+		return 0;
+	}
+
+	static BOOL CALLBACK EnumWindowsProcess(HWND hWnd, LPARAM lParam)
+	{
+		reinterpret_cast<std::vector<WINDOWID> *>(lParam)->push_back(reinterpret_cast<WINDOWID>(hWnd));
+		return true;
+	}
+
+	IVirtualDesktopManager *m_DesktopManager;
+	pSetWindowCompositionAttribute m_SetWindowCompositionAttribute;
+};
@@ -0,0 +1,225 @@
+#pragma once
+#include <windows.h>
+#include <deque>
+#include <string>
+
+#include "eventloop.hpp"
+
+// Event source for the real desktop. Window events come from out-of-context
+// WinEvent hooks, which Windows delivers through this thread's message queue,
+// so waiting for them is a plain MsgWaitForMultipleObjectsEx: the thread only
+// wakes up when something happened or the scheduler's timeout expired. Explorer
+// writes the current virtual desktop to the registry, the same wait watches it.
+//
+// Location changes are the exception: Windows also raises them for every move of the
+// cursor and the caret, which would wake the thread up on each mouse move only for
+// HookProc to throw them away. Moves and resizes by the user come with their own
+// start and end events, so location changes are only hooked for the process of the
+// foreground window, which is what maximises, restores and snaps. Any other window
+// that moves on its own is caught up with by the next refresh, which doesn't back off
+// past DYNAMIC_WS_MAX_REFRESH_INTERVAL while that matters, see EffectiveScheduling.
+class Win32EventSource : public EventSource
+{
+public:
+	Win32EventSource()
+	{
+		Instance() = this;
+
+		m_Hooks[0] = Hook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND);
+		m_Hooks[1] = Hook(EVENT_SYSTEM_MINIMIZESTART, EVENT_SYSTEM_MINIMIZEEND);
+		m_Hooks[2] = Hook(EVENT_OBJECT_DESTROY, EVENT_OBJECT_HIDE);
+		m_Hooks[3] = Hook(EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE);
+		m_Hooks[4] = Hook(EVENT_OBJECT_CLOAKED, EVENT_OBJECT_UNCLOAKED); // Switching virtual desktops cloaks windows
+		m_Hooks[5] = Hook(EVENT_SYSTEM_MOVESIZESTART, EVENT_SYSTEM_MOVESIZEEND);
+		m_LocationHook = NULL;
+		m_LocationProcess = 0;
+		m_ForegroundProcess = 0;
+		FollowForeground(GetForegroundWindow());
+		HookLocation();
+
+		m_DesktopKey = OpenDesktopKey();
+		m_DesktopSwitched = m_DesktopKey ? CreateEvent(NULL, FALSE, FALSE, NULL) : NULL;
+		WatchDesktop();
+	}
+
+	~Win32EventSource()
+	{
+		for (HWINEVENTHOOK hook : m_Hooks)
+		{
+			if (hook)
+			{
+				UnhookWinEvent(hook);
+			}
+		}
+		if (m_LocationHook)
+		{
+			UnhookWinEvent(m_LocationHook);
+		}
+		if (m_DesktopKey)
+		{
+			RegCloseKey(m_DesktopKey);
+		}
+		if (m_DesktopSwitched)
+		{
+			CloseHandle(m_DesktopSwitched);
+		}
+		Instance() = nullptr;
+	}
+
+	// Queue an event from this thread, for example from a window procedure.
+	void Push(EVENTTYPE type, WINDOWID window = 0)
+	{
+		// Moving a window fires a flood of identical events, only keep one.
+		if (!m_Queue.empty() && m_Queue.back().type == type && m_Queue.back().window == window)
+		{
+			return;
+		}
+		m_Queue.push_back({ type, window });
+	}
+
+	std::uint64_t Now() override
+	{
+		return GetTickCount64();
+	}
+
+	bool WaitForEvent(std::uint32_t timeout, EVENT &ev) override
+	{
+		std::uint64_t deadline = Now() + timeout;
+
+		for (;;)
+		{
+			// Dispatching is also what runs the WinEvent callbacks.
+			MSG msg;
+			while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+			{
+				if (msg.message == WM_QUIT)
+				{
+					ev = { QuitRequested, 0 };
+					return true;
+				}
+				TranslateMessage(&msg);
+				DispatchMessage(&msg);
+			}
+			HookLocation(); // Not from HookProc, which may run for the hook being replaced
+
+			if (m_DesktopSwitched && WaitForSingleObject(m_DesktopSwitched, 0) == WAIT_OBJECT_0)
+			{
+				WatchDesktop(); // Notifications are one shot
+				Push(DesktopSwitched);
+			}
+
+			if (!m_Queue.empty())
+			{
+				ev = m_Queue.front();
+				m_Queue.pop_front();
+				return true;
+			}
+
+			std::uint64_t now = Now();
+			if (now >= deadline)
+			{
+				return false;
+			}
+			MsgWaitForMultipleObjectsEx(m_DesktopSwitched ? 1 : 0, &m_DesktopSwitched, static_cast<DWORD>(deadline - now), QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+		}
+	}
+
+private:
+	static Win32EventSource *&Instance()
+	{
+		static Win32EventSource *instance = nullptr;
+		return instance;
+	}
+
+	static HWINEVENTHOOK Hook(DWORD min, DWORD max, DWORD process = 0)
+	{
+		return SetWinEventHook(min, max, NULL, HookProc, process, 0, WINEVENT_OUTOFCONTEXT | WINEVENT_SKIPOWNPROCESS);
+	}
+
+	void FollowForeground(HWND hWnd)
+	{
+		DWORD process = 0;
+		if (hWnd && GetWindowThreadProcessId(hWnd, &process))
+		{
+			m_ForegroundProcess = process;
+		}
+	}
+
+	// Moves the location change hook to the process of the foreground window, if that changed.
+	void HookLocation()
+	{
+		if (m_ForegroundProcess == m_LocationProcess)
+		{
+			return;
+		}
+		if (m_LocationHook)
+		{
+			UnhookWinEvent(m_LocationHook);
+		}
+		m_LocationHook = Hook(EVENT_OBJECT_LOCATIONCHANGE, EVENT_OBJECT_LOCATIONCHANGE, m_ForegroundProcess);
+		m_LocationProcess = m_ForegroundProcess;
+	}
+
+	// Where Explorer keeps CurrentVirtualDesktop: per session on Windows 10, directly
+	// under Explorer on later versions. Null if neither exists, cloak events are then
+	// the only sign of a desktop switch.
+	static HKEY OpenDesktopKey()
+	{
+		DWORD session = 0;
+		ProcessIdToSessionId(GetCurrentProcessId(), &session);
+		std::wstring path = L"Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\SessionInfo\\" + std::to_wstring(session) + L"\\VirtualDesktops";
+
+		HKEY key = NULL;
+		if (RegOpenKeyEx(HKEY_CURRENT_USER, path.c_str(), 0, KEY_NOTIFY, &key) != ERROR_SUCCESS &&
+			RegOpenKeyEx(HKEY_CURRENT_USER, L"Software\\Microsoft\\Windows\\CurrentVersion\\Explorer\\VirtualDesktops", 0, KEY_NOTIFY, &key) != ERROR_SUCCESS)
+		{
+			return NULL;
+		}
+		return key;
+	}
+
+	void WatchDesktop()
+	{
+		if (m_DesktopSwitched)
+		{
+			RegNotifyChangeKeyValue(m_DesktopKey, FALSE, REG_NOTIFY_CHANGE_LAST_SET, m_DesktopSwitched, TRUE);
+		}
+	}
+
+	static void CALLBACK HookProc(HWINEVENTHOOK, DWORD event, HWND hWnd, LONG idObject, LONG idChild, DWORD, DWORD)
+	{
+		Win32EventSource *source = Instance();
+
+		// We only care about windows themselves, not the cursor, caret, scrollbars, etc.
+		if (!source || !hWnd || idObject != OBJID_WINDOW || idChild != CHILDID_SELF)
+		{
+			return;
+		}
+
+		WINDOWID window = reinterpret_cast<WINDOWID>(hWnd);
+		if (event == EVENT_SYSTEM_FOREGROUND)
+		{
+			source->FollowForeground(hWnd);
+			source->Push(ForegroundChanged, window);
+		}
+		else if (event == EVENT_OBJECT_DESTROY)
+		{
+			source->Push(WindowDestroyed, window);
+		}
+		else if (GetAncestor(hWnd, GA_ROOT) == hWnd) // Only top level windows can be maximised
+		{
+			source->Push(
+				event == EVENT_OBJECT_NAMECHANGE ? WindowRenamed :
+				event == EVENT_OBJECT_CLOAKED || event == EVENT_OBJECT_UNCLOAKED ? WindowCloaked :
+				WindowChanged, window);
+		}
+	}
+
+	HWINEVENTHOOK m_Hooks[6];
+	HWINEVENTHOOK m_LocationHook;  // Only for m_LocationProcess, see the class comment
+	DWORD m_LocationProcess;
+	DWORD m_ForegroundProcess;     // Where m_LocationHook should be
+	HKEY m_DesktopKey;
+	HANDLE m_DesktopSwitched; // Signalled by the registry when the current desktop changes
+	std::deque<EVENT> m_Queue;
+};
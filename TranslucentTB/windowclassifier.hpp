@@ -0,0 +1,631 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cwchar>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "backend.hpp"
+#include "decisiontrace.hpp"
+#include "desktopcache.hpp"
+#include "eventloop.hpp"
+#include "exclusionmatcher.hpp"
+#include "fullscreentracker.hpp"
+#include "geometryindex.hpp"
+#include "maximisedindex.hpp"
+#include "metrics.hpp"
+#include "processcache.hpp"
+#include "qualifypipeline.hpp"
+#include "startmenutracker.hpp"
+#include "tracerecorder.hpp"
+#include "verdictcache.hpp"
+
+const std::size_t MAX_WINDOW_STRING = 260; // Longest class name or title we look at (MAX_PATH)
+
+const std::size_t MAX_RECYCLED_STATES = 4; // The worker's latest state, the one being applied, and a spare
+
+const std::uint64_t CONSISTENCY_INTERVAL = 10000; // Run a full enumeration at least this often (ms), in case an event was missed
+
+enum TASKBARSTATE { Normal, WindowMaximised, StartMenuOpen }; // Create a state to store all
+															  // states of the Taskbar
+			// Normal           | Proceed as normal. If no dynamic options are set, act as it says in opt.taskbar_appearance
+			// WindowMaximised  | There is a window which is maximised on the monitor this HWND is in. Display as blurred.
+			// StartMenuOpen    | The Start Menu is open on the monitor this HWND is in. Display as it would be without TranslucentTB active.
+
+enum DYNAMICWSMODE
+{
+	DynamicWsMaximised, // A taskbar changes when a window on its monitor is maximised
+	DynamicWsGeometry   // A taskbar changes when a window on its monitor touches it, however it got there
+};
+
+// Parts of the shell that touch the taskbar without covering the desktop.
+const wchar_t *const SHELL_WINDOW_CLASSES[] = {
+	L"Shell_TrayWnd", L"Shell_SecondaryTrayWnd", L"Progman", L"WorkerW", L"TaskListThumbnailWnd", L"NotifyIconOverflowWindow"
+};
+
+struct MONITORSTATE
+{
+	MONITORID monitor;
+	TASKBARSTATE state;
+};
+
+// What the taskbar of every monitor should show. Never modified while anyone but the
+// classifier holds it, so it can be handed from the thread that classifies windows to
+// the one that owns the taskbars; the classifier reuses it once everyone let go.
+struct DESKTOPSTATE
+{
+	std::vector<MONITORSTATE> monitors;       // Monitors that aren't listed are Normal
+	std::vector<FULLSCREENWINDOW> fullscreen; // Monitors a fullscreen window covers, their taskbars are hidden
+	std::uint64_t sequence;                   // Increases with every classification
+
+	TASKBARSTATE StateOf(MONITORID monitor) const
+	{
+		for (const MONITORSTATE &entry : monitors)
+		{
+			if (entry.monitor == monitor)
+			{
+				return entry.state;
+			}
+		}
+		return Normal;
+	}
+
+	bool IsCovered(MONITORID monitor) const
+	{
+		for (const FULLSCREENWINDOW &entry : fullscreen)
+		{
+			if (entry.monitor == monitor)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+// Works out which monitors have a maximised window or the Start menu on them. This is
+// where all the window enumeration and querying happens, so it can be slowed down by a
+// hung window or a slow process; it only produces a DESKTOPSTATE and never touches a
+// taskbar, so it can run on its own thread (classificationworker.hpp).
+class WindowClassifier
+{
+public:
+	// `exclusions` is owned by the caller, and only accessed through std::atomic_load.
+	WindowClassifier(Backend &backend, const std::shared_ptr<const ExclusionMatcher> &exclusions) :
+		m_Backend(backend),
+		m_Exclusions(exclusions),
+		m_ProcessCache(backend),
+		m_Recorder(nullptr),
+		m_Metrics(nullptr),
+		m_Decisions(nullptr),
+		m_MonitorGeometry(0, std::hash<MONITORID>(), std::equal_to<MONITORID>(), GEOMETRYMAP::allocator_type(m_Pool)),
+		m_ShellWindows(0, std::hash<WINDOWID>(), std::equal_to<WINDOWID>(), SHELLMAP::allocator_type(m_Pool)),
+		m_Mode(DynamicWsMaximised),
+		m_StartMenu(backend),
+		m_Fullscreen(backend),
+		m_Desktops(backend),
+		m_MaximisedChecks({ StageMaximised, StageVisible, StageDesktop, StageExcluded }),
+		m_GeometryChecks({ StageVisible, StageDesktop, StagePlaced, StageShell, StageExcluded }),
+		m_LastFullEnumeration(0),
+		m_LastStartResync(0),
+		m_LastFullscreenResync(0),
+		m_Sequence(0)
+	{ }
+
+	// Sees every event as it arrives. Windows are only marked here, and checked once
+	// per pass, so a window sending hundreds of events while it is dragged costs one check.
+	void OnEvent(const EVENT &ev)
+	{
+		if (m_Recorder)
+		{
+			m_Recorder->RecordEvent(ev);
+		}
+		m_StartMenu.OnEvent(ev);
+		m_Fullscreen.OnEvent(ev);
+		m_Desktops.OnEvent(ev);
+
+		if (ev.type == WindowDestroyed)
+		{
+			m_MaximisedWindows.Remove(ev.window);
+			m_WindowGeometry.Remove(ev.window);
+			m_ShellWindows.erase(ev.window);
+			m_Verdicts.Remove(ev.window);
+		}
+		else if ((ev.type == WindowChanged || ev.type == WindowRenamed || ev.type == WindowCloaked || ev.type == ForegroundChanged) && ev.window)
+		{
+			if (ev.type == WindowRenamed)
+			{
+				m_Verdicts.Renamed(ev.window);
+			}
+			if (m_DirtyWindows.empty() || m_DirtyWindows.back() != ev.window) // A dragged window sends a flood of these
+			{
+				if (m_DirtyWindows.size() == m_DirtyWindows.capacity())
+				{
+					Deduplicate(m_DirtyWindows); // Rather than growing, it is sized for every window once
+				}
+				m_DirtyWindows.push_back(ev.window);
+			}
+		}
+	}
+
+	// `reason` is a combination of PASSREASON flags, `now` the time in milliseconds.
+	std::shared_ptr<DESKTOPSTATE> Classify(unsigned int reason, std::uint64_t now, bool dynamicws, bool dynamicstart, DYNAMICWSMODE mode = DynamicWsMaximised)
+	{
+		if (mode != m_Mode)
+		{
+			reason |= PassSettings; // The other index wasn't kept up to date
+			m_Mode = mode;
+		}
+		if (!dynamicws && (reason & (PassMonitors | PassSettings)))
+		{
+			m_MonitorGeometry.clear(); // No full enumeration is going to do it
+		}
+		m_ProcessCache.BeginPass(now);
+		if (reason & PassRefresh)
+		{
+			m_ProcessCache.Sweep(); // Forget processes that exited
+		}
+
+		if (m_Decisions)
+		{
+			m_Decisions->Emit(DecisionPassBegin, 0, reason);
+		}
+		std::shared_ptr<DESKTOPSTATE> state = RecycleState();
+		state->sequence = ++m_Sequence;
+
+		UpdateWindows(reason, now, dynamicws);
+		if (m_Mode == DynamicWsGeometry)
+		{
+			ArenaVector<MONITORID> monitors((ArenaAllocator<MONITORID>(m_Arena)));
+			m_WindowGeometry.Monitors(monitors);
+			for (MONITORID monitor : monitors)
+			{
+				const MONITORGEOMETRY *geometry = Geometry(monitor);
+				if (geometry && m_WindowGeometry.TouchesTaskbar(monitor, *geometry))
+				{
+					state->monitors.push_back({ monitor, WindowMaximised });
+				}
+			}
+		}
+		else
+		{
+			ArenaVector<MONITORID> monitors((ArenaAllocator<MONITORID>(m_Arena)));
+			m_MaximisedWindows.Monitors(monitors);
+			for (MONITORID monitor : monitors)
+			{
+				state->monitors.push_back({ monitor, WindowMaximised });
+			}
+		}
+
+		// Tracked on its own, so the other taskbars keep showing their maximised windows
+		// and this one goes back to them once the Start menu closes.
+		MONITORID startmonitor = 0;
+		if (dynamicstart && IsStartMenuOpen(reason, now, startmonitor))
+		{
+			auto it = state->monitors.begin();
+			while (it != state->monitors.end() && it->monitor != startmonitor)
+			{
+				++it;
+			}
+			if (it != state->monitors.end())
+			{
+				it->state = StartMenuOpen;
+			}
+			else
+			{
+				state->monitors.push_back({ startmonitor, StartMenuOpen });
+			}
+		}
+
+		const std::vector<FULLSCREENWINDOW> &covering = FullscreenWindows(reason, now);
+		state->fullscreen.assign(covering.begin(), covering.end());
+
+		if (m_Recorder)
+		{
+			m_Recorder->RecordPass(reason, now, dynamicws, dynamicstart, m_Mode == DynamicWsGeometry);
+		}
+		m_Arena.Reset(); // Whatever the pass made in there is gone by now
+		if (m_Decisions)
+		{
+			m_Decisions->Emit(DecisionPassEnd, 0, static_cast<std::uint32_t>(state->monitors.size()));
+		}
+		return state;
+	}
+
+	// Whether a window should make the taskbar of its monitor switch to dynamicws_state.
+	bool WindowQualifies(WINDOWID window, MONITORID &monitor)
+	{
+		WINDOWPLACE place;
+		if (!Decide(window, m_MaximisedChecks, m_MaximisedChecks.Evaluate([&](QUALIFYSTAGE stage, bool &cached) { return Check(stage, window, place, cached); })))
+		{
+			return false;
+		}
+
+		monitor = m_Backend.GetWindowMonitor(window);
+		return true;
+	}
+
+	// Same, for DynamicWsGeometry: whether a window could cover the taskbar of its monitor,
+	// the index works out whether it does.
+	bool WindowQualifies(WINDOWID window, WINDOWPLACE &place)
+	{
+		return Decide(window, m_GeometryChecks, m_GeometryChecks.Evaluate([&](QUALIFYSTAGE stage, bool &cached) { return Check(stage, window, place, cached); }));
+	}
+
+	bool IsExcluded(WINDOWID window)
+	{
+		std::shared_ptr<const ExclusionMatcher> matcher = std::atomic_load(&m_Exclusions);
+		if (matcher != m_VerdictRules)
+		{
+			m_Verdicts.Clear(); // Made with the old rules
+			m_VerdictRules = matcher;
+			if (m_Recorder)
+			{
+				m_Recorder->RecordRules(matcher ? matcher->Rules() : EXCLUSIONRULES(), matcher ? matcher->Folding() : 0);
+			}
+		}
+		if (!matcher)
+		{
+			return false;
+		}
+
+		unsigned long pid = m_Backend.GetWindowProcessId(window);
+		bool excluded = false;
+		std::uint64_t titlehash = 0;
+		VERDICTLOOKUP lookup = m_Verdicts.Lookup(window, pid, excluded, titlehash);
+		if (lookup == VerdictKnown)
+		{
+			return excluded;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		wchar_t windowTitle[MAX_WINDOW_STRING];
+		std::size_t length = 0;
+		if (matcher->HasTitleRules())
+		{
+			length = m_Backend.GetWindowTitle(window, windowTitle, MAX_WINDOW_STRING);
+		}
+
+		std::uint64_t newhash = VerdictCache::HashTitle(windowTitle, length);
+		if (lookup == VerdictTitleChanged && newhash == titlehash)
+		{
+			m_Verdicts.Confirm(window); // Renamed to the same thing, or no rule looks at titles
+			return excluded;
+		}
+
+		excluded = Evaluate(window, pid, *matcher, windowTitle, length);
+		auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		m_Verdicts.Store(window, pid, newhash, excluded, static_cast<std::uint64_t>(cost));
+		if (m_Metrics)
+		{
+			m_Metrics->Record(MetricExclusionTime, static_cast<unsigned long long>(cost));
+		}
+		return excluded;
+	}
+
+	const PROCESSCACHESTATS &ProcessCacheStats() const { return m_ProcessCache.Stats(); }
+	const MAXIMISEDINDEXSTATS &MaximisedWindowStats() const { return m_MaximisedWindows.Stats(); }
+	const GEOMETRYINDEXSTATS &WindowGeometryStats() const { return m_WindowGeometry.Stats(); }
+	const STARTMENUSTATS &StartMenuStats() const { return m_StartMenu.Stats(); }
+	const FULLSCREENSTATS &FullscreenStats() const { return m_Fullscreen.Stats(); }
+	const DESKTOPCACHESTATS &DesktopCacheStats() const { return m_Desktops.Stats(); }
+	const QualifyPipeline &QualifyChecks(DYNAMICWSMODE mode) const { return mode == DynamicWsGeometry ? m_GeometryChecks : m_MaximisedChecks; }
+	ARENASTATS ArenaStats() const { return m_Arena.Stats(); }
+	const VERDICTCACHESTATS &VerdictCacheStats() const { return m_Verdicts.Stats(); }
+
+	// Writes down every event, rules change and pass. `recorder` must also be the backend
+	// this classifier was made with, so it sees what the passes asked.
+	void SetRecorder(TraceRecorder *recorder) { m_Recorder = recorder; }
+
+	// Counts enumerations, the windows passes look at and how long exclusion rules take.
+	void SetMetrics(MetricsRegistry *metrics) { m_Metrics = metrics; }
+
+	// Writes down every pass, and every window it qualifies or rejects, and why.
+	void SetDecisionTrace(DecisionTrace *decisions) { m_Decisions = decisions; }
+
+private:
+	typedef std::unordered_map<MONITORID, MONITORGEOMETRY, std::hash<MONITORID>, std::equal_to<MONITORID>, PoolAllocator<std::pair<const MONITORID, MONITORGEOMETRY>>> GEOMETRYMAP;
+	typedef std::unordered_map<WINDOWID, bool, std::hash<WINDOWID>, std::equal_to<WINDOWID>, PoolAllocator<std::pair<const WINDOWID, bool>>> SHELLMAP;
+
+	// One step of WindowQualifies, in whatever order the pipeline picked. Sets `cached`
+	// when a cache answered instead of the backend.
+	bool Check(QUALIFYSTAGE stage, WINDOWID window, WINDOWPLACE &place, bool &cached)
+	{
+		switch (stage)
+		{
+		case StageMaximised:
+			return m_Backend.IsWindowMaximised(window);
+		case StageVisible:
+			return m_Backend.IsWindowVisible(window);
+		case StageDesktop:
+		{
+			unsigned long long queries = m_Desktops.Stats().queries;
+			bool member = m_Desktops.IsOnCurrentDesktop(window);
+			cached = m_Desktops.Stats().queries == queries;
+			return member;
+		}
+		case StagePlaced:
+		{
+			if (!m_Backend.GetWindowRect(window, place.rect))
+			{
+				return false;
+			}
+			place.monitor = m_Backend.GetWindowMonitor(window);
+			const MONITORGEOMETRY *geometry = Geometry(place.monitor);
+			return geometry && Intersects(place.rect, geometry->bounds); // Minimised windows are far off screen
+		}
+		case StageShell:
+			cached = m_ShellWindows.count(window) != 0;
+			return !IsShellWindow(window);
+		default:
+		{
+			unsigned long long misses = m_Verdicts.Stats().misses + m_Verdicts.Stats().revalidations;
+			bool excluded = IsExcluded(window);
+			cached = m_Verdicts.Stats().misses + m_Verdicts.Stats().revalidations == misses;
+			return !excluded;
+		}
+		}
+	}
+
+	// Runs the rules against a window. `title` has already been fetched if a rule needs it.
+	bool Evaluate(WINDOWID window, unsigned long pid, const ExclusionMatcher &matcher, const wchar_t *title, std::size_t length)
+	{
+		// Only fetch the attributes some rule looks at, cheapest first
+		if (matcher.HasClassRules())
+		{
+			wchar_t className[MAX_WINDOW_STRING];
+			std::size_t classlength = m_Backend.GetWindowClass(window, className, MAX_WINDOW_STRING);
+			m_ClassName.assign(className, classlength);
+			if (matcher.MatchesClass(m_ClassName)) { return true; }
+		}
+
+		if (matcher.HasTitleRules() && matcher.MatchesTitle(title, length)) { return true; }
+
+		if (matcher.HasExeRules())
+		{
+			if (m_ProcessCache.GetExeName(pid, m_ExeName) && matcher.MatchesExe(m_ExeName)) { return true; }
+		}
+
+		return false;
+	}
+
+	void UpdateWindows(unsigned int reason, std::uint64_t now, bool dynamicws)
+	{
+		if (!dynamicws)
+		{
+			m_MaximisedWindows.Clear();
+			m_WindowGeometry.Clear();
+			m_DirtyWindows.clear();
+			return;
+		}
+
+		if ((reason & (PassMonitors | PassSettings)) || now - m_LastFullEnumeration >= CONSISTENCY_INTERVAL)
+		{
+			// Every window might have changed monitor, the taskbar might have moved, or the
+			// options changed: start from scratch.
+			m_MonitorGeometry.clear();
+			if (reason & PassSettings)
+			{
+				m_Desktops.Clear(); // Cheap next to what the user just did, and catches anything missed
+			}
+			std::vector<WINDOWID> &windows = m_Enumerated;
+			m_Backend.EnumerateWindows(windows);
+			m_DirtyWindows.reserve(windows.size());
+			if (m_Mode == DynamicWsGeometry)
+			{
+				ArenaVector<std::pair<WINDOWID, WINDOWPLACE>> qualifying((ArenaAllocator<std::pair<WINDOWID, WINDOWPLACE>>(m_Arena)));
+				qualifying.reserve(windows.size());
+				for (WINDOWID window : windows)
+				{
+					WINDOWPLACE place;
+					if (WindowQualifies(window, place))
+					{
+						qualifying.push_back(std::make_pair(window, place));
+					}
+				}
+				m_WindowGeometry.Reserve(windows.size());
+				m_WindowGeometry.Reconcile(qualifying);
+				m_MaximisedWindows.Clear();
+				CountWindows(windows.size(), qualifying.size());
+			}
+			else
+			{
+				ArenaVector<std::pair<WINDOWID, MONITORID>> qualifying((ArenaAllocator<std::pair<WINDOWID, MONITORID>>(m_Arena)));
+				qualifying.reserve(windows.size());
+				for (WINDOWID window : windows)
+				{
+					MONITORID monitor;
+					if (WindowQualifies(window, monitor))
+					{
+						qualifying.push_back(std::make_pair(window, monitor));
+					}
+				}
+				m_MaximisedWindows.Reserve(windows.size());
+				m_MaximisedWindows.Reconcile(qualifying);
+				m_WindowGeometry.Clear();
+				CountWindows(windows.size(), qualifying.size());
+			}
+			m_Verdicts.Prune(windows, m_Arena);
+			if (m_ShellWindows.size() > windows.size())
+			{
+				m_ShellWindows.clear(); // Some destroyed windows were missed
+			}
+			m_Desktops.Trim(windows.size());
+			m_LastFullEnumeration = now;
+			if (m_Metrics)
+			{
+				m_Metrics->Add(MetricEnumerations);
+			}
+		}
+		else if (m_Mode == DynamicWsGeometry)
+		{
+			Deduplicate(m_DirtyWindows);
+			std::size_t qualified = 0;
+			for (WINDOWID window : m_DirtyWindows)
+			{
+				WINDOWPLACE place = {};
+				bool qualifies = m_Backend.IsWindow(window) && WindowQualifies(window, place);
+				m_WindowGeometry.Update(window, qualifies, place);
+				qualified += qualifies;
+			}
+			CountWindows(m_DirtyWindows.size(), qualified);
+		}
+		else
+		{
+			Deduplicate(m_DirtyWindows);
+			std::size_t qualified = 0;
+			for (WINDOWID window : m_DirtyWindows)
+			{
+				MONITORID monitor = 0;
+				bool qualifies = m_Backend.IsWindow(window) && WindowQualifies(window, monitor);
+				m_MaximisedWindows.Update(window, qualifies, monitor);
+				qualified += qualifies;
+			}
+			CountWindows(m_DirtyWindows.size(), qualified);
+		}
+		m_DirtyWindows.clear();
+	}
+
+	// Passes on what `checks` made of `window`.
+	bool Decide(WINDOWID window, const QualifyPipeline &checks, bool qualifies)
+	{
+		if (m_Decisions)
+		{
+			m_Decisions->Emit(qualifies ? DecisionQualified : DecisionRejected, window, checks.LastRejection());
+		}
+		return qualifies;
+	}
+
+	void CountWindows(std::size_t visited, std::size_t qualified)
+	{
+		if (m_Metrics)
+		{
+			m_Metrics->Add(MetricWindowsVisited, visited);
+			m_Metrics->Add(MetricWindowsQualified, qualified);
+		}
+	}
+
+	static void Deduplicate(std::vector<WINDOWID> &windows)
+	{
+		std::sort(windows.begin(), windows.end());
+		windows.erase(std::unique(windows.begin(), windows.end()), windows.end());
+	}
+
+	// A state nobody else holds any more is cleared and reused, rather than a new one
+	// allocated for every pass.
+	std::shared_ptr<DESKTOPSTATE> RecycleState()
+	{
+		for (std::shared_ptr<DESKTOPSTATE> &state : m_States)
+		{
+			if (state.use_count() == 1)
+			{
+				std::atomic_thread_fence(std::memory_order_acquire); // Whoever let go of it is done reading
+				state->monitors.clear();
+				state->fullscreen.clear();
+				return state;
+			}
+		}
+
+		std::shared_ptr<DESKTOPSTATE> state = std::make_shared<DESKTOPSTATE>();
+		if (m_States.size() < MAX_RECYCLED_STATES)
+		{
+			m_States.push_back(state);
+		}
+		return state;
+	}
+
+	// Cached until the next full enumeration, which the monitors or the taskbar moving causes.
+	const MONITORGEOMETRY *Geometry(MONITORID monitor)
+	{
+		auto it = m_MonitorGeometry.find(monitor);
+		if (it == m_MonitorGeometry.end())
+		{
+			MONITORGEOMETRY geometry;
+			if (!m_Backend.GetMonitorRects(monitor, geometry.bounds, geometry.work))
+			{
+				return nullptr;
+			}
+			it = m_MonitorGeometry.emplace(monitor, geometry).first;
+		}
+		return &it->second;
+	}
+
+	// A window's class never changes, so this is only asked once per window.
+	bool IsShellWindow(WINDOWID window)
+	{
+		auto it = m_ShellWindows.find(window);
+		if (it != m_ShellWindows.end())
+		{
+			return it->second;
+		}
+
+		wchar_t className[MAX_WINDOW_STRING];
+		m_Backend.GetWindowClass(window, className, MAX_WINDOW_STRING);
+		bool shell = false;
+		for (const wchar_t *shellclass : SHELL_WINDOW_CLASSES)
+		{
+			shell = shell || !std::wcscmp(className, shellclass);
+		}
+		m_ShellWindows.emplace(window, shell);
+		return shell;
+	}
+
+	bool IsStartMenuOpen(unsigned int reason, std::uint64_t now, MONITORID &monitor)
+	{
+		bool resync = (reason & (PassMonitors | PassSettings)) || now - m_LastStartResync >= CONSISTENCY_INTERVAL;
+		if (resync)
+		{
+			m_LastStartResync = now;
+		}
+		return m_StartMenu.Update(resync, monitor);
+	}
+
+	const std::vector<FULLSCREENWINDOW> &FullscreenWindows(unsigned int reason, std::uint64_t now)
+	{
+		bool resync = (reason & (PassMonitors | PassSettings)) || now - m_LastFullscreenResync >= CONSISTENCY_INTERVAL;
+		if (resync)
+		{
+			m_LastFullscreenResync = now;
+		}
+		return m_Fullscreen.Update(resync,
+			[this](MONITORID monitor) { return Geometry(monitor); },
+			[this](WINDOWID window) { return !IsShellWindow(window) && m_Desktops.IsOnCurrentDesktop(window); });
+	}
+
+	Backend &m_Backend;
+	const std::shared_ptr<const ExclusionMatcher> &m_Exclusions;
+	ProcessNameCache m_ProcessCache;
+	TraceRecorder *m_Recorder;
+	MetricsRegistry *m_Metrics;
+	DecisionTrace *m_Decisions;
+	MaximisedWindowIndex m_MaximisedWindows;
+	WindowGeometryIndex m_WindowGeometry;
+	NodePool m_Pool; // Before the maps, which give their nodes back when destroyed
+	GEOMETRYMAP m_MonitorGeometry; // Emptied by every full enumeration
+	SHELLMAP m_ShellWindows;
+	DYNAMICWSMODE m_Mode;
+	StartMenuTracker m_StartMenu;
+	FullscreenTracker m_Fullscreen;
+	DesktopMembershipCache m_Desktops;
+	QualifyPipeline m_MaximisedChecks;
+	QualifyPipeline m_GeometryChecks;
+	VerdictCache m_Verdicts;
+	std::shared_ptr<const ExclusionMatcher> m_VerdictRules; // What m_Verdicts was filled with, keeps it alive so its address isn't reused
+	std::vector<WINDOWID> m_DirtyWindows; // Windows that changed since the last pass, possibly more than once
+	std::vector<WINDOWID> m_Enumerated;   // Every window, as of the last full enumeration
+	std::vector<std::shared_ptr<DESKTOPSTATE>> m_States; // Handed out before, reused once nobody holds them
+	std::wstring m_ClassName; // Scratch space for matching, so its buffer is reused
+	std::wstring m_ExeName;
+	TickArena m_Arena; // Reset at the end of every pass
+	std::uint64_t m_LastFullEnumeration;
+	std::uint64_t m_LastStartResync;
+	std::uint64_t m_LastFullscreenResync;
+	std::uint64_t m_Sequence;
+};